@@ -0,0 +1,186 @@
+// Include header file
+#include "arena.h"
+
+
+static size_t alignSize(size_t bytes) {
+  return (bytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+
+static char *blockData(arena_block_t *block) {
+  return (char *) block + block->offset;
+}
+
+
+// Find where the data of a block at this address would be aligned
+static size_t dataOffset(arena_block_t *block) {
+  uintptr_t start = (uintptr_t) block + sizeof(arena_block_t);
+  return alignSize(start) - (uintptr_t) block;
+}
+
+
+static arena_block_t *newBlock(arena_t *arena, size_t size) {
+
+  arena_block_t *block = malloc(sizeof(arena_block_t) + ARENA_ALIGNMENT +
+                                size);
+  if (block == NULL) {
+    return NULL;
+  }
+
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  block->offset = dataOffset(block);
+
+  arena->reserved += size;
+  if (arena->reserved > arena->peakReserved) {
+    arena->peakReserved = arena->reserved;
+  }
+
+  return block;
+}
+
+
+void arenaInit(arena_t *arena, size_t blockSize) {
+  arena->blocks = NULL;
+  arena->large = NULL;
+  arena->blockSize = alignSize(blockSize);
+  arena->allocated = 0;
+  arena->reserved = 0;
+  arena->peakReserved = 0;
+}
+
+
+void *arenaAlloc(arena_t *arena, size_t bytes) {
+
+  bytes = alignSize(bytes);
+
+  // Large allocations would waste most of a shared block
+  if (bytes > arena->blockSize / 4) {
+    arena_block_t *block = newBlock(arena, bytes);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->used = bytes;
+    block->next = arena->large;
+    arena->large = block;
+    arena->allocated += bytes;
+    return blockData(block);
+  }
+
+  arena_block_t *block = arena->blocks;
+  if (block == NULL || block->used + bytes > block->size) {
+    block = newBlock(arena, arena->blockSize);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena->blocks;
+    arena->blocks = block;
+  }
+
+  void *pointer = blockData(block) + block->used;
+  block->used += bytes;
+  arena->allocated += bytes;
+
+  return pointer;
+}
+
+
+void *arenaGrow(arena_t *arena, void *pointer, size_t oldBytes,
+                size_t newBytes) {
+
+  if (pointer == NULL) {
+    return arenaAlloc(arena, newBytes);
+  }
+
+  oldBytes = alignSize(oldBytes);
+  newBytes = alignSize(newBytes);
+  if (newBytes <= oldBytes) {
+    return pointer;
+  }
+
+  // Dedicated blocks are resized like any heap block
+  arena_block_t **link = &arena->large;
+  for (arena_block_t *block = arena->large; block != NULL;
+       block = block->next) {
+
+    if (blockData(block) == pointer) {
+      size_t oldOffset = block->offset;
+      size_t oldSize = block->size;
+      block = realloc(block, sizeof(arena_block_t) + ARENA_ALIGNMENT +
+                             newBytes);
+      if (block == NULL) {
+        return NULL;
+      }
+
+      // The new address may need the data moving to stay aligned
+      block->offset = dataOffset(block);
+      if (block->offset != oldOffset) {
+        memmove((char *) block + block->offset, (char *) block + oldOffset,
+                oldBytes);
+      }
+      block->size = newBytes;
+      block->used = newBytes;
+      *link = block;
+
+      arena->allocated += newBytes - oldBytes;
+      arena->reserved += newBytes - oldSize;
+      if (arena->reserved > arena->peakReserved) {
+        arena->peakReserved = arena->reserved;
+      }
+      return blockData(block);
+    }
+    link = &block->next;
+  }
+
+  // The latest small allocation can grow in to the rest of its block
+  arena_block_t *block = arena->blocks;
+  if (block != NULL && (char *) pointer + oldBytes ==
+                       blockData(block) + block->used &&
+      block->used - oldBytes + newBytes <= block->size) {
+    block->used += newBytes - oldBytes;
+    arena->allocated += newBytes - oldBytes;
+    return pointer;
+  }
+
+  void *grown = arenaAlloc(arena, newBytes);
+  if (grown != NULL) {
+    memcpy(grown, pointer, oldBytes);
+  }
+
+  return grown;
+}
+
+
+void arenaReset(arena_t *arena) {
+
+  while (arena->large != NULL) {
+    arena_block_t *next = arena->large->next;
+    arena->reserved -= arena->large->size;
+    free(arena->large);
+    arena->large = next;
+  }
+
+  // Keep the newest block, which is usually the only one
+  if (arena->blocks != NULL) {
+    while (arena->blocks->next != NULL) {
+      arena_block_t *next = arena->blocks->next->next;
+      arena->reserved -= arena->blocks->next->size;
+      free(arena->blocks->next);
+      arena->blocks->next = next;
+    }
+    arena->blocks->used = 0;
+  }
+}
+
+
+void arenaFree(arena_t *arena) {
+
+  arenaReset(arena);
+
+  if (arena->blocks != NULL) {
+    arena->reserved -= arena->blocks->size;
+    free(arena->blocks);
+    arena->blocks = NULL;
+  }
+}
@@ -0,0 +1,84 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+// Include standard libraries
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+// Error code constants
+#define ARENA_ALLOC_ERROR -8 // Returned by anything an arena ran out under
+
+// Numeric constants
+#define ARENA_ALIGNMENT 32 // Every allocation can be loaded as a vector
+#define ARENA_SCENE_BLOCK_SIZE (1 << 20)
+#define ARENA_SCRATCH_BLOCK_SIZE (64 << 10)
+
+// Define types to be used in c file
+typedef struct arena_block_t arena_block_t;
+typedef struct arena_t arena_t;
+
+struct arena_block_t {
+  arena_block_t *next;
+  size_t size; // Bytes of data after the header
+  size_t used;
+  size_t offset; // Start of the data from the block, which is aligned
+};
+
+struct arena_t { // Region allocator, everything in it is freed at once
+  arena_block_t *blocks; // Block being filled first
+  arena_block_t *large; // Dedicated blocks
+  size_t blockSize;
+  size_t allocated; // Bytes handed out since the arena was created
+  size_t reserved; // Bytes of blocks currently held
+  size_t peakReserved;
+};
+
+
+/**
+ * Set up an empty arena. No memory is reserved until the first allocation.
+ *
+ * @param  arena      arena to initialize
+ * @param  blockSize  bytes reserved at a time for small allocations
+ */
+void arenaInit(arena_t *arena, size_t blockSize);
+
+/**
+ * Allocate memory from an arena, aligned to ARENA_ALIGNMENT. Requests
+ * larger than a quarter block get a dedicated block of their own.
+ *
+ * @param  arena  arena to allocate from
+ * @param  bytes  size of the allocation
+ * @return        pointer to the memory, or NULL if none is left
+ */
+void *arenaAlloc(arena_t *arena, size_t bytes);
+
+/**
+ * Grow an allocation from an arena, keeping its contents. Large
+ * allocations are resized in place, anything else is copied to a new
+ * allocation and the old space is only reclaimed by a reset.
+ *
+ * @param  arena     arena the allocation came from
+ * @param  pointer   allocation to grow, or NULL for a new allocation
+ * @param  oldBytes  current size of the allocation
+ * @param  newBytes  size to grow the allocation to
+ * @return           pointer to the grown memory, or NULL if none is left
+ */
+void *arenaGrow(arena_t *arena, void *pointer, size_t oldBytes,
+                size_t newBytes);
+
+/**
+ * Free every allocation at once, keeping one block for reuse.
+ *
+ * @param  arena  arena to reset
+ */
+void arenaReset(arena_t *arena);
+
+/**
+ * Free every allocation along with all of the arena's blocks.
+ *
+ * @param  arena  arena to free
+ */
+void arenaFree(arena_t *arena);
+
+#endif  // ARENA_H
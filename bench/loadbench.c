@@ -0,0 +1,104 @@
+// Measures how quickly scene CSV files are loaded, in objects per second
+#include <math.h> // INFINITY
+#include "../parsing.h"
+#include "../trace.h"
+
+// Numeric constants
+#define DEFAULT_NUM_SPHERES 1000000
+#define NUM_RUNS 3
+
+// String constants
+#define USAGE_MESSAGE "\
+Usage: loadbench [num_spheres] [scratch_file]\n\
+  num_spheres: spheres in the generated scene (default 1000000)\n\
+  scratch_file: file written and removed by the benchmark\n"
+
+
+// Write a scene of randomly placed spheres in the format of the examples
+static void writeScene(const char *path, int numSpheres) {
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Unable to open '%s' for writing\n", path);
+    exit(1);
+  }
+
+  fprintf(file, "camera, width: 0.5, height: 0.5\n");
+  fprintf(file, "plane, diffuse_color: [1, 1, 1], specular_color: [0, 0, 0], "
+          "position: [0, -10, 0], normal: [0, 1, 0], reflectivity: 0.2, "
+          "refractivity: 0, ior: 1\n");
+  fprintf(file, "light, color: [2, 2, 2], theta: 0, radial-a2: 0.0125, "
+          "radial-a1: 0, radial-a0: 0, position: [0, 16, -45]\n");
+
+  unsigned int seed = 12345;
+  for (int i = 0; i < numSpheres; i++) {
+    double values[7];
+    for (int j = 0; j < 7; j++) {
+      seed = seed * 1103515245 + 12345;
+      values[j] = ((seed >> 8) & 0xffff) / 65536.0;
+    }
+    fprintf(file, "sphere, diffuse_color: [%g, %g, %g], "
+            "specular_color: [0.5, 0.5, 0.5], position: [%.4f, %.4f, %.4f], "
+            "radius: %g, reflectivity: 0.2, refractivity: 0.3, ior: 1.33\n",
+            values[0], values[1], values[2], values[3]*200 - 100,
+            values[4]*200 - 100, -values[5]*200 - 20, values[6] + 0.1);
+  }
+
+  fclose(file);
+}
+
+
+int main(int argc, char *argv[]) {
+
+  int numSpheres = DEFAULT_NUM_SPHERES;
+  const char *path = "loadbench_scratch.csv";
+
+  if (argc > 3) {
+    fprintf(stderr, USAGE_MESSAGE);
+    return 1;
+  }
+  if (argc >= 2) numSpheres = atoi(argv[1]);
+  if (argc == 3) path = argv[2];
+
+  if (numSpheres <= 0) {
+    fprintf(stderr, "Error: Invalid number of spheres, must be > 0\n");
+    return 1;
+  }
+
+  writeScene(path, numSpheres);
+
+  double best = INFINITY;
+  int numLoaded = 0;
+
+  for (int run = 0; run < NUM_RUNS; run++) {
+    FILE *file = fopen(path, "r");
+    camera_t camera;
+    scene_storage_t storage;
+    arena_t arena;
+    arenaInit(&arena, ARENA_SCENE_BLOCK_SIZE);
+
+    double start = traceNow();
+    int errorStatus = parseInput(&camera, &storage, &arena, file);
+    double elapsed = traceNow() - start;
+    fclose(file);
+
+    if (errorStatus != 0) {
+      fprintf(stderr, "Error: Generated scene failed to parse\n");
+      return 1;
+    }
+
+    numLoaded = storage.numObjects + storage.numLights;
+    arenaFree(&arena);
+
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  printf("%d objects, best of %d runs\n", numLoaded, NUM_RUNS);
+  printf("Load  %8.3f s  %12.0f objects/s\n", best, numLoaded / best);
+
+  remove(path);
+
+  return 0;
+}
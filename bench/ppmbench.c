@@ -0,0 +1,123 @@
+// Measures PPM write throughput for both output formats at 8K
+#include <math.h> // INFINITY
+#include "../ppmrw.h"
+#include "../trace.h"
+
+// Numeric constants
+#define DEFAULT_WIDTH 7680
+#define DEFAULT_HEIGHT 4320
+#define NUM_RUNS 3
+
+// String constants
+#define USAGE_MESSAGE "\
+Usage: ppmbench [width height] [scratch_file]\n\
+  width: pixel width of the test image (default 7680)\n\
+  height: pixel height of the test image (default 4320)\n\
+  scratch_file: file written and removed by the benchmark\n"
+
+
+// The per pixel fprintf writer that P3 output used to go through
+static int writeReferenceP3(ppm_t *image, FILE *file) {
+  fprintf(file, "P3\n%d %d\n%d\n", image->width, image->height,
+          image->maxColorValue);
+  for (int i = 0; i < image->width*image->height; i++) {
+    fprintf(file, "%d %d %d\n",
+            image->pixels[i].r, image->pixels[i].g, image->pixels[i].b);
+  }
+  return 0;
+}
+
+
+// Time the best of several writes, returns MB/s and the file size
+static double timeWrite(ppm_t *image, const char *path, int format,
+                        long *outBytes) {
+
+  double best = INFINITY;
+
+  for (int run = 0; run < NUM_RUNS; run++) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+      fprintf(stderr, "Error: Unable to open '%s' for writing\n", path);
+      exit(1);
+    }
+
+    double start = traceNow();
+    if (format == 0) {
+      writeReferenceP3(image, file);
+    }
+    else {
+      writePPM(image, file, format);
+    }
+    fflush(file);
+    double elapsed = traceNow() - start;
+
+    *outBytes = ftell(file);
+    fclose(file);
+
+    if (elapsed < best) {
+      best = elapsed;
+    }
+  }
+
+  return *outBytes / 1e6 / best;
+}
+
+
+int main(int argc, char *argv[]) {
+
+  ppm_t image;
+  image.width = DEFAULT_WIDTH;
+  image.height = DEFAULT_HEIGHT;
+  image.maxColorValue = 255;
+  const char *path = "ppmbench_scratch.ppm";
+
+  if (argc == 3 || argc == 4) {
+    image.width = atoi(argv[1]);
+    image.height = atoi(argv[2]);
+    if (argc == 4) path = argv[3];
+  }
+  else if (argc == 2) {
+    path = argv[1];
+  }
+  else if (argc != 1) {
+    fprintf(stderr, USAGE_MESSAGE);
+    return 1;
+  }
+
+  if (image.width <= 0 || image.height <= 0) {
+    fprintf(stderr, "Error: Invalid width or height, must be > 0\n");
+    return 1;
+  }
+
+  // Gradients with some noise so every digit count shows up
+  image.pixels = malloc(sizeof(pixel_t) * image.width * image.height);
+  unsigned int seed = 12345;
+  for (int i = 0; i < image.height; i++) {
+    for (int j = 0; j < image.width; j++) {
+      seed = seed * 1103515245 + 12345;
+      pixel_t *pixel = &image.pixels[i*image.width + j];
+      pixel->r = j * 255 / image.width;
+      pixel->g = i * 255 / image.height;
+      pixel->b = (seed >> 16) & 0xff;
+    }
+  }
+
+  long bytes;
+  double rate;
+
+  printf("%dx%d, best of %d runs\n", image.width, image.height, NUM_RUNS);
+
+  rate = timeWrite(&image, path, 6, &bytes);
+  printf("P6            %8.1f MB/s  %10ld bytes\n", rate, bytes);
+
+  rate = timeWrite(&image, path, 3, &bytes);
+  printf("P3            %8.1f MB/s  %10ld bytes\n", rate, bytes);
+
+  rate = timeWrite(&image, path, 0, &bytes);
+  printf("P3 (fprintf)  %8.1f MB/s  %10ld bytes\n", rate, bytes);
+
+  remove(path);
+  free(image.pixels);
+
+  return 0;
+}
@@ -0,0 +1,289 @@
+// Renders a fixed matrix of scenes and resolutions and records the speed
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h> // INFINITY
+#include <sys/stat.h> // mkdir
+
+// Numeric constants
+#define NUM_RUNS 3
+#define MAX_LINE 256
+#define MAX_COMMAND 1024
+#define MAX_BASELINE 64
+
+// String constants
+#define RAYCAST_PATH "./raycast"
+#define SCENEGEN_PATH "bench/scenegen"
+#define SCENE_DIR "bench/scenes"
+#define OUTPUT_PATH "bench/scenes/render.ppm"
+#define RESULTS_PATH "bench/results.csv"
+#define BASELINE_PATH "bench/baseline.csv"
+#define RESULTS_HEADER \
+  "scene,width,height,rays,parse_s,render_s,write_s,mrays_per_s\n"
+#define USAGE_MESSAGE "\
+Usage: renderbench [runs]\n\
+  runs: renders of each scene, the fastest is kept (default 3)\n\
+Run from the repository root after make, make scenegen and make renderbench.\n"
+
+// Define types to be used in c file
+typedef struct {
+  const char *name;
+  const char *args; // Options for scenegen, NULL for a file in examples
+} bench_scene_t;
+
+typedef struct {
+  int width;
+  int height;
+} bench_size_t;
+
+typedef struct {
+  char scene[MAX_LINE];
+  int width;
+  int height;
+  long rays;
+  double parseSeconds;
+  double renderSeconds;
+  double writeSeconds;
+  double mraysPerSecond;
+} bench_result_t;
+
+// Scenes from the hand made example up to one that stresses the hierarchy
+static const bench_scene_t scenes[] = {
+  { "fringe", NULL },
+  { "mixed_1k", "--spheres 1000 --planes 2 --point-lights 2 "
+                "--spot-lights 1 --seed 1" },
+  { "mirrors_1k", "--spheres 1000 --planes 2 --point-lights 1 "
+                  "--reflective 0.9 --refractive 0 --reflectivity 0.8 "
+                  "--refractivity 0.1 --seed 2" },
+  { "glass_1k", "--spheres 1000 --planes 2 --point-lights 1 "
+                "--reflective 0.1 --refractive 0.9 --reflectivity 0.1 "
+                "--refractivity 0.8 --seed 3" },
+  { "lights_1k", "--spheres 1000 --planes 1 --point-lights 8 "
+                 "--spot-lights 8 --reflective 0.2 --refractive 0.2 "
+                 "--seed 4" },
+  { "spheres_100k", "--spheres 100000 --planes 1 --point-lights 1 "
+                    "--reflective 0.2 --refractive 0.2 --seed 5" },
+};
+
+static const bench_size_t sizes[] = {
+  { 320, 240 },
+  { 800, 600 },
+};
+
+
+// Path of a scene's CSV file
+static void scenePath(const bench_scene_t *scene, char *path, size_t size) {
+  if (scene->args == NULL) {
+    snprintf(path, size, "examples/%s.csv", scene->name);
+  }
+  else {
+    snprintf(path, size, SCENE_DIR "/%s.csv", scene->name);
+  }
+}
+
+
+// Render a scene once and read the times and counters it reports,
+// returns 0 on success
+static int renderOnce(const char *path, int width, int height,
+                      bench_result_t *result) {
+
+  char command[MAX_COMMAND];
+  snprintf(command, sizeof(command), RAYCAST_PATH " --stats text %d %d %s "
+           OUTPUT_PATH, width, height, path);
+
+  FILE *pipe = popen(command, "r");
+  if (pipe == NULL) {
+    fprintf(stderr, "Error: Unable to run '%s'\n", command);
+    return 1;
+  }
+
+  char line[MAX_LINE];
+  char key[MAX_LINE];
+  double value;
+  long rays = 0;
+  int found = 0;
+  while (fgets(line, sizeof(line), pipe) != NULL) {
+    if (sscanf(line, "%255s %lf", key, &value) != 2) continue;
+
+    if (strcmp(key, "parse") == 0) {
+      result->parseSeconds = value;
+      found++;
+    }
+    else if (strcmp(key, "render") == 0) {
+      result->renderSeconds = value;
+      found++;
+    }
+    else if (strcmp(key, "write") == 0) {
+      result->writeSeconds = value;
+      found++;
+    }
+    else if (strcmp(key, "primary_rays") == 0 ||
+             strcmp(key, "reflect_rays") == 0 ||
+             strcmp(key, "refract_rays") == 0 ||
+             strcmp(key, "shadow_rays") == 0) {
+      rays += (long) value;
+    }
+    else if (strcmp(key, "mrays_per_sec") == 0) {
+      result->mraysPerSecond = value;
+      found++;
+    }
+  }
+
+  if (pclose(pipe) != 0 || found != 4) {
+    fprintf(stderr, "Error: '%s' failed\n", command);
+    return 1;
+  }
+
+  result->rays = rays;
+  return 0;
+}
+
+
+// Best Mrays/s recorded for a run in the baseline, or 0 if it has none
+static double baselineRate(const bench_result_t *baseline, int numBaseline,
+                           const bench_result_t *result) {
+  for (int i = 0; i < numBaseline; i++) {
+    if (strcmp(baseline[i].scene, result->scene) == 0 &&
+        baseline[i].width == result->width &&
+        baseline[i].height == result->height) {
+      return baseline[i].mraysPerSecond;
+    }
+  }
+  return 0;
+}
+
+
+// Read the results of an earlier run, returns the number read
+static int readBaseline(const char *path, bench_result_t *baseline) {
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return 0;
+
+  char line[MAX_LINE];
+  int count = 0;
+  while (count < MAX_BASELINE && fgets(line, sizeof(line), file) != NULL) {
+    bench_result_t *entry = &baseline[count];
+    if (sscanf(line, "%255[^,],%d,%d,%ld,%lf,%lf,%lf,%lf", entry->scene,
+               &entry->width, &entry->height, &entry->rays,
+               &entry->parseSeconds, &entry->renderSeconds,
+               &entry->writeSeconds, &entry->mraysPerSecond) == 8) {
+      count++;
+    }
+  }
+
+  fclose(file);
+  return count;
+}
+
+
+int main(int argc, char *argv[]) {
+
+  int numRuns = NUM_RUNS;
+
+  if (argc == 2) {
+    numRuns = atoi(argv[1]);
+  }
+  else if (argc != 1) {
+    fprintf(stderr, USAGE_MESSAGE);
+    return 1;
+  }
+
+  if (numRuns <= 0) {
+    fprintf(stderr, "Error: Invalid number of runs, must be > 0\n");
+    return 1;
+  }
+
+  int numScenes = sizeof(scenes) / sizeof(scenes[0]);
+  int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+  char path[MAX_LINE];
+  char command[MAX_COMMAND];
+
+  // Generated scenes are the same every time, so only make missing ones
+  mkdir(SCENE_DIR, 0755);
+  for (int i = 0; i < numScenes; i++) {
+    if (scenes[i].args == NULL) continue;
+
+    scenePath(&scenes[i], path, sizeof(path));
+    FILE *existing = fopen(path, "r");
+    if (existing != NULL) {
+      fclose(existing);
+      continue;
+    }
+
+    snprintf(command, sizeof(command), SCENEGEN_PATH " %s %s",
+             scenes[i].args, path);
+    if (system(command) != 0) {
+      fprintf(stderr, "Error: '%s' failed\n", command);
+      return 1;
+    }
+  }
+
+  bench_result_t baseline[MAX_BASELINE];
+  int numBaseline = readBaseline(BASELINE_PATH, baseline);
+
+  FILE *results = fopen(RESULTS_PATH, "w");
+  if (results == NULL) {
+    fprintf(stderr, "Error: Unable to open '" RESULTS_PATH "' for writing\n");
+    return 1;
+  }
+  fprintf(results, RESULTS_HEADER);
+
+  printf("Best of %d runs%s\n", numRuns,
+         numBaseline > 0 ? ", speed against " BASELINE_PATH : "");
+  printf("%-14s %9s %12s %9s %9s %9s %9s", "scene", "size", "rays",
+         "parse_s", "render_s", "write_s", "Mrays/s");
+  printf(numBaseline > 0 ? " %9s\n" : "\n", "speedup");
+
+  for (int i = 0; i < numScenes; i++) {
+    scenePath(&scenes[i], path, sizeof(path));
+
+    for (int j = 0; j < numSizes; j++) {
+      bench_result_t best;
+      best.renderSeconds = INFINITY;
+
+      for (int run = 0; run < numRuns; run++) {
+        bench_result_t result;
+        if (renderOnce(path, sizes[j].width, sizes[j].height, &result)) {
+          fclose(results);
+          return 1;
+        }
+        if (result.renderSeconds < best.renderSeconds) {
+          best = result;
+        }
+      }
+
+      snprintf(best.scene, sizeof(best.scene), "%s", scenes[i].name);
+      best.width = sizes[j].width;
+      best.height = sizes[j].height;
+
+      char size[MAX_LINE];
+      snprintf(size, sizeof(size), "%dx%d", best.width, best.height);
+      printf("%-14s %9s %12ld %9.4f %9.4f %9.4f %9.2f", best.scene, size,
+             best.rays, best.parseSeconds, best.renderSeconds,
+             best.writeSeconds, best.mraysPerSecond);
+
+      double rate = baselineRate(baseline, numBaseline, &best);
+      if (rate > 0) {
+        printf(" %8.2fx\n", best.mraysPerSecond / rate);
+      }
+      else {
+        printf(numBaseline > 0 ? " %9s\n" : "\n", "-");
+      }
+      fflush(stdout);
+
+      fprintf(results, "%s,%d,%d,%ld,%.6f,%.6f,%.6f,%.3f\n", best.scene,
+              best.width, best.height, best.rays, best.parseSeconds,
+              best.renderSeconds, best.writeSeconds, best.mraysPerSecond);
+    }
+  }
+
+  remove(OUTPUT_PATH);
+
+  if (fclose(results) != 0) {
+    fprintf(stderr, "Error: Unable to write '" RESULTS_PATH "'\n");
+    return 1;
+  }
+  printf("Results written to " RESULTS_PATH "\n");
+
+  return 0;
+}
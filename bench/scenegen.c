@@ -0,0 +1,220 @@
+// Generates scene CSV files of any size for the benchmarks
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// Numeric constants
+#define SCENE_NEAR 20.0 // Distance of the closest sphere centres
+#define SCENE_DEPTH 100.0 // Depth of the box the spheres are spread over
+#define SCENE_SPREAD 0.22 // Half width of the view at each distance
+#define SPHERE_FILL 0.25 // Share of the box's width taken by each sphere
+#define DEFAULT_REFLECTIVITY 0.4
+#define DEFAULT_REFRACTIVITY 0.3
+#define DEFAULT_IOR 1.33
+
+// String constants
+#define USAGE_MESSAGE "\
+Usage: scenegen [options] output.csv\n\
+Options:\n\
+  --spheres N: spheres spread through the view (default 100)\n\
+  --planes N: planes, the first a floor, then a back wall, then tilted\n\
+    planes behind the spheres (default 1)\n\
+  --point-lights N: point lights above the spheres (default 1)\n\
+  --spot-lights N: spot lights pointing in to the scene (default 0)\n\
+  --reflective SHARE: share of objects that reflect, 0 to 1 (default 0.5)\n\
+  --refractive SHARE: share of objects that refract, 0 to 1 (default 0.5)\n\
+  --reflectivity R: reflectivity of reflective objects (default 0.4)\n\
+  --refractivity T: refractivity of refractive objects (default 0.3)\n\
+  --seed N: seed of the random layout (default 1)\n"
+
+// Define types to be used in c file
+typedef struct {
+  int numSpheres;
+  int numPlanes;
+  int numPointLights;
+  int numSpotLights;
+  double reflectiveShare;
+  double refractiveShare;
+  double reflectivity;
+  double refractivity;
+  unsigned int seed;
+} scene_params_t;
+
+
+// Next value of a linear congruential generator, uniform in [0, 1)
+static double nextRandom(unsigned int *seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return ((*seed >> 8) & 0xffff) / 65536.0;
+}
+
+
+// Reflectivity, refractivity and index of refraction of the next object,
+// picked so the shares of the scene come out as asked for
+static void writeSurface(FILE *file, const scene_params_t *params,
+                         unsigned int *seed) {
+  double reflectivity = nextRandom(seed) < params->reflectiveShare ?
+                        params->reflectivity : 0;
+  double refractivity = nextRandom(seed) < params->refractiveShare ?
+                        params->refractivity : 0;
+  fprintf(file, "reflectivity: %g, refractivity: %g, ior: %g\n",
+          reflectivity, refractivity, DEFAULT_IOR);
+}
+
+
+static void writeScene(FILE *file, const scene_params_t *params) {
+
+  unsigned int seed = params->seed;
+  double far = SCENE_NEAR + SCENE_DEPTH;
+
+  fprintf(file, "camera, width: 0.5, height: 0.5\n");
+
+  // Random values are each read in to a local before use, since C leaves
+  // the order arguments are evaluated in to the compiler
+
+  // Spheres fill a box that widens with distance like the view does, so
+  // they stay in frame, sized so more of them pack in more tightly
+  double radius = SPHERE_FILL * SCENE_SPREAD * far /
+                  cbrt(params->numSpheres > 0 ? params->numSpheres : 1);
+  for (int i = 0; i < params->numSpheres; i++) {
+    double z = SCENE_NEAR + nextRandom(&seed) * SCENE_DEPTH;
+    double x = (nextRandom(&seed) * 2 - 1) * SCENE_SPREAD * z;
+    double y = (nextRandom(&seed) * 2 - 1) * SCENE_SPREAD * z;
+    double r = radius * (0.5 + nextRandom(&seed));
+    double blue = nextRandom(&seed);
+    double green = nextRandom(&seed);
+    double red = nextRandom(&seed);
+    fprintf(file, "sphere, diffuse_color: [%.3f, %.3f, %.3f], "
+            "specular_color: [0.5, 0.5, 0.5], "
+            "position: [%.4f, %.4f, %.4f], radius: %.4f, ",
+            red, green, blue, x, y, -z, r);
+    writeSurface(file, params, &seed);
+  }
+
+  for (int i = 0; i < params->numPlanes; i++) {
+    double position[3] = { 0, 0, -far - 10 - i };
+    double normal[3] = { 0, 0, 1 };
+    if (i == 0) {
+      position[1] = -SCENE_SPREAD * far;
+      position[2] = 0;
+      normal[1] = 1;
+      normal[2] = 0;
+    }
+    else if (i > 1) {
+      normal[0] = nextRandom(&seed) - 0.5;
+      normal[1] = nextRandom(&seed) - 0.5;
+    }
+    double blue = nextRandom(&seed);
+    double green = nextRandom(&seed);
+    double red = nextRandom(&seed);
+    fprintf(file, "plane, diffuse_color: [%.3f, %.3f, %.3f], "
+            "specular_color: [0, 0, 0], position: [%g, %g, %g], "
+            "normal: [%.4f, %.4f, %.4f], ", red, green, blue, position[0],
+            position[1], position[2], normal[0], normal[1], normal[2]);
+    writeSurface(file, params, &seed);
+  }
+
+  for (int i = 0; i < params->numPointLights; i++) {
+    double z = SCENE_NEAR + nextRandom(&seed) * SCENE_DEPTH;
+    double x = (nextRandom(&seed) * 2 - 1) * SCENE_SPREAD * far;
+    fprintf(file, "light, color: [1.5, 1.5, 1.5], theta: 0, "
+            "radial-a2: 0.0005, radial-a1: 0, radial-a0: 0, "
+            "position: [%.4f, %.4f, %.4f]\n", x, SCENE_SPREAD * far, -z);
+  }
+
+  for (int i = 0; i < params->numSpotLights; i++) {
+    double dy = (nextRandom(&seed) - 0.5) * 0.3;
+    double dx = (nextRandom(&seed) - 0.5) * 0.3;
+    double y = (nextRandom(&seed) * 2 - 1) * SCENE_NEAR * SCENE_SPREAD;
+    double x = (nextRandom(&seed) * 2 - 1) * SCENE_NEAR * SCENE_SPREAD;
+    fprintf(file, "light, color: [1, 1, 1], theta: 20, radial-a2: 0.0005, "
+            "radial-a1: 0, radial-a0: 0, angular-a0: 10, "
+            "position: [%.4f, %.4f, 0], direction: [%.4f, %.4f, -1]\n",
+            x, y, dx, dy);
+  }
+}
+
+
+int main(int argc, char *argv[]) {
+
+  scene_params_t params = { 100, 1, 1, 0, 0.5, 0.5, DEFAULT_REFLECTIVITY,
+                            DEFAULT_REFRACTIVITY, 1 };
+  const char *path = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--", 2) != 0) {
+      if (path != NULL) {
+        fprintf(stderr, USAGE_MESSAGE);
+        return 1;
+      }
+      path = argv[i];
+      continue;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Error: Option '%s' requires a value\n", argv[i]);
+      return 1;
+    }
+
+    if (strcmp(argv[i], "--spheres") == 0) {
+      params.numSpheres = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--planes") == 0) {
+      params.numPlanes = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--point-lights") == 0) {
+      params.numPointLights = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--spot-lights") == 0) {
+      params.numSpotLights = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--reflective") == 0) {
+      params.reflectiveShare = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--refractive") == 0) {
+      params.refractiveShare = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--reflectivity") == 0) {
+      params.reflectivity = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--refractivity") == 0) {
+      params.refractivity = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--seed") == 0) {
+      params.seed = (unsigned int) atoi(argv[++i]);
+    }
+    else {
+      fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+
+  if (path == NULL) {
+    fprintf(stderr, USAGE_MESSAGE);
+    return 1;
+  }
+  if (params.numSpheres < 0 || params.numPlanes < 0 ||
+      params.numPointLights < 0 || params.numSpotLights < 0) {
+    fprintf(stderr, "Error: Invalid object count, must be >= 0\n");
+    return 1;
+  }
+  if (params.reflectivity + params.refractivity > 1) {
+    fprintf(stderr, "Error: Reflectivity and refractivity add up to "
+                    "more than 1\n");
+    return 1;
+  }
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Unable to open '%s' for writing\n", path);
+    return 1;
+  }
+
+  writeScene(file, &params);
+
+  if (fclose(file) != 0) {
+    fprintf(stderr, "Error: Unable to write '%s'\n", path);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,672 @@
+// Include header file
+#include "bvh.h"
+#include <limits.h> // INT_MAX
+
+
+// Axis aligned box used while building
+typedef struct {
+  double min[3];
+  double max[3];
+} bounds_t;
+
+// Per primitive data used while building
+typedef struct {
+  bounds_t bounds;
+  double centroid[3];
+  int id;
+} build_item_t;
+
+typedef struct {
+  bvh_t *bvh;
+  build_item_t *items;
+} builder_t;
+
+
+// Leaves are kept in scene order, which lets the kernels resolve ties
+static int compareItems(const void *a, const void *b) {
+  return ((const build_item_t *) a)->id - ((const build_item_t *) b)->id;
+}
+
+
+static void boundsEmpty(bounds_t *bounds) {
+  for (int k = 0; k < 3; k++) {
+    bounds->min[k] = INFINITY;
+    bounds->max[k] = -INFINITY;
+  }
+}
+
+
+static void boundsGrow(bounds_t *bounds, const bounds_t *other) {
+  for (int k = 0; k < 3; k++) {
+    if (other->min[k] < bounds->min[k]) bounds->min[k] = other->min[k];
+    if (other->max[k] > bounds->max[k]) bounds->max[k] = other->max[k];
+  }
+}
+
+
+static double boundsArea(const bounds_t *bounds) {
+  double dx = bounds->max[0] - bounds->min[0];
+  double dy = bounds->max[1] - bounds->min[1];
+  double dz = bounds->max[2] - bounds->min[2];
+  if (dx < 0 || dy < 0 || dz < 0) {
+    return 0;
+  }
+  return 2 * (dx*dy + dy*dz + dz*dx);
+}
+
+
+// Pick a split position for items [begin, end), -1 if a leaf is better
+static int findSplit(build_item_t *items, int begin, int end,
+                     const bounds_t *bounds) {
+
+  int count = end - begin;
+  double bestCost = count * boundsArea(bounds);
+  int bestAxis = -1;
+  int bestBin = 0;
+  double centroidMin[3];
+  double centroidMax[3];
+
+  // Bin on centroids so that large spheres don't squash everything
+  for (int k = 0; k < 3; k++) {
+    centroidMin[k] = INFINITY;
+    centroidMax[k] = -INFINITY;
+  }
+  for (int i = begin; i < end; i++) {
+    for (int k = 0; k < 3; k++) {
+      if (items[i].centroid[k] < centroidMin[k])
+        centroidMin[k] = items[i].centroid[k];
+      if (items[i].centroid[k] > centroidMax[k])
+        centroidMax[k] = items[i].centroid[k];
+    }
+  }
+
+  for (int k = 0; k < 3; k++) {
+
+    double extent = centroidMax[k] - centroidMin[k];
+    if (!(extent > 0)) {
+      continue;
+    }
+
+    bounds_t binBounds[BVH_NUM_BINS];
+    int binCounts[BVH_NUM_BINS] = { 0 };
+    for (int b = 0; b < BVH_NUM_BINS; b++) {
+      boundsEmpty(&binBounds[b]);
+    }
+
+    double scale = BVH_NUM_BINS / extent;
+    for (int i = begin; i < end; i++) {
+      int b = (int) ((items[i].centroid[k] - centroidMin[k]) * scale);
+      if (b >= BVH_NUM_BINS) b = BVH_NUM_BINS - 1;
+      binCounts[b]++;
+      boundsGrow(&binBounds[b], &items[i].bounds);
+    }
+
+    // Sweep from the right to get the cost of every right hand side
+    double rightCosts[BVH_NUM_BINS];
+    bounds_t running;
+    int runningCount = 0;
+    boundsEmpty(&running);
+    for (int b = BVH_NUM_BINS - 1; b > 0; b--) {
+      boundsGrow(&running, &binBounds[b]);
+      runningCount += binCounts[b];
+      rightCosts[b] = runningCount * boundsArea(&running);
+    }
+
+    // Then sweep from the left and combine
+    boundsEmpty(&running);
+    runningCount = 0;
+    for (int b = 0; b < BVH_NUM_BINS - 1; b++) {
+      boundsGrow(&running, &binBounds[b]);
+      runningCount += binCounts[b];
+
+      if (runningCount == 0 || runningCount == count) {
+        continue;
+      }
+
+      double cost = BVH_TRAVERSAL_COST * boundsArea(bounds) +
+                    runningCount * boundsArea(&running) + rightCosts[b + 1];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = k;
+        bestBin = b;
+      }
+    }
+  }
+
+  // Fall back to a median split when a leaf would be too large
+  if (bestAxis < 0) {
+    return count > BVH_MAX_LEAF_SIZE ? begin + count / 2 : -1;
+  }
+
+  // Partition the items around the chosen bin boundary
+  double scale = BVH_NUM_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+  int left = begin;
+  int right = end - 1;
+  while (left <= right) {
+    int b = (int) ((items[left].centroid[bestAxis] - centroidMin[bestAxis]) *
+                   scale);
+    if (b >= BVH_NUM_BINS) b = BVH_NUM_BINS - 1;
+
+    if (b <= bestBin) {
+      left++;
+    }
+    else {
+      build_item_t temp = items[left];
+      items[left] = items[right];
+      items[right--] = temp;
+    }
+  }
+
+  return left;
+}
+
+
+static void buildNode(builder_t *builder, int nodeIndex, int begin, int end,
+                      int depth) {
+
+  bvh_t *bvh = builder->bvh;
+  build_item_t *items = builder->items;
+  bvh_node_t *node = &bvh->nodes[nodeIndex];
+
+  bounds_t bounds;
+  boundsEmpty(&bounds);
+  for (int i = begin; i < end; i++) {
+    boundsGrow(&bounds, &items[i].bounds);
+  }
+
+  for (int k = 0; k < 3; k++) {
+    node->min[k] = bounds.min[k];
+    node->max[k] = bounds.max[k];
+  }
+
+  int split = -1;
+  if (end - begin > BVH_LEAF_SIZE) {
+    split = findSplit(items, begin, end, &bounds);
+  }
+
+  // Deep lopsided trees switch to halving so traversal never overflows
+  if (depth >= BVH_STACK_SIZE / 2 && end - begin > 1) {
+    split = begin + (end - begin) / 2;
+  }
+
+  // Leaf, which owns the items in its range
+  if (split < 0) {
+    node->first = begin;
+    node->count = end - begin;
+    qsort(items + begin, end - begin, sizeof(build_item_t), compareItems);
+    return;
+  }
+
+  // Interior, left child directly follows the parent
+  int leftIndex = bvh->numNodes++;
+  buildNode(builder, leftIndex, begin, split, depth + 1);
+
+  int rightIndex = bvh->numNodes++;
+  node = &bvh->nodes[nodeIndex];
+  node->first = rightIndex;
+  node->count = 0;
+  buildNode(builder, rightIndex, split, end, depth + 1);
+}
+
+
+bvh_t *bvhBuild(object_t **scene, int numObjects, arena_t *arena) {
+
+  bvh_t *bvh = arenaAlloc(arena, sizeof(bvh_t));
+  int numItems = 0;
+  if (bvh == NULL) return NULL;
+
+  // Count the objects that can be bounded
+  for (int i = 0; i < numObjects; i++) {
+    if (scene[i]->kind == OBJECT_KIND_SPHERE) {
+      numItems++;
+    }
+  }
+
+  // Build data only lives until the tree is finished
+  arena_t scratch;
+  arenaInit(&scratch, ARENA_SCRATCH_BLOCK_SIZE);
+
+  bvh->nodes = arenaAlloc(arena, sizeof(bvh_node_t) * (2 * numItems + 1));
+  build_item_t *items = arenaAlloc(&scratch, sizeof(build_item_t) *
+                                             (numItems + 1));
+  if (bvh->nodes == NULL || items == NULL) {
+    arenaFree(&scratch);
+    return NULL;
+  }
+  numItems = 0;
+
+  for (int i = 0; i < numObjects; i++) {
+
+    if (scene[i]->kind != OBJECT_KIND_SPHERE) {
+      continue;
+    }
+
+    // Pad the bounds a little so rounding never rejects a grazing hit
+    sphere_t *sphere = (sphere_t *) scene[i];
+    double radius = fabs(sphere->radius);
+    build_item_t *item = &items[numItems++];
+    double position[3] = { sphere->position.x, sphere->position.y,
+                           sphere->position.z };
+
+    for (int k = 0; k < 3; k++) {
+      double center = position[k];
+      double padding = BVH_BOUNDS_PADDING * (radius + fabs(center));
+      item->centroid[k] = center;
+      item->bounds.min[k] = center - radius - padding;
+      item->bounds.max[k] = center + radius + padding;
+    }
+    item->id = i;
+  }
+
+  // An empty tree is one leaf with no primitives
+  builder_t builder = { bvh, items };
+  bvh->numNodes = 1;
+  buildNode(&builder, 0, 0, numItems, 0);
+
+  // Lay the sphere data out in leaf order
+  int *order = arenaAlloc(&scratch, sizeof(int) * (numItems + 1));
+  int errorStatus = ARENA_ALLOC_ERROR;
+  if (order != NULL) {
+    for (int i = 0; i < numItems; i++) {
+      order[i] = items[i].id;
+    }
+    errorStatus = primitiveListBuild(&bvh->primitives, scene, numObjects,
+                                     order, arena);
+  }
+
+  arenaFree(&scratch);
+
+  return errorStatus == 0 ? bvh : NULL;
+}
+
+
+// Slab test, returns the entry distance or INFINITY when missed. A NaN from
+// 0 * inf only happens for a ray lying in a face of a padded box, which
+// cannot touch the primitive inside it anyway.
+static inline real_t nodeEntry(const bvh_node_t *node, vec3_t origin,
+                               vec3_t invDirection, real_t tMax) {
+
+  COUNTERS_ADD(boxTests, 1);
+
+  real_t tMin = 0;
+  real_t o[3] = { origin.x, origin.y, origin.z };
+  real_t inv[3] = { invDirection.x, invDirection.y, invDirection.z };
+
+  for (int k = 0; k < 3; k++) {
+    real_t t0 = (node->min[k] - o[k]) * inv[k];
+    real_t t1 = (node->max[k] - o[k]) * inv[k];
+    real_t tNear = t0 < t1 ? t0 : t1;
+    real_t tFar = t0 < t1 ? t1 : t0;
+
+    tMin = tNear > tMin ? tNear : tMin;
+    tMax = tFar < tMax ? tFar : tMax;
+  }
+
+  return tMin <= tMax ? tMin : INFINITY;
+}
+
+
+real_t bvhIntersect(bvh_t *bvh, object_t **outObject,
+                    vec3_t origin, vec3_t direction, real_t tMax) {
+
+  primitive_list_t *primitives = &bvh->primitives;
+  object_t *closestObject = NULL;
+  int closestId = INT_MAX;
+  real_t closestT = tMax;
+  real_t currT;
+
+  // Planes first, they bound how far the tree has to be searched
+  int plane = planeClosest(&primitives->planes, 0, primitives->planes.count,
+                           origin, direction, tMax, &currT);
+  if (plane >= 0) {
+    closestT = currT;
+    closestObject = primitives->planeObjects[plane];
+    closestId = primitives->planeIds[plane];
+  }
+
+  vec3_t invDirection = vec3_make(1 / direction.x,
+                                  1 / direction.y,
+                                  1 / direction.z);
+
+  // Deferred nodes along with the distance at which the ray enters them
+  int stack[BVH_STACK_SIZE];
+  real_t stackT[BVH_STACK_SIZE];
+  int stackSize = 0;
+  int nodeIndex = 0;
+
+  if (nodeEntry(&bvh->nodes[0], origin, invDirection, closestT) == INFINITY) {
+    nodeIndex = -1;
+  }
+
+  while (nodeIndex >= 0 || stackSize > 0) {
+
+    // Skip deferred nodes that are now further away than the closest hit
+    if (nodeIndex < 0) {
+      stackSize--;
+      if (stackT[stackSize] <= closestT) {
+        nodeIndex = stack[stackSize];
+      }
+      continue;
+    }
+
+    bvh_node_t *node = &bvh->nodes[nodeIndex];
+
+    if (node->count > 0) {
+
+      int sphere = sphereClosest(&primitives->spheres, node->first,
+                                 node->first + node->count, origin,
+                                 direction, closestT, &currT);
+
+      // Equal t goes to whichever object the scene lists first
+      if (sphere >= 0 &&
+          (currT < closestT ||
+           (currT == closestT && primitives->sphereIds[sphere] < closestId))) {
+        closestT = currT;
+        closestObject = primitives->sphereObjects[sphere];
+        closestId = primitives->sphereIds[sphere];
+      }
+      nodeIndex = -1;
+      continue;
+    }
+
+    // Visit the nearer child first and keep the other for later
+    int left = nodeIndex + 1;
+    int right = node->first;
+    real_t leftT = nodeEntry(&bvh->nodes[left], origin, invDirection,
+                             closestT);
+    real_t rightT = nodeEntry(&bvh->nodes[right], origin, invDirection,
+                              closestT);
+
+    if (leftT == INFINITY && rightT == INFINITY) {
+      nodeIndex = -1;
+    }
+    else if (leftT == INFINITY) {
+      nodeIndex = right;
+    }
+    else if (rightT == INFINITY) {
+      nodeIndex = left;
+    }
+    else if (leftT <= rightT) {
+      stack[stackSize] = right;
+      stackT[stackSize++] = rightT;
+      nodeIndex = left;
+    }
+    else {
+      stack[stackSize] = left;
+      stackT[stackSize++] = leftT;
+      nodeIndex = right;
+    }
+  }
+
+  if (closestObject == NULL) {
+    return NO_INTERSECTION_FOUND;
+  }
+
+  if (outObject != NULL) {
+    *outObject = closestObject;
+  }
+  return closestT;
+}
+
+
+int bvhOccluded(bvh_t *bvh, vec3_t origin, vec3_t direction, real_t tMax) {
+
+  primitive_list_t *primitives = &bvh->primitives;
+
+  if (planeAnyHit(&primitives->planes, 0, primitives->planes.count,
+                  origin, direction, tMax)) {
+    return 1;
+  }
+
+  vec3_t invDirection = vec3_make(1 / direction.x,
+                                  1 / direction.y,
+                                  1 / direction.z);
+
+  // Order doesn't matter here, so children are simply pushed
+  int stack[BVH_STACK_SIZE];
+  int stackSize = 0;
+
+  if (nodeEntry(&bvh->nodes[0], origin, invDirection, tMax) != INFINITY) {
+    stack[stackSize++] = 0;
+  }
+
+  while (stackSize > 0) {
+
+    int nodeIndex = stack[--stackSize];
+    bvh_node_t *node = &bvh->nodes[nodeIndex];
+
+    if (node->count > 0) {
+      if (sphereAnyHit(&primitives->spheres, node->first,
+                       node->first + node->count, origin, direction, tMax)) {
+        return 1;
+      }
+      continue;
+    }
+
+    if (nodeEntry(&bvh->nodes[node->first], origin, invDirection,
+                  tMax) != INFINITY) {
+      stack[stackSize++] = node->first;
+    }
+    if (nodeEntry(&bvh->nodes[nodeIndex + 1], origin, invDirection,
+                  tMax) != INFINITY) {
+      stack[stackSize++] = nodeIndex + 1;
+    }
+  }
+
+  return 0;
+}
+
+
+// Slab test for every lane in mask, returning the lanes that enter the
+// node and the nearest entry distance among them
+static int packetEntry(const bvh_node_t *node, const ray_packet_t *packet,
+                       const vec3_t *invDirection, const real_t *tMax,
+                       int mask, real_t *outT) {
+
+  int entered = 0;
+  *outT = INFINITY;
+
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    if (!(mask & (1 << k))) {
+      continue;
+    }
+
+    vec3_t origin = vec3_make(packet->ox[k], packet->oy[k], packet->oz[k]);
+    real_t t = nodeEntry(node, origin, invDirection[k], tMax[k]);
+    if (t != INFINITY) {
+      entered |= 1 << k;
+      *outT = t < *outT ? t : *outT;
+    }
+  }
+
+  return entered;
+}
+
+
+static void packetInverse(vec3_t *invDirection, const ray_packet_t *packet) {
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    invDirection[k] = vec3_make(1 / packet->dx[k],
+                                1 / packet->dy[k],
+                                1 / packet->dz[k]);
+  }
+}
+
+
+int bvhIntersectPacket(bvh_t *bvh, const ray_packet_t *packet,
+                       object_t **outObjects, real_t *outT) {
+
+  primitive_list_t *primitives = &bvh->primitives;
+  int closestId[PACKET_WIDTH];
+  real_t closestT[PACKET_WIDTH];
+  real_t currT[PACKET_WIDTH];
+  int index[PACKET_WIDTH];
+  int hits = 0;
+
+  // Planes first, they bound how far the tree has to be searched
+  int planeHits = planeClosestPacket(&primitives->planes, 0,
+                                     primitives->planes.count, packet,
+                                     packet->mask, packet->tMax, currT,
+                                     index);
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    closestT[k] = packet->tMax[k];
+    closestId[k] = INT_MAX;
+    if (planeHits & (1 << k)) {
+      closestT[k] = currT[k];
+      outObjects[k] = primitives->planeObjects[index[k]];
+      closestId[k] = primitives->planeIds[index[k]];
+    }
+  }
+  hits = planeHits;
+
+  vec3_t invDirection[PACKET_WIDTH];
+  packetInverse(invDirection, packet);
+
+  // Deferred nodes along with the lanes that entered them
+  int stack[BVH_STACK_SIZE];
+  int stackMask[BVH_STACK_SIZE];
+  int stackSize = 0;
+  int nodeIndex = 0;
+  real_t entryT;
+  int mask = packetEntry(&bvh->nodes[0], packet, invDirection, closestT,
+                         packet->mask, &entryT);
+
+  while (mask != 0 || stackSize > 0) {
+
+    // Drop the lanes whose closest hit is now nearer than a deferred node
+    if (mask == 0) {
+      stackSize--;
+      nodeIndex = stack[stackSize];
+      mask = packetEntry(&bvh->nodes[nodeIndex], packet, invDirection,
+                         closestT, stackMask[stackSize], &entryT);
+      continue;
+    }
+
+    bvh_node_t *node = &bvh->nodes[nodeIndex];
+
+    if (node->count > 0) {
+
+      int sphereHits = sphereClosestPacket(&primitives->spheres, node->first,
+                                           node->first + node->count, packet,
+                                           mask, closestT, currT, index);
+
+      // Equal t goes to whichever object the scene lists first
+      for (int k = 0; k < PACKET_WIDTH; k++) {
+        if (!(sphereHits & (1 << k))) {
+          continue;
+        }
+        int id = primitives->sphereIds[index[k]];
+        if (currT[k] < closestT[k] ||
+            (currT[k] == closestT[k] && id < closestId[k])) {
+          closestT[k] = currT[k];
+          outObjects[k] = primitives->sphereObjects[index[k]];
+          closestId[k] = id;
+        }
+      }
+      hits |= sphereHits;
+      mask = 0;
+      continue;
+    }
+
+    // Visit the child the packet reaches first and keep the other for later
+    int left = nodeIndex + 1;
+    int right = node->first;
+    real_t leftT;
+    real_t rightT;
+    int leftMask = packetEntry(&bvh->nodes[left], packet, invDirection,
+                               closestT, mask, &leftT);
+    int rightMask = packetEntry(&bvh->nodes[right], packet, invDirection,
+                                closestT, mask, &rightT);
+
+    if (leftMask == 0) {
+      nodeIndex = right;
+      mask = rightMask;
+    }
+    else if (rightMask == 0) {
+      nodeIndex = left;
+      mask = leftMask;
+    }
+    else if (leftT <= rightT) {
+      stack[stackSize] = right;
+      stackMask[stackSize++] = rightMask;
+      nodeIndex = left;
+      mask = leftMask;
+    }
+    else {
+      stack[stackSize] = left;
+      stackMask[stackSize++] = leftMask;
+      nodeIndex = right;
+      mask = rightMask;
+    }
+  }
+
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    outT[k] = closestT[k];
+  }
+  return hits;
+}
+
+
+int bvhOccludedPacket(bvh_t *bvh, const ray_packet_t *packet) {
+
+  primitive_list_t *primitives = &bvh->primitives;
+
+  int blocked = planeAnyHitPacket(&primitives->planes, 0,
+                                  primitives->planes.count, packet,
+                                  packet->mask);
+  int pending = packet->mask & ~blocked;
+  if (pending == 0) {
+    return blocked;
+  }
+
+  vec3_t invDirection[PACKET_WIDTH];
+  packetInverse(invDirection, packet);
+
+  // Order doesn't matter here, so children are simply pushed
+  int stack[BVH_STACK_SIZE];
+  int stackMask[BVH_STACK_SIZE];
+  int stackSize = 0;
+  real_t entryT;
+
+  int mask = packetEntry(&bvh->nodes[0], packet, invDirection, packet->tMax,
+                         pending, &entryT);
+  if (mask != 0) {
+    stack[0] = 0;
+    stackMask[stackSize++] = mask;
+  }
+
+  while (stackSize > 0 && pending != 0) {
+
+    stackSize--;
+    int nodeIndex = stack[stackSize];
+    mask = stackMask[stackSize] & pending;
+    if (mask == 0) {
+      continue;
+    }
+
+    bvh_node_t *node = &bvh->nodes[nodeIndex];
+
+    if (node->count > 0) {
+      int sphereHits = sphereAnyHitPacket(&primitives->spheres, node->first,
+                                          node->first + node->count, packet,
+                                          mask);
+      blocked |= sphereHits;
+      pending &= ~sphereHits;
+      continue;
+    }
+
+    int rightMask = packetEntry(&bvh->nodes[node->first], packet,
+                                invDirection, packet->tMax, mask, &entryT);
+    if (rightMask != 0) {
+      stack[stackSize] = node->first;
+      stackMask[stackSize++] = rightMask;
+    }
+    int leftMask = packetEntry(&bvh->nodes[nodeIndex + 1], packet,
+                               invDirection, packet->tMax, mask, &entryT);
+    if (leftMask != 0) {
+      stack[stackSize] = nodeIndex + 1;
+      stackMask[stackSize++] = leftMask;
+    }
+  }
+
+  return blocked;
+}
@@ -0,0 +1,107 @@
+#ifndef BVH_H
+#define BVH_H
+
+// Include standard libraries
+#include <stdlib.h>
+#include <math.h>
+#include "vector.h"
+#include "parsing.h"
+#include "math_helpers.h"
+#include "kernels.h"
+#include "counters.h"
+#include "arena.h"
+
+// Numeric constants
+#define BVH_NUM_BINS 16
+#define BVH_LEAF_SIZE 4 // Always make a leaf at or below this size
+#define BVH_MAX_LEAF_SIZE 16 // Never make a leaf above this size
+#define BVH_STACK_SIZE 64
+#define BVH_TRAVERSAL_COST 1.0 // Relative to one primitive test
+#ifdef RAYCAST_FLOAT // Relative growth of primitive bounds, past rounding
+#define BVH_BOUNDS_PADDING 1e-6
+#else
+#define BVH_BOUNDS_PADDING 1e-9
+#endif
+
+// Define types to be used in c file
+typedef struct bvh_node_t bvh_node_t;
+typedef struct bvh_t bvh_t;
+
+struct bvh_node_t {
+  real_t min[3];
+  real_t max[3];
+  int first; // First primitive for leaves, right child for interior nodes
+  int count; // Number of primitives, 0 for interior nodes
+};
+
+struct bvh_t {
+  bvh_node_t *nodes; // Depth first, so a left child follows its parent
+  int numNodes;
+  primitive_list_t primitives; // Spheres in leaf order, planes unbounded
+};
+
+
+/**
+ * Build a bounding volume hierarchy over the scene with a binned
+ * surface area heuristic. Spheres go in to the tree, planes are kept
+ * in a separate list that is always tested.
+ * 
+ * @param  scene       array of objects describing the world
+ * @param  numObjects  number of objects in the world
+ * @param  arena       arena that owns the hierarchy once built
+ * @return             newly created hierarchy, NULL when the arena ran out
+ */
+bvh_t *bvhBuild(object_t **scene, int numObjects, arena_t *arena);
+
+/**
+ * Find the closest object hit by a ray. Ties on t are broken in favour
+ * of the object that comes first in the scene, so the result is the
+ * same as testing every object in order.
+ * 
+ * @param  bvh        hierarchy to traverse
+ * @param  outObject  reference to object that was hit
+ * @param  origin     point to send the ray from
+ * @param  direction  direction to send the ray
+ * @param  tMax       furthest t that counts as a hit
+ * @return            the t value of the intersection point
+ */
+real_t bvhIntersect(bvh_t *bvh, object_t **outObject,
+                    vec3_t origin, vec3_t direction, real_t tMax);
+
+/**
+ * Check whether anything blocks a ray within tMax. Traversal stops at
+ * the first hit found rather than looking for the closest one.
+ * 
+ * @param  bvh        hierarchy to traverse
+ * @param  origin     point to send the ray from
+ * @param  direction  direction to send the ray
+ * @param  tMax       furthest t that counts as a hit
+ * @return            1 if the ray is blocked, otherwise 0
+ */
+int bvhOccluded(bvh_t *bvh, vec3_t origin, vec3_t direction, real_t tMax);
+
+/**
+ * Find the closest object hit by every lane of a packet in one traversal.
+ * A node is visited while any lane still enters it, carrying the mask of
+ * lanes that do, and each lane gets the same result as bvhIntersect.
+ * 
+ * @param  bvh         hierarchy to traverse
+ * @param  packet      rays to trace
+ * @param  outObjects  object hit in each lane
+ * @param  outT        t value of the hit in each lane
+ * @return             mask of the lanes that hit something
+ */
+int bvhIntersectPacket(bvh_t *bvh, const ray_packet_t *packet,
+                       object_t **outObjects, real_t *outT);
+
+/**
+ * Check which lanes of a packet are blocked within their tMax. Lanes
+ * leave the traversal as soon as they are found to be blocked.
+ * 
+ * @param  bvh     hierarchy to traverse
+ * @param  packet  rays to test
+ * @return         mask of the lanes that are blocked
+ */
+int bvhOccludedPacket(bvh_t *bvh, const ray_packet_t *packet);
+
+#endif  // BVH_H
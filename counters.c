@@ -0,0 +1,35 @@
+// Include header file
+#include "counters.h"
+
+
+__thread ray_counters_t *threadCounters = NULL;
+
+
+void countersBind(ray_counters_t *counters) {
+  threadCounters = counters;
+}
+
+
+void countersClear(ray_counters_t *counters) {
+  memset(counters, 0, sizeof(ray_counters_t));
+}
+
+
+void countersMerge(ray_counters_t *total, const ray_counters_t *counters) {
+  total->primaryRays += counters->primaryRays;
+  total->reflectRays += counters->reflectRays;
+  total->refractRays += counters->refractRays;
+  total->shadowRays += counters->shadowRays;
+  total->sphereTests += counters->sphereTests;
+  total->planeTests += counters->planeTests;
+  total->boxTests += counters->boxTests;
+  total->hits += counters->hits;
+  total->misses += counters->misses;
+  total->occluded += counters->occluded;
+  for (int i = 0; i < COUNTERS_MAX_LEVELS; i++) {
+    total->levelRays[i] += counters->levelRays[i];
+  }
+  if (counters->deepestLevel > total->deepestLevel) {
+    total->deepestLevel = counters->deepestLevel;
+  }
+}
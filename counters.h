@@ -0,0 +1,86 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+// Include standard libraries
+#include <stdlib.h>
+#include <string.h>
+
+// Numeric constants
+#define COUNTERS_MAX_LEVELS 8 // Deeper rays are counted in the last level
+
+// Define types to be used in c file
+typedef struct ray_counters_t ray_counters_t;
+
+struct ray_counters_t { // Work done by one thread, merged once it is done
+  long primaryRays;
+  long reflectRays;
+  long refractRays;
+  long shadowRays;
+  long sphereTests; // Spheres handed to an intersection kernel, per ray
+  long planeTests;
+  long boxTests; // Bounding volume hierarchy nodes tested, per ray
+  long hits; // Closest hit queries that found an object
+  long misses;
+  long occluded; // Shadow rays that found something in the way
+  long levelRays[COUNTERS_MAX_LEVELS]; // Rays cast at each level, 1 first
+  int deepestLevel;
+};
+
+// Counters of the thread the caller runs on, NULL while counting is off
+extern __thread ray_counters_t *threadCounters;
+
+/**
+ * Add to one counter of the calling thread, if it is counting. Costs a
+ * single branch when counting is off.
+ *
+ * @param  field   name of the ray_counters_t field
+ * @param  amount  amount to add
+ */
+#define COUNTERS_ADD(field, amount) \
+  do { \
+    if (threadCounters != NULL) { \
+      threadCounters->field += (amount); \
+    } \
+  } while (0)
+
+
+/**
+ * Count rays cast at one level of the ray tree, the camera ray being
+ * level 1, on the calling thread if it is counting.
+ *
+ * @param  level  level of the rays
+ * @param  count  number of rays
+ */
+static inline void countersLevel(int level, long count) {
+  if (threadCounters != NULL) {
+    int bucket = level < COUNTERS_MAX_LEVELS ? level : COUNTERS_MAX_LEVELS;
+    threadCounters->levelRays[bucket - 1] += count;
+    if (level > threadCounters->deepestLevel) {
+      threadCounters->deepestLevel = level;
+    }
+  }
+}
+
+/**
+ * Count on a set of counters from the calling thread, or stop counting.
+ *
+ * @param  counters  counters to add to, or NULL to stop counting
+ */
+void countersBind(ray_counters_t *counters);
+
+/**
+ * Zero a set of counters.
+ *
+ * @param  counters  counters to clear
+ */
+void countersClear(ray_counters_t *counters);
+
+/**
+ * Add one set of counters in to another.
+ *
+ * @param  total     counters to add to
+ * @param  counters  counters to add
+ */
+void countersMerge(ray_counters_t *total, const ray_counters_t *counters);
+
+#endif  // COUNTERS_H
@@ -0,0 +1,1047 @@
+// Include header file
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#endif
+
+/*
+ * Every kernel evaluates exactly the expressions used by sphereIntersect
+ * and planeIntersect, in the same order and without fused multiply-adds,
+ * so all instruction sets produce bit-identical t values.
+ */
+
+typedef int (*sphere_kernel_t)(const sphere_soa_t *spheres, int begin,
+                               int end, vec3_t origin, vec3_t direction,
+                               real_t tMax, int anyHit, real_t *outT);
+typedef int (*plane_kernel_t)(const plane_soa_t *planes, int begin, int end,
+                              vec3_t origin, vec3_t direction, real_t tMax,
+                              int anyHit, real_t *outT);
+
+typedef int (*sphere_packet_kernel_t)(const sphere_soa_t *spheres,
+                                      int begin, int end,
+                                      const ray_packet_t *packet, int mask,
+                                      const real_t *tMax, int anyHit,
+                                      real_t *outT, int *outIndex);
+typedef int (*plane_packet_kernel_t)(const plane_soa_t *planes, int begin,
+                                     int end, const ray_packet_t *packet,
+                                     int mask, const real_t *tMax,
+                                     int anyHit, real_t *outT,
+                                     int *outIndex);
+
+static sphere_kernel_t sphereKernel;
+static plane_kernel_t planeKernel;
+static sphere_packet_kernel_t spherePacketKernel;
+static plane_packet_kernel_t planePacketKernel;
+
+
+static int sphereClosestScalar(const sphere_soa_t *spheres, int begin,
+                               int end, vec3_t origin, vec3_t direction,
+                               real_t tMax, int anyHit, real_t *outT) {
+
+  real_t a = direction.x*direction.x +
+             direction.y*direction.y +
+             direction.z*direction.z;
+  real_t originLength2 = origin.x*origin.x;
+  int closest = -1;
+  real_t closestT = INFINITY;
+
+  for (int i = begin; i < end; i++) {
+
+    real_t b = 2*(direction.x*(origin.x - spheres->x[i]) +
+                  direction.y*(origin.y - spheres->y[i]) +
+                  direction.z*(origin.z - spheres->z[i]));
+
+    real_t c = spheres->length2[i] + originLength2 +
+               origin.y*origin.y + origin.z*origin.z +
+               -2*(spheres->x[i]*origin.x +
+                   spheres->y[i]*origin.y +
+                   spheres->z[i]*origin.z) -
+               spheres->radius2[i];
+
+    real_t discr = b*b - 4*a*c;
+    if (discr < 0) {
+      continue;
+    }
+
+    // Prioritize closest intersection
+    real_t t = (-b - sqrt(discr)) / (2*a);
+    if (!(t > 0)) {
+      t = (-b + sqrt(discr)) / (2*a);
+    }
+
+    if (t > 0 && t <= tMax && t < closestT) {
+      closestT = t;
+      closest = i;
+      if (anyHit) break;
+    }
+  }
+
+  *outT = closestT;
+  return closest;
+}
+
+
+static int planeClosestScalar(const plane_soa_t *planes, int begin, int end,
+                              vec3_t origin, vec3_t direction, real_t tMax,
+                              int anyHit, real_t *outT) {
+
+  int closest = -1;
+  real_t closestT = INFINITY;
+
+  for (int i = begin; i < end; i++) {
+
+    // No intersections if the vector is parallel to the plane
+    real_t product = direction.x*planes->nx[i] +
+                     direction.y*planes->ny[i] +
+                     direction.z*planes->nz[i];
+    if (product == 0) {
+      continue;
+    }
+
+    real_t t = ((planes->x[i] - origin.x)*planes->nx[i] +
+                (planes->y[i] - origin.y)*planes->ny[i] +
+                (planes->z[i] - origin.z)*planes->nz[i]) / product;
+
+    if (t > 0 && t <= tMax && t < closestT) {
+      closestT = t;
+      closest = i;
+      if (anyHit) break;
+    }
+  }
+
+  *outT = closestT;
+  return closest;
+}
+
+
+static vec3_t laneOrigin(const ray_packet_t *packet, int k) {
+  return vec3_make(packet->ox[k], packet->oy[k], packet->oz[k]);
+}
+
+
+static vec3_t laneDirection(const ray_packet_t *packet, int k) {
+  return vec3_make(packet->dx[k], packet->dy[k], packet->dz[k]);
+}
+
+
+// Packets without a vector unit to spread the lanes over test each lane
+// in turn with the single ray kernels
+static int sphereClosestPacketScalar(const sphere_soa_t *spheres, int begin,
+                                     int end, const ray_packet_t *packet,
+                                     int mask, const real_t *tMax,
+                                     int anyHit, real_t *outT,
+                                     int *outIndex) {
+
+  int hits = 0;
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    outT[k] = INFINITY;
+    outIndex[k] = -1;
+    if (mask & (1 << k)) {
+      outIndex[k] = sphereKernel(spheres, begin, end, laneOrigin(packet, k),
+                                 laneDirection(packet, k), tMax[k], anyHit,
+                                 &outT[k]);
+      if (outIndex[k] >= 0) hits |= 1 << k;
+    }
+  }
+
+  return hits;
+}
+
+
+static int planeClosestPacketScalar(const plane_soa_t *planes, int begin,
+                                    int end, const ray_packet_t *packet,
+                                    int mask, const real_t *tMax,
+                                    int anyHit, real_t *outT,
+                                    int *outIndex) {
+
+  int hits = 0;
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    outT[k] = INFINITY;
+    outIndex[k] = -1;
+    if (mask & (1 << k)) {
+      outIndex[k] = planeKernel(planes, begin, end, laneOrigin(packet, k),
+                                laneDirection(packet, k), tMax[k], anyHit,
+                                &outT[k]);
+      if (outIndex[k] >= 0) hits |= 1 << k;
+    }
+  }
+
+  return hits;
+}
+
+
+#ifdef KERNELS_X86
+
+/*
+ * The vector kernels are written once over these macros, which name the
+ * float (_ps) or double (_pd) form of each intrinsic. A double build has 2
+ * lanes in an SSE vector and 4 in an AVX one, a float build 4 and 8, and a
+ * packet fills one AVX vector of doubles or one SSE vector of floats.
+ * Lanes count primitives from begin, which keeps them exact in a float.
+ */
+#ifdef RAYCAST_FLOAT
+typedef __m128 sse_vec_t;
+typedef __m256 avx_vec_t;
+typedef __m128 packet_vec_t;
+#define SSE_OP(name) _mm_##name##_ps
+#define AVX_OP(name) _mm256_##name##_ps
+#define PACKET_OP(name) _mm_##name##_ps
+#define SSE_WIDTH 4
+#define AVX_WIDTH 8
+#define SSE_LANE_INDEX _mm_set_ps(3, 2, 1, 0)
+#define AVX_LANE_INDEX _mm256_set_ps(7, 6, 5, 4, 3, 2, 1, 0)
+#else
+typedef __m128d sse_vec_t;
+typedef __m256d avx_vec_t;
+typedef __m256d packet_vec_t;
+#define SSE_OP(name) _mm_##name##_pd
+#define AVX_OP(name) _mm256_##name##_pd
+#define PACKET_OP(name) _mm256_##name##_pd
+#define SSE_WIDTH 2
+#define AVX_WIDTH 4
+#define SSE_LANE_INDEX _mm_set_pd(1, 0)
+#define AVX_LANE_INDEX _mm256_set_pd(3, 2, 1, 0)
+#endif
+
+// Pick the lane with the smallest t, lowest index between equal t
+static int reduceLanes(const real_t *laneT, const real_t *laneIndex,
+                       int width, int begin, real_t *outT) {
+
+  int closest = -1;
+  real_t closestT = INFINITY;
+
+  for (int k = 0; k < width; k++) {
+    if (laneIndex[k] < 0) {
+      continue;
+    }
+    if (laneT[k] < closestT ||
+        (laneT[k] == closestT && laneIndex[k] < closest)) {
+      closestT = laneT[k];
+      closest = (int) laneIndex[k];
+    }
+  }
+
+  *outT = closestT;
+  return closest < 0 ? -1 : begin + closest;
+}
+
+
+static int sphereClosestSse2(const sphere_soa_t *spheres, int begin,
+                             int end, vec3_t origin, vec3_t direction,
+                             real_t tMax, int anyHit, real_t *outT) {
+
+  real_t aScalar = direction.x*direction.x +
+                   direction.y*direction.y +
+                   direction.z*direction.z;
+
+  sse_vec_t ox = SSE_OP(set1)(origin.x);
+  sse_vec_t oy = SSE_OP(set1)(origin.y);
+  sse_vec_t oz = SSE_OP(set1)(origin.z);
+  sse_vec_t dx = SSE_OP(set1)(direction.x);
+  sse_vec_t dy = SSE_OP(set1)(direction.y);
+  sse_vec_t dz = SSE_OP(set1)(direction.z);
+  sse_vec_t two = SSE_OP(set1)(2);
+  sse_vec_t minusTwo = SSE_OP(set1)(-2);
+  sse_vec_t fourA = SSE_OP(set1)(4*aScalar);
+  sse_vec_t twoA = SSE_OP(set1)(2*aScalar);
+  sse_vec_t originX2 = SSE_OP(set1)(origin.x*origin.x);
+  sse_vec_t originY2 = SSE_OP(set1)(origin.y*origin.y);
+  sse_vec_t originZ2 = SSE_OP(set1)(origin.z*origin.z);
+  sse_vec_t zero = SSE_OP(setzero)();
+  sse_vec_t signBit = SSE_OP(set1)(-0.0);
+  sse_vec_t limit = SSE_OP(set1)(tMax);
+  sse_vec_t endIndex = SSE_OP(set1)(end - begin);
+  sse_vec_t step = SSE_OP(set1)(SSE_WIDTH);
+
+  sse_vec_t index = SSE_LANE_INDEX;
+  sse_vec_t bestT = SSE_OP(set1)(INFINITY);
+  sse_vec_t bestIndex = SSE_OP(set1)(-1);
+
+  for (int i = begin; i < end; i += SSE_WIDTH) {
+
+    sse_vec_t px = SSE_OP(loadu)(spheres->x + i);
+    sse_vec_t py = SSE_OP(loadu)(spheres->y + i);
+    sse_vec_t pz = SSE_OP(loadu)(spheres->z + i);
+
+    sse_vec_t b = SSE_OP(add)(
+        SSE_OP(add)(SSE_OP(mul)(dx, SSE_OP(sub)(ox, px)),
+                    SSE_OP(mul)(dy, SSE_OP(sub)(oy, py))),
+        SSE_OP(mul)(dz, SSE_OP(sub)(oz, pz)));
+    b = SSE_OP(mul)(two, b);
+
+    sse_vec_t dot = SSE_OP(add)(SSE_OP(add)(SSE_OP(mul)(px, ox),
+                                            SSE_OP(mul)(py, oy)),
+                                SSE_OP(mul)(pz, oz));
+    sse_vec_t c = SSE_OP(add)(SSE_OP(loadu)(spheres->length2 + i),
+                              originX2);
+    c = SSE_OP(add)(c, originY2);
+    c = SSE_OP(add)(c, originZ2);
+    c = SSE_OP(add)(c, SSE_OP(mul)(minusTwo, dot));
+    c = SSE_OP(sub)(c, SSE_OP(loadu)(spheres->radius2 + i));
+
+    // Most spheres are missed, so skip the square root and divides when
+    // no lane has a real root
+    sse_vec_t discr = SSE_OP(sub)(SSE_OP(mul)(b, b), SSE_OP(mul)(fourA, c));
+    if (SSE_OP(movemask)(SSE_OP(cmpge)(discr, zero)) == 0) {
+      index = SSE_OP(add)(index, step);
+      continue;
+    }
+
+    // Any remaining negative discriminant gives NaN and fails every test
+    sse_vec_t root = SSE_OP(sqrt)(discr);
+    sse_vec_t negB = SSE_OP(xor)(b, signBit);
+    sse_vec_t t1 = SSE_OP(div)(SSE_OP(sub)(negB, root), twoA);
+    sse_vec_t t2 = SSE_OP(div)(SSE_OP(add)(negB, root), twoA);
+
+    sse_vec_t useT1 = SSE_OP(cmpgt)(t1, zero);
+    sse_vec_t t = SSE_OP(or)(SSE_OP(and)(useT1, t1),
+                             SSE_OP(andnot)(useT1, t2));
+
+    sse_vec_t hit = SSE_OP(and)(SSE_OP(cmpgt)(t, zero),
+                                SSE_OP(cmple)(t, limit));
+    hit = SSE_OP(and)(hit, SSE_OP(cmplt)(t, bestT));
+    hit = SSE_OP(and)(hit, SSE_OP(cmplt)(index, endIndex));
+
+    bestT = SSE_OP(or)(SSE_OP(and)(hit, t), SSE_OP(andnot)(hit, bestT));
+    bestIndex = SSE_OP(or)(SSE_OP(and)(hit, index),
+                           SSE_OP(andnot)(hit, bestIndex));
+    index = SSE_OP(add)(index, step);
+
+    if (anyHit && SSE_OP(movemask)(hit) != 0) break;
+  }
+
+  real_t laneT[SSE_WIDTH];
+  real_t laneIndex[SSE_WIDTH];
+  SSE_OP(storeu)(laneT, bestT);
+  SSE_OP(storeu)(laneIndex, bestIndex);
+
+  return reduceLanes(laneT, laneIndex, SSE_WIDTH, begin, outT);
+}
+
+
+static int planeClosestSse2(const plane_soa_t *planes, int begin, int end,
+                            vec3_t origin, vec3_t direction, real_t tMax,
+                            int anyHit, real_t *outT) {
+
+  sse_vec_t ox = SSE_OP(set1)(origin.x);
+  sse_vec_t oy = SSE_OP(set1)(origin.y);
+  sse_vec_t oz = SSE_OP(set1)(origin.z);
+  sse_vec_t dx = SSE_OP(set1)(direction.x);
+  sse_vec_t dy = SSE_OP(set1)(direction.y);
+  sse_vec_t dz = SSE_OP(set1)(direction.z);
+  sse_vec_t zero = SSE_OP(setzero)();
+  sse_vec_t limit = SSE_OP(set1)(tMax);
+  sse_vec_t endIndex = SSE_OP(set1)(end - begin);
+  sse_vec_t step = SSE_OP(set1)(SSE_WIDTH);
+
+  sse_vec_t index = SSE_LANE_INDEX;
+  sse_vec_t bestT = SSE_OP(set1)(INFINITY);
+  sse_vec_t bestIndex = SSE_OP(set1)(-1);
+
+  for (int i = begin; i < end; i += SSE_WIDTH) {
+
+    sse_vec_t nx = SSE_OP(loadu)(planes->nx + i);
+    sse_vec_t ny = SSE_OP(loadu)(planes->ny + i);
+    sse_vec_t nz = SSE_OP(loadu)(planes->nz + i);
+
+    sse_vec_t product = SSE_OP(add)(SSE_OP(add)(SSE_OP(mul)(dx, nx),
+                                                SSE_OP(mul)(dy, ny)),
+                                    SSE_OP(mul)(dz, nz));
+
+    sse_vec_t t = SSE_OP(add)(
+        SSE_OP(add)(
+            SSE_OP(mul)(SSE_OP(sub)(SSE_OP(loadu)(planes->x + i), ox), nx),
+            SSE_OP(mul)(SSE_OP(sub)(SSE_OP(loadu)(planes->y + i), oy), ny)),
+        SSE_OP(mul)(SSE_OP(sub)(SSE_OP(loadu)(planes->z + i), oz), nz));
+    t = SSE_OP(div)(t, product);
+
+    sse_vec_t hit = SSE_OP(and)(SSE_OP(cmpneq)(product, zero),
+                                SSE_OP(cmpgt)(t, zero));
+    hit = SSE_OP(and)(hit, SSE_OP(cmple)(t, limit));
+    hit = SSE_OP(and)(hit, SSE_OP(cmplt)(t, bestT));
+    hit = SSE_OP(and)(hit, SSE_OP(cmplt)(index, endIndex));
+
+    bestT = SSE_OP(or)(SSE_OP(and)(hit, t), SSE_OP(andnot)(hit, bestT));
+    bestIndex = SSE_OP(or)(SSE_OP(and)(hit, index),
+                           SSE_OP(andnot)(hit, bestIndex));
+    index = SSE_OP(add)(index, step);
+
+    if (anyHit && SSE_OP(movemask)(hit) != 0) break;
+  }
+
+  real_t laneT[SSE_WIDTH];
+  real_t laneIndex[SSE_WIDTH];
+  SSE_OP(storeu)(laneT, bestT);
+  SSE_OP(storeu)(laneIndex, bestIndex);
+
+  return reduceLanes(laneT, laneIndex, SSE_WIDTH, begin, outT);
+}
+
+
+__attribute__((target("avx2")))
+static int sphereClosestAvx2(const sphere_soa_t *spheres, int begin,
+                             int end, vec3_t origin, vec3_t direction,
+                             real_t tMax, int anyHit, real_t *outT) {
+
+  real_t aScalar = direction.x*direction.x +
+                   direction.y*direction.y +
+                   direction.z*direction.z;
+
+  avx_vec_t ox = AVX_OP(set1)(origin.x);
+  avx_vec_t oy = AVX_OP(set1)(origin.y);
+  avx_vec_t oz = AVX_OP(set1)(origin.z);
+  avx_vec_t dx = AVX_OP(set1)(direction.x);
+  avx_vec_t dy = AVX_OP(set1)(direction.y);
+  avx_vec_t dz = AVX_OP(set1)(direction.z);
+  avx_vec_t two = AVX_OP(set1)(2);
+  avx_vec_t minusTwo = AVX_OP(set1)(-2);
+  avx_vec_t fourA = AVX_OP(set1)(4*aScalar);
+  avx_vec_t twoA = AVX_OP(set1)(2*aScalar);
+  avx_vec_t originX2 = AVX_OP(set1)(origin.x*origin.x);
+  avx_vec_t originY2 = AVX_OP(set1)(origin.y*origin.y);
+  avx_vec_t originZ2 = AVX_OP(set1)(origin.z*origin.z);
+  avx_vec_t zero = AVX_OP(setzero)();
+  avx_vec_t signBit = AVX_OP(set1)(-0.0);
+  avx_vec_t limit = AVX_OP(set1)(tMax);
+  avx_vec_t endIndex = AVX_OP(set1)(end - begin);
+  avx_vec_t step = AVX_OP(set1)(AVX_WIDTH);
+
+  avx_vec_t index = AVX_LANE_INDEX;
+  avx_vec_t bestT = AVX_OP(set1)(INFINITY);
+  avx_vec_t bestIndex = AVX_OP(set1)(-1);
+
+  for (int i = begin; i < end; i += AVX_WIDTH) {
+
+    avx_vec_t px = AVX_OP(loadu)(spheres->x + i);
+    avx_vec_t py = AVX_OP(loadu)(spheres->y + i);
+    avx_vec_t pz = AVX_OP(loadu)(spheres->z + i);
+
+    avx_vec_t b = AVX_OP(add)(
+        AVX_OP(add)(AVX_OP(mul)(dx, AVX_OP(sub)(ox, px)),
+                    AVX_OP(mul)(dy, AVX_OP(sub)(oy, py))),
+        AVX_OP(mul)(dz, AVX_OP(sub)(oz, pz)));
+    b = AVX_OP(mul)(two, b);
+
+    avx_vec_t dot = AVX_OP(add)(AVX_OP(add)(AVX_OP(mul)(px, ox),
+                                            AVX_OP(mul)(py, oy)),
+                                AVX_OP(mul)(pz, oz));
+    avx_vec_t c = AVX_OP(add)(AVX_OP(loadu)(spheres->length2 + i),
+                              originX2);
+    c = AVX_OP(add)(c, originY2);
+    c = AVX_OP(add)(c, originZ2);
+    c = AVX_OP(add)(c, AVX_OP(mul)(minusTwo, dot));
+    c = AVX_OP(sub)(c, AVX_OP(loadu)(spheres->radius2 + i));
+
+    // Most spheres are missed, so skip the square root and divides when
+    // no lane has a real root
+    avx_vec_t discr = AVX_OP(sub)(AVX_OP(mul)(b, b), AVX_OP(mul)(fourA, c));
+    if (AVX_OP(movemask)(AVX_OP(cmp)(discr, zero, _CMP_GE_OQ)) == 0) {
+      index = AVX_OP(add)(index, step);
+      continue;
+    }
+
+    // Any remaining negative discriminant gives NaN and fails every test
+    avx_vec_t root = AVX_OP(sqrt)(discr);
+    avx_vec_t negB = AVX_OP(xor)(b, signBit);
+    avx_vec_t t1 = AVX_OP(div)(AVX_OP(sub)(negB, root), twoA);
+    avx_vec_t t2 = AVX_OP(div)(AVX_OP(add)(negB, root), twoA);
+
+    avx_vec_t t = AVX_OP(blendv)(t2, t1, AVX_OP(cmp)(t1, zero, _CMP_GT_OQ));
+
+    avx_vec_t hit = AVX_OP(and)(AVX_OP(cmp)(t, zero, _CMP_GT_OQ),
+                                AVX_OP(cmp)(t, limit, _CMP_LE_OQ));
+    hit = AVX_OP(and)(hit, AVX_OP(cmp)(t, bestT, _CMP_LT_OQ));
+    hit = AVX_OP(and)(hit, AVX_OP(cmp)(index, endIndex, _CMP_LT_OQ));
+
+    bestT = AVX_OP(blendv)(bestT, t, hit);
+    bestIndex = AVX_OP(blendv)(bestIndex, index, hit);
+    index = AVX_OP(add)(index, step);
+
+    if (anyHit && AVX_OP(movemask)(hit) != 0) break;
+  }
+
+  real_t laneT[AVX_WIDTH];
+  real_t laneIndex[AVX_WIDTH];
+  AVX_OP(storeu)(laneT, bestT);
+  AVX_OP(storeu)(laneIndex, bestIndex);
+
+  return reduceLanes(laneT, laneIndex, AVX_WIDTH, begin, outT);
+}
+
+
+__attribute__((target("avx2")))
+static int planeClosestAvx2(const plane_soa_t *planes, int begin, int end,
+                            vec3_t origin, vec3_t direction, real_t tMax,
+                            int anyHit, real_t *outT) {
+
+  avx_vec_t ox = AVX_OP(set1)(origin.x);
+  avx_vec_t oy = AVX_OP(set1)(origin.y);
+  avx_vec_t oz = AVX_OP(set1)(origin.z);
+  avx_vec_t dx = AVX_OP(set1)(direction.x);
+  avx_vec_t dy = AVX_OP(set1)(direction.y);
+  avx_vec_t dz = AVX_OP(set1)(direction.z);
+  avx_vec_t zero = AVX_OP(setzero)();
+  avx_vec_t limit = AVX_OP(set1)(tMax);
+  avx_vec_t endIndex = AVX_OP(set1)(end - begin);
+  avx_vec_t step = AVX_OP(set1)(AVX_WIDTH);
+
+  avx_vec_t index = AVX_LANE_INDEX;
+  avx_vec_t bestT = AVX_OP(set1)(INFINITY);
+  avx_vec_t bestIndex = AVX_OP(set1)(-1);
+
+  for (int i = begin; i < end; i += AVX_WIDTH) {
+
+    avx_vec_t nx = AVX_OP(loadu)(planes->nx + i);
+    avx_vec_t ny = AVX_OP(loadu)(planes->ny + i);
+    avx_vec_t nz = AVX_OP(loadu)(planes->nz + i);
+
+    avx_vec_t product = AVX_OP(add)(
+        AVX_OP(add)(AVX_OP(mul)(dx, nx), AVX_OP(mul)(dy, ny)),
+        AVX_OP(mul)(dz, nz));
+
+    avx_vec_t t = AVX_OP(add)(
+        AVX_OP(add)(
+            AVX_OP(mul)(AVX_OP(sub)(AVX_OP(loadu)(planes->x + i), ox), nx),
+            AVX_OP(mul)(AVX_OP(sub)(AVX_OP(loadu)(planes->y + i), oy), ny)),
+        AVX_OP(mul)(AVX_OP(sub)(AVX_OP(loadu)(planes->z + i), oz), nz));
+    t = AVX_OP(div)(t, product);
+
+    avx_vec_t hit = AVX_OP(and)(AVX_OP(cmp)(product, zero, _CMP_NEQ_UQ),
+                                AVX_OP(cmp)(t, zero, _CMP_GT_OQ));
+    hit = AVX_OP(and)(hit, AVX_OP(cmp)(t, limit, _CMP_LE_OQ));
+    hit = AVX_OP(and)(hit, AVX_OP(cmp)(t, bestT, _CMP_LT_OQ));
+    hit = AVX_OP(and)(hit, AVX_OP(cmp)(index, endIndex, _CMP_LT_OQ));
+
+    bestT = AVX_OP(blendv)(bestT, t, hit);
+    bestIndex = AVX_OP(blendv)(bestIndex, index, hit);
+    index = AVX_OP(add)(index, step);
+
+    if (anyHit && AVX_OP(movemask)(hit) != 0) break;
+  }
+
+  real_t laneT[AVX_WIDTH];
+  real_t laneIndex[AVX_WIDTH];
+  AVX_OP(storeu)(laneT, bestT);
+  AVX_OP(storeu)(laneIndex, bestIndex);
+
+  return reduceLanes(laneT, laneIndex, AVX_WIDTH, begin, outT);
+}
+
+// Unpack the results of a packet kernel, returning the mask of lanes hit
+__attribute__((target("avx2")))
+static int storePacketLanes(packet_vec_t bestT, packet_vec_t bestIndex,
+                            int begin, real_t *outT, int *outIndex) {
+
+  real_t laneT[PACKET_WIDTH];
+  real_t laneIndex[PACKET_WIDTH];
+  PACKET_OP(storeu)(laneT, bestT);
+  PACKET_OP(storeu)(laneIndex, bestIndex);
+
+  int hits = 0;
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    outT[k] = laneT[k];
+    outIndex[k] = laneIndex[k] < 0 ? -1 : begin + (int) laneIndex[k];
+    if (outIndex[k] >= 0) hits |= 1 << k;
+  }
+
+  return hits;
+}
+
+
+__attribute__((target("avx2")))
+static packet_vec_t laneMask(int mask) {
+#ifdef RAYCAST_FLOAT
+  return _mm_castsi128_ps(_mm_set_epi32(mask & 8 ? -1 : 0,
+                                        mask & 4 ? -1 : 0,
+                                        mask & 2 ? -1 : 0,
+                                        mask & 1 ? -1 : 0));
+#else
+  return _mm256_castsi256_pd(_mm256_set_epi64x(mask & 8 ? -1 : 0,
+                                               mask & 4 ? -1 : 0,
+                                               mask & 2 ? -1 : 0,
+                                               mask & 1 ? -1 : 0));
+#endif
+}
+
+
+// One ray in each lane, every sphere broadcast against the whole packet
+__attribute__((target("avx2")))
+static int sphereClosestPacketAvx2(const sphere_soa_t *spheres, int begin,
+                                   int end, const ray_packet_t *packet,
+                                   int mask, const real_t *tMax, int anyHit,
+                                   real_t *outT, int *outIndex) {
+
+  packet_vec_t ox = PACKET_OP(loadu)(packet->ox);
+  packet_vec_t oy = PACKET_OP(loadu)(packet->oy);
+  packet_vec_t oz = PACKET_OP(loadu)(packet->oz);
+  packet_vec_t dx = PACKET_OP(loadu)(packet->dx);
+  packet_vec_t dy = PACKET_OP(loadu)(packet->dy);
+  packet_vec_t dz = PACKET_OP(loadu)(packet->dz);
+
+  packet_vec_t a = PACKET_OP(add)(PACKET_OP(add)(PACKET_OP(mul)(dx, dx),
+                                                 PACKET_OP(mul)(dy, dy)),
+                                  PACKET_OP(mul)(dz, dz));
+  packet_vec_t two = PACKET_OP(set1)(2);
+  packet_vec_t minusTwo = PACKET_OP(set1)(-2);
+  packet_vec_t fourA = PACKET_OP(mul)(PACKET_OP(set1)(4), a);
+  packet_vec_t twoA = PACKET_OP(mul)(two, a);
+  packet_vec_t originX2 = PACKET_OP(mul)(ox, ox);
+  packet_vec_t originY2 = PACKET_OP(mul)(oy, oy);
+  packet_vec_t originZ2 = PACKET_OP(mul)(oz, oz);
+  packet_vec_t zero = PACKET_OP(setzero)();
+  packet_vec_t signBit = PACKET_OP(set1)(-0.0);
+  packet_vec_t limit = PACKET_OP(loadu)(tMax);
+  packet_vec_t active = laneMask(mask);
+
+  packet_vec_t bestT = PACKET_OP(set1)(INFINITY);
+  packet_vec_t bestIndex = PACKET_OP(set1)(-1);
+
+  for (int i = begin; i < end; i++) {
+
+    packet_vec_t px = PACKET_OP(set1)(spheres->x[i]);
+    packet_vec_t py = PACKET_OP(set1)(spheres->y[i]);
+    packet_vec_t pz = PACKET_OP(set1)(spheres->z[i]);
+
+    packet_vec_t b = PACKET_OP(add)(
+        PACKET_OP(add)(PACKET_OP(mul)(dx, PACKET_OP(sub)(ox, px)),
+                       PACKET_OP(mul)(dy, PACKET_OP(sub)(oy, py))),
+        PACKET_OP(mul)(dz, PACKET_OP(sub)(oz, pz)));
+    b = PACKET_OP(mul)(two, b);
+
+    packet_vec_t dot = PACKET_OP(add)(
+        PACKET_OP(add)(PACKET_OP(mul)(px, ox), PACKET_OP(mul)(py, oy)),
+        PACKET_OP(mul)(pz, oz));
+    packet_vec_t c = PACKET_OP(add)(PACKET_OP(set1)(spheres->length2[i]),
+                                    originX2);
+    c = PACKET_OP(add)(c, originY2);
+    c = PACKET_OP(add)(c, originZ2);
+    c = PACKET_OP(add)(c, PACKET_OP(mul)(minusTwo, dot));
+    c = PACKET_OP(sub)(c, PACKET_OP(set1)(spheres->radius2[i]));
+
+    // Most spheres are missed by the whole packet
+    packet_vec_t discr = PACKET_OP(sub)(PACKET_OP(mul)(b, b),
+                                        PACKET_OP(mul)(fourA, c));
+    if (PACKET_OP(movemask)(PACKET_OP(and)(
+            PACKET_OP(cmp)(discr, zero, _CMP_GE_OQ), active)) == 0) {
+      continue;
+    }
+
+    packet_vec_t root = PACKET_OP(sqrt)(discr);
+    packet_vec_t negB = PACKET_OP(xor)(b, signBit);
+    packet_vec_t t1 = PACKET_OP(div)(PACKET_OP(sub)(negB, root), twoA);
+    packet_vec_t t2 = PACKET_OP(div)(PACKET_OP(add)(negB, root), twoA);
+
+    packet_vec_t t = PACKET_OP(blendv)(t2, t1,
+                                       PACKET_OP(cmp)(t1, zero, _CMP_GT_OQ));
+
+    packet_vec_t hit = PACKET_OP(and)(PACKET_OP(cmp)(t, zero, _CMP_GT_OQ),
+                                      PACKET_OP(cmp)(t, limit, _CMP_LE_OQ));
+    hit = PACKET_OP(and)(hit, PACKET_OP(cmp)(t, bestT, _CMP_LT_OQ));
+    hit = PACKET_OP(and)(hit, active);
+
+    bestT = PACKET_OP(blendv)(bestT, t, hit);
+    bestIndex = PACKET_OP(blendv)(bestIndex, PACKET_OP(set1)(i - begin),
+                                  hit);
+
+    // Lanes that only need any hit are done with their first
+    if (anyHit) {
+      active = PACKET_OP(andnot)(hit, active);
+      if (PACKET_OP(movemask)(active) == 0) break;
+    }
+  }
+
+  return storePacketLanes(bestT, bestIndex, begin, outT, outIndex);
+}
+
+
+__attribute__((target("avx2")))
+static int planeClosestPacketAvx2(const plane_soa_t *planes, int begin,
+                                  int end, const ray_packet_t *packet,
+                                  int mask, const real_t *tMax, int anyHit,
+                                  real_t *outT, int *outIndex) {
+
+  packet_vec_t ox = PACKET_OP(loadu)(packet->ox);
+  packet_vec_t oy = PACKET_OP(loadu)(packet->oy);
+  packet_vec_t oz = PACKET_OP(loadu)(packet->oz);
+  packet_vec_t dx = PACKET_OP(loadu)(packet->dx);
+  packet_vec_t dy = PACKET_OP(loadu)(packet->dy);
+  packet_vec_t dz = PACKET_OP(loadu)(packet->dz);
+  packet_vec_t zero = PACKET_OP(setzero)();
+  packet_vec_t limit = PACKET_OP(loadu)(tMax);
+  packet_vec_t active = laneMask(mask);
+
+  packet_vec_t bestT = PACKET_OP(set1)(INFINITY);
+  packet_vec_t bestIndex = PACKET_OP(set1)(-1);
+
+  for (int i = begin; i < end; i++) {
+
+    packet_vec_t nx = PACKET_OP(set1)(planes->nx[i]);
+    packet_vec_t ny = PACKET_OP(set1)(planes->ny[i]);
+    packet_vec_t nz = PACKET_OP(set1)(planes->nz[i]);
+
+    packet_vec_t product = PACKET_OP(add)(
+        PACKET_OP(add)(PACKET_OP(mul)(dx, nx), PACKET_OP(mul)(dy, ny)),
+        PACKET_OP(mul)(dz, nz));
+
+    packet_vec_t t = PACKET_OP(add)(
+        PACKET_OP(add)(
+            PACKET_OP(mul)(PACKET_OP(sub)(PACKET_OP(set1)(planes->x[i]), ox),
+                           nx),
+            PACKET_OP(mul)(PACKET_OP(sub)(PACKET_OP(set1)(planes->y[i]), oy),
+                           ny)),
+        PACKET_OP(mul)(PACKET_OP(sub)(PACKET_OP(set1)(planes->z[i]), oz),
+                       nz));
+    t = PACKET_OP(div)(t, product);
+
+    packet_vec_t hit = PACKET_OP(and)(
+        PACKET_OP(cmp)(product, zero, _CMP_NEQ_UQ),
+        PACKET_OP(cmp)(t, zero, _CMP_GT_OQ));
+    hit = PACKET_OP(and)(hit, PACKET_OP(cmp)(t, limit, _CMP_LE_OQ));
+    hit = PACKET_OP(and)(hit, PACKET_OP(cmp)(t, bestT, _CMP_LT_OQ));
+    hit = PACKET_OP(and)(hit, active);
+
+    bestT = PACKET_OP(blendv)(bestT, t, hit);
+    bestIndex = PACKET_OP(blendv)(bestIndex, PACKET_OP(set1)(i - begin),
+                                  hit);
+
+    if (anyHit) {
+      active = PACKET_OP(andnot)(hit, active);
+      if (PACKET_OP(movemask)(active) == 0) break;
+    }
+  }
+
+  return storePacketLanes(bestT, bestIndex, begin, outT, outIndex);
+}
+
+#endif  // KERNELS_X86
+
+
+int kernelsInit(int simdKind) {
+
+#ifdef KERNELS_X86
+  __builtin_cpu_init();
+  int best = __builtin_cpu_supports("avx2") ? SIMD_KIND_AVX2 :
+             __builtin_cpu_supports("sse2") ? SIMD_KIND_SSE2 :
+                                              SIMD_KIND_SCALAR;
+  if (simdKind == SIMD_KIND_AUTO) {
+    simdKind = best;
+  }
+
+  // A forced instruction set the CPU lacks would crash on the first ray
+  else if (simdKind > best) {
+    fprintf(stderr, "Warning: This CPU does not support %s, using %s\n",
+            simdKindName(simdKind), simdKindName(best));
+    simdKind = best;
+  }
+#else
+  simdKind = SIMD_KIND_SCALAR;
+#endif
+
+  switch (simdKind) {
+#ifdef KERNELS_X86
+    case SIMD_KIND_AVX2:
+      sphereKernel = sphereClosestAvx2;
+      planeKernel = planeClosestAvx2;
+      spherePacketKernel = sphereClosestPacketAvx2;
+      planePacketKernel = planeClosestPacketAvx2;
+      break;
+    case SIMD_KIND_SSE2:
+      sphereKernel = sphereClosestSse2;
+      planeKernel = planeClosestSse2;
+      spherePacketKernel = sphereClosestPacketScalar;
+      planePacketKernel = planeClosestPacketScalar;
+      break;
+#endif
+    default:
+      simdKind = SIMD_KIND_SCALAR;
+      sphereKernel = sphereClosestScalar;
+      planeKernel = planeClosestScalar;
+      spherePacketKernel = sphereClosestPacketScalar;
+      planePacketKernel = planeClosestPacketScalar;
+      break;
+  }
+
+  return simdKind;
+}
+
+
+const char *simdKindName(int simdKind) {
+  switch (simdKind) {
+    case SIMD_KIND_AVX2: return "avx2";
+    case SIMD_KIND_SSE2: return "sse2";
+    case SIMD_KIND_SCALAR: return "scalar";
+    default: return "auto";
+  }
+}
+
+
+int sphereClosest(const sphere_soa_t *spheres, int begin, int end,
+                  vec3_t origin, vec3_t direction, real_t tMax,
+                  real_t *outT) {
+  COUNTERS_ADD(sphereTests, end - begin);
+  return sphereKernel(spheres, begin, end, origin, direction, tMax, 0,
+                      outT);
+}
+
+
+int planeClosest(const plane_soa_t *planes, int begin, int end,
+                 vec3_t origin, vec3_t direction, real_t tMax,
+                 real_t *outT) {
+  COUNTERS_ADD(planeTests, end - begin);
+  return planeKernel(planes, begin, end, origin, direction, tMax, 0, outT);
+}
+
+
+int sphereAnyHit(const sphere_soa_t *spheres, int begin, int end,
+                 vec3_t origin, vec3_t direction, real_t tMax) {
+  real_t t;
+  COUNTERS_ADD(sphereTests, end - begin);
+  return sphereKernel(spheres, begin, end, origin, direction, tMax, 1,
+                      &t) >= 0;
+}
+
+
+int planeAnyHit(const plane_soa_t *planes, int begin, int end,
+                vec3_t origin, vec3_t direction, real_t tMax) {
+  real_t t;
+  COUNTERS_ADD(planeTests, end - begin);
+  return planeKernel(planes, begin, end, origin, direction, tMax, 1, &t) >= 0;
+}
+
+
+int sphereClosestPacket(const sphere_soa_t *spheres, int begin, int end,
+                        const ray_packet_t *packet, int mask,
+                        const real_t *tMax, real_t *outT, int *outIndex) {
+  COUNTERS_ADD(sphereTests, (end - begin) * __builtin_popcount(mask));
+  return spherePacketKernel(spheres, begin, end, packet, mask, tMax, 0,
+                            outT, outIndex);
+}
+
+
+int planeClosestPacket(const plane_soa_t *planes, int begin, int end,
+                       const ray_packet_t *packet, int mask,
+                       const real_t *tMax, real_t *outT, int *outIndex) {
+  COUNTERS_ADD(planeTests, (end - begin) * __builtin_popcount(mask));
+  return planePacketKernel(planes, begin, end, packet, mask, tMax, 0, outT,
+                           outIndex);
+}
+
+
+int sphereAnyHitPacket(const sphere_soa_t *spheres, int begin, int end,
+                       const ray_packet_t *packet, int mask) {
+  real_t t[PACKET_WIDTH];
+  int index[PACKET_WIDTH];
+  COUNTERS_ADD(sphereTests, (end - begin) * __builtin_popcount(mask));
+  return spherePacketKernel(spheres, begin, end, packet, mask, packet->tMax,
+                            1, t, index);
+}
+
+
+int planeAnyHitPacket(const plane_soa_t *planes, int begin, int end,
+                      const ray_packet_t *packet, int mask) {
+  real_t t[PACKET_WIDTH];
+  int index[PACKET_WIDTH];
+  COUNTERS_ADD(planeTests, (end - begin) * __builtin_popcount(mask));
+  return planePacketKernel(planes, begin, end, packet, mask, packet->tMax,
+                           1, t, index);
+}
+
+
+int paddedLength(int count) {
+  return (count + SIMD_MAX_WIDTH - 1) / SIMD_MAX_WIDTH * SIMD_MAX_WIDTH +
+         SIMD_MAX_WIDTH;
+}
+
+
+// Allocate an array with room for a whole vector past the end
+static real_t *paddedArray(arena_t *arena, int count, real_t fill) {
+  int padded = paddedLength(count);
+  real_t *array = arenaAlloc(arena, sizeof(real_t) * padded);
+  if (array == NULL) return NULL;
+  for (int i = 0; i < padded; i++) {
+    array[i] = fill;
+  }
+  return array;
+}
+
+
+int primitiveListBuild(primitive_list_t *list, object_t **scene,
+                       int numObjects, const int *sphereOrder,
+                       arena_t *arena) {
+
+  int numSpheres = 0;
+  int numPlanes = 0;
+
+  for (int i = 0; i < numObjects; i++) {
+    if (scene[i]->kind == OBJECT_KIND_SPHERE) numSpheres++;
+    else if (scene[i]->kind == OBJECT_KIND_PLANE) numPlanes++;
+  }
+
+  // Padding lanes can never be hit, a negative radius2 gives c = inf
+  sphere_soa_t *spheres = &list->spheres;
+  spheres->count = numSpheres;
+  spheres->x = paddedArray(arena, numSpheres, 0);
+  spheres->y = paddedArray(arena, numSpheres, 0);
+  spheres->z = paddedArray(arena, numSpheres, 0);
+  spheres->length2 = paddedArray(arena, numSpheres, 0);
+  spheres->radius2 = paddedArray(arena, numSpheres, -INFINITY);
+  list->sphereObjects = arenaAlloc(arena, sizeof(object_t *) *
+                                          (numSpheres + 1));
+  list->sphereIds = arenaAlloc(arena, sizeof(int) * (numSpheres + 1));
+
+  // A zero normal is parallel to every ray
+  plane_soa_t *planes = &list->planes;
+  planes->count = numPlanes;
+  planes->x = paddedArray(arena, numPlanes, 0);
+  planes->y = paddedArray(arena, numPlanes, 0);
+  planes->z = paddedArray(arena, numPlanes, 0);
+  planes->nx = paddedArray(arena, numPlanes, 0);
+  planes->ny = paddedArray(arena, numPlanes, 0);
+  planes->nz = paddedArray(arena, numPlanes, 0);
+  list->planeObjects = arenaAlloc(arena, sizeof(object_t *) *
+                                         (numPlanes + 1));
+  list->planeIds = arenaAlloc(arena, sizeof(int) * (numPlanes + 1));
+
+  if (spheres->x == NULL || spheres->y == NULL || spheres->z == NULL ||
+      spheres->length2 == NULL || spheres->radius2 == NULL ||
+      list->sphereObjects == NULL || list->sphereIds == NULL ||
+      planes->x == NULL || planes->y == NULL || planes->z == NULL ||
+      planes->nx == NULL || planes->ny == NULL || planes->nz == NULL ||
+      list->planeObjects == NULL || list->planeIds == NULL) {
+    return ARENA_ALLOC_ERROR;
+  }
+
+  numSpheres = 0;
+  numPlanes = 0;
+
+  for (int i = 0; i < numObjects; i++) {
+
+    if (scene[i]->kind == OBJECT_KIND_PLANE) {
+      plane_t *plane = (plane_t *) scene[i];
+      planes->x[numPlanes] = plane->position.x;
+      planes->y[numPlanes] = plane->position.y;
+      planes->z[numPlanes] = plane->position.z;
+      planes->nx[numPlanes] = plane->normal.x;
+      planes->ny[numPlanes] = plane->normal.y;
+      planes->nz[numPlanes] = plane->normal.z;
+      list->planeObjects[numPlanes] = scene[i];
+      list->planeIds[numPlanes++] = i;
+    }
+
+    else if (scene[i]->kind == OBJECT_KIND_SPHERE && sphereOrder == NULL) {
+      list->sphereIds[numSpheres++] = i;
+    }
+  }
+
+  if (sphereOrder != NULL) {
+    for (int i = 0; i < spheres->count; i++) {
+      list->sphereIds[i] = sphereOrder[i];
+    }
+  }
+
+  for (int i = 0; i < spheres->count; i++) {
+    sphere_t *sphere = (sphere_t *) scene[list->sphereIds[i]];
+    vec3_t position = sphere->position;
+
+    spheres->x[i] = position.x;
+    spheres->y[i] = position.y;
+    spheres->z[i] = position.z;
+    spheres->length2[i] = position.x*position.x +
+                          position.y*position.y +
+                          position.z*position.z;
+    spheres->radius2[i] = sphere->radius*sphere->radius;
+    list->sphereObjects[i] = scene[list->sphereIds[i]];
+  }
+
+  return 0;
+}
+
+
+real_t primitiveListIntersect(const primitive_list_t *list,
+                              object_t **outObject, vec3_t origin,
+                              vec3_t direction, real_t tMax) {
+
+  real_t sphereT;
+  real_t planeT;
+  int sphere = sphereClosest(&list->spheres, 0, list->spheres.count,
+                             origin, direction, tMax, &sphereT);
+  int plane = planeClosest(&list->planes, 0, list->planes.count,
+                           origin, direction, tMax, &planeT);
+
+  if (sphere < 0 && plane < 0) {
+    return NO_INTERSECTION_FOUND;
+  }
+
+  // Equal t goes to whichever object the scene lists first
+  int useSphere = plane < 0 ||
+                  (sphere >= 0 &&
+                   (sphereT < planeT ||
+                    (sphereT == planeT &&
+                     list->sphereIds[sphere] < list->planeIds[plane])));
+
+  if (outObject != NULL) {
+    *outObject = useSphere ? list->sphereObjects[sphere]
+                           : list->planeObjects[plane];
+  }
+  return useSphere ? sphereT : planeT;
+}
+
+
+int primitiveListOccluded(const primitive_list_t *list, vec3_t origin,
+                          vec3_t direction, real_t tMax) {
+  return planeAnyHit(&list->planes, 0, list->planes.count,
+                     origin, direction, tMax) ||
+         sphereAnyHit(&list->spheres, 0, list->spheres.count,
+                      origin, direction, tMax);
+}
+
+
+int primitiveListIntersectPacket(const primitive_list_t *list,
+                                 const ray_packet_t *packet,
+                                 object_t **outObjects, real_t *outT) {
+
+  real_t sphereT[PACKET_WIDTH];
+  int sphere[PACKET_WIDTH];
+  real_t planeT[PACKET_WIDTH];
+  int plane[PACKET_WIDTH];
+  int hits = sphereClosestPacket(&list->spheres, 0, list->spheres.count,
+                                 packet, packet->mask, packet->tMax,
+                                 sphereT, sphere) |
+             planeClosestPacket(&list->planes, 0, list->planes.count,
+                                packet, packet->mask, packet->tMax, planeT,
+                                plane);
+
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    if (!(hits & (1 << k))) {
+      continue;
+    }
+
+    // Equal t goes to whichever object the scene lists first
+    int useSphere = plane[k] < 0 ||
+                    (sphere[k] >= 0 &&
+                     (sphereT[k] < planeT[k] ||
+                      (sphereT[k] == planeT[k] &&
+                       list->sphereIds[sphere[k]] <
+                       list->planeIds[plane[k]])));
+
+    outObjects[k] = useSphere ? list->sphereObjects[sphere[k]]
+                              : list->planeObjects[plane[k]];
+    outT[k] = useSphere ? sphereT[k] : planeT[k];
+  }
+
+  return hits;
+}
+
+
+int primitiveListOccludedPacket(const primitive_list_t *list,
+                                const ray_packet_t *packet) {
+  int blocked = planeAnyHitPacket(&list->planes, 0, list->planes.count,
+                                  packet, packet->mask);
+  if (blocked == packet->mask) {
+    return blocked;
+  }
+  return blocked | sphereAnyHitPacket(&list->spheres, 0, list->spheres.count,
+                                      packet, packet->mask & ~blocked);
+}
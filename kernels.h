@@ -0,0 +1,302 @@
+#ifndef KERNELS_H
+#define KERNELS_H
+
+// Include standard libraries
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h> // INT_MAX
+#include "vector.h"
+#include "parsing.h"
+#include "math_helpers.h"
+#include "arena.h"
+#include "counters.h"
+
+// Define constants
+#define SIMD_KIND_AUTO 0
+#define SIMD_KIND_SCALAR 1
+#define SIMD_KIND_SSE2 2
+#define SIMD_KIND_AVX2 3
+
+// Numeric constants
+#ifdef RAYCAST_FLOAT // Arrays are padded so a full vector can be loaded
+#define SIMD_MAX_WIDTH 8
+#define KERNEL_MAX_RANGE (1 << 24) // Primitives a float lane counts exactly
+#else
+#define SIMD_MAX_WIDTH 4
+#define KERNEL_MAX_RANGE INT_MAX
+#endif
+#define PACKET_WIDTH 4 // Rays in a packet, 4 doubles or floats in one vector
+
+// Define types to be used in c file
+typedef struct sphere_soa_t sphere_soa_t;
+typedef struct plane_soa_t plane_soa_t;
+typedef struct primitive_list_t primitive_list_t;
+typedef struct ray_packet_t ray_packet_t;
+
+struct sphere_soa_t {
+  real_t *x;
+  real_t *y;
+  real_t *z;
+  real_t *length2; // Squared distance of the centre from the world origin
+  real_t *radius2;
+  int count;
+};
+
+struct plane_soa_t {
+  real_t *x; // Point on the plane
+  real_t *y;
+  real_t *z;
+  real_t *nx; // Unit normal
+  real_t *ny;
+  real_t *nz;
+  int count;
+};
+
+struct primitive_list_t { // Intersection data split by kind
+  sphere_soa_t spheres;
+  object_t **sphereObjects;
+  int *sphereIds; // Scene index, used to break ties between equal hits
+  plane_soa_t planes;
+  object_t **planeObjects;
+  int *planeIds;
+};
+
+struct ray_packet_t { // Rays traced together, lane k in element k
+  real_t ox[PACKET_WIDTH];
+  real_t oy[PACKET_WIDTH];
+  real_t oz[PACKET_WIDTH];
+  real_t dx[PACKET_WIDTH];
+  real_t dy[PACKET_WIDTH];
+  real_t dz[PACKET_WIDTH];
+  real_t tMax[PACKET_WIDTH]; // Furthest t that counts as a hit
+  int mask; // Bit k is set when lane k holds a ray
+};
+
+
+/**
+ * Choose the intersection kernels for the rest of the run. Must be
+ * called before any rays are cast.
+ * 
+ * @param  simdKind  requested instruction set, SIMD_KIND_AUTO checks CPUID,
+ *                   others fall back with a warning if the CPU lacks them
+ * @return           instruction set that was actually selected
+ */
+int kernelsInit(int simdKind);
+
+/**
+ * Get a printable name for an instruction set.
+ * 
+ * @param  simdKind  instruction set constant
+ * @return           name of the instruction set
+ */
+const char *simdKindName(int simdKind);
+
+/**
+ * Find the closest sphere in [begin, end) that a ray hits within tMax.
+ * Gives the same t values as sphereIntersect, and the lowest index wins
+ * between equal hits.
+ * 
+ * @param  spheres    sphere arrays to test
+ * @param  begin      first sphere to test
+ * @param  end        one past the last sphere to test
+ * @param  origin     point to send the ray from
+ * @param  direction  direction to send the ray
+ * @param  tMax       furthest t that counts as a hit
+ * @param  outT       t value of the closest hit
+ * @return            index of the closest sphere, -1 when nothing was hit
+ */
+int sphereClosest(const sphere_soa_t *spheres, int begin, int end,
+                  vec3_t origin, vec3_t direction, real_t tMax,
+                  real_t *outT);
+
+/**
+ * Find the closest plane in [begin, end) that a ray hits within tMax.
+ * Gives the same t values as planeIntersect, and the lowest index wins
+ * between equal hits.
+ * 
+ * @param  planes     plane arrays to test
+ * @param  begin      first plane to test
+ * @param  end        one past the last plane to test
+ * @param  origin     point to send the ray from
+ * @param  direction  direction to send the ray
+ * @param  tMax       furthest t that counts as a hit
+ * @param  outT       t value of the closest hit
+ * @return            index of the closest plane, -1 when nothing was hit
+ */
+int planeClosest(const plane_soa_t *planes, int begin, int end,
+                 vec3_t origin, vec3_t direction, real_t tMax,
+                 real_t *outT);
+
+/**
+ * Check whether a ray hits any sphere in [begin, end) within tMax,
+ * stopping at the first vector of spheres that contains a hit.
+ * 
+ * @param  spheres    sphere arrays to test
+ * @param  begin      first sphere to test
+ * @param  end        one past the last sphere to test
+ * @param  origin     point to send the ray from
+ * @param  direction  direction to send the ray
+ * @param  tMax       furthest t that counts as a hit
+ * @return            1 if any sphere was hit, otherwise 0
+ */
+int sphereAnyHit(const sphere_soa_t *spheres, int begin, int end,
+                 vec3_t origin, vec3_t direction, real_t tMax);
+
+/**
+ * Check whether a ray hits any plane in [begin, end) within tMax,
+ * stopping at the first vector of planes that contains a hit.
+ * 
+ * @param  planes     plane arrays to test
+ * @param  begin      first plane to test
+ * @param  end        one past the last plane to test
+ * @param  origin     point to send the ray from
+ * @param  direction  direction to send the ray
+ * @param  tMax       furthest t that counts as a hit
+ * @return            1 if any plane was hit, otherwise 0
+ */
+int planeAnyHit(const plane_soa_t *planes, int begin, int end,
+                vec3_t origin, vec3_t direction, real_t tMax);
+
+/**
+ * Find the closest sphere in [begin, end) for every active lane of a
+ * packet. Each lane gets exactly the result sphereClosest would give it.
+ * 
+ * @param  spheres   sphere arrays to test
+ * @param  begin     first sphere to test
+ * @param  end       one past the last sphere to test
+ * @param  packet    rays to test
+ * @param  mask      lanes of the packet to test
+ * @param  tMax      furthest t that counts as a hit in each lane
+ * @param  outT      t value of the closest hit in each lane
+ * @param  outIndex  index of the closest sphere in each lane, or -1
+ * @return           mask of the lanes that hit a sphere
+ */
+int sphereClosestPacket(const sphere_soa_t *spheres, int begin, int end,
+                        const ray_packet_t *packet, int mask,
+                        const real_t *tMax, real_t *outT, int *outIndex);
+
+/**
+ * Find the closest plane in [begin, end) for every active lane of a
+ * packet. Each lane gets exactly the result planeClosest would give it.
+ * 
+ * @param  planes    plane arrays to test
+ * @param  begin     first plane to test
+ * @param  end       one past the last plane to test
+ * @param  packet    rays to test
+ * @param  mask      lanes of the packet to test
+ * @param  tMax      furthest t that counts as a hit in each lane
+ * @param  outT      t value of the closest hit in each lane
+ * @param  outIndex  index of the closest plane in each lane, or -1
+ * @return           mask of the lanes that hit a plane
+ */
+int planeClosestPacket(const plane_soa_t *planes, int begin, int end,
+                       const ray_packet_t *packet, int mask,
+                       const real_t *tMax, real_t *outT, int *outIndex);
+
+/**
+ * Check which active lanes of a packet hit any sphere in [begin, end)
+ * within the packet's tMax, dropping each lane at its first hit.
+ * 
+ * @param  spheres  sphere arrays to test
+ * @param  begin    first sphere to test
+ * @param  end      one past the last sphere to test
+ * @param  packet   rays to test
+ * @param  mask     lanes of the packet to test
+ * @return          mask of the lanes that hit a sphere
+ */
+int sphereAnyHitPacket(const sphere_soa_t *spheres, int begin, int end,
+                       const ray_packet_t *packet, int mask);
+
+/**
+ * Check which active lanes of a packet hit any plane in [begin, end)
+ * within the packet's tMax, dropping each lane at its first hit.
+ * 
+ * @param  planes  plane arrays to test
+ * @param  begin   first plane to test
+ * @param  end     one past the last plane to test
+ * @param  packet  rays to test
+ * @param  mask    lanes of the packet to test
+ * @return         mask of the lanes that hit a plane
+ */
+int planeAnyHitPacket(const plane_soa_t *planes, int begin, int end,
+                      const ray_packet_t *packet, int mask);
+
+/**
+ * Copy objects in to a primitive list. Spheres keep the order given
+ * by sphereOrder so that a hierarchy can address them by range; planes
+ * keep scene order.
+ * 
+ * @param  list         output primitive list
+ * @param  scene        array of objects describing the world
+ * @param  numObjects   number of objects in the world
+ * @param  sphereOrder  scene indices of the spheres in the wanted order,
+ *                      NULL for scene order
+ * @param  arena        arena that owns the list's arrays
+ * @return              0 on success, ARENA_ALLOC_ERROR when the arena ran out
+ */
+int primitiveListBuild(primitive_list_t *list, object_t **scene,
+                       int numObjects, const int *sphereOrder,
+                       arena_t *arena);
+
+/**
+ * Find the closest object in a primitive list, breaking ties in favour
+ * of the object that comes first in the scene.
+ * 
+ * @param  list       primitive list to search
+ * @param  outObject  reference to object that was hit
+ * @param  origin     point to send the ray from
+ * @param  direction  direction to send the ray
+ * @param  tMax       furthest t that counts as a hit
+ * @return            the t value of the intersection point
+ */
+real_t primitiveListIntersect(const primitive_list_t *list,
+                              object_t **outObject, vec3_t origin,
+                              vec3_t direction, real_t tMax);
+
+/**
+ * Check whether anything in a primitive list blocks a ray within tMax.
+ * 
+ * @param  list       primitive list to search
+ * @param  origin     point to send the ray from
+ * @param  direction  direction to send the ray
+ * @param  tMax       furthest t that counts as a hit
+ * @return            1 if the ray is blocked, otherwise 0
+ */
+int primitiveListOccluded(const primitive_list_t *list, vec3_t origin,
+                          vec3_t direction, real_t tMax);
+
+/**
+ * Find the closest object in a primitive list for every lane of a packet,
+ * with the same result primitiveListIntersect gives each ray on its own.
+ * 
+ * @param  list        primitive list to search
+ * @param  packet      rays to trace
+ * @param  outObjects  object hit in each lane
+ * @param  outT        t value of the hit in each lane
+ * @return             mask of the lanes that hit something
+ */
+int primitiveListIntersectPacket(const primitive_list_t *list,
+                                 const ray_packet_t *packet,
+                                 object_t **outObjects, real_t *outT);
+
+/**
+ * Check which lanes of a packet are blocked by anything in a primitive
+ * list within their tMax.
+ * 
+ * @param  list    primitive list to search
+ * @param  packet  rays to test
+ * @return         mask of the lanes that are blocked
+ */
+int primitiveListOccludedPacket(const primitive_list_t *list,
+                                const ray_packet_t *packet);
+
+/**
+ * Number of elements allocated for each array of a primitive list, which
+ * leaves room to load a whole vector past the last primitive.
+ * 
+ * @param  count  number of primitives in the array
+ * @return        padded length of the array
+ */
+int paddedLength(int count);
+
+#endif  // KERNELS_H
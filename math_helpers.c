@@ -2,25 +2,22 @@
 #include "math_helpers.h"
 
 
-double radialAttenuation(light_t *light, double distance) {
+real_t radialAttenuation(light_t *light, real_t distance) {
   return 1 / (light->radial_a0 +
               light->radial_a1 * distance +
               light->radial_a2 * pow(distance, 2));
 }
 
 
-double angularAttenuation(light_t *light, vector3_t loDirection) {
-
-  vector3_t tempOlDirection = vector3_create(0, 0, 0);
-  vector3_scale(tempOlDirection, loDirection, -1);
+real_t angularAttenuation(light_t *light, vec3_t loDirection) {
 
   if (light->kind != LIGHT_KIND_SPOT) {
     return 1.0;
   }
 
-  double dot = vector3_dot(tempOlDirection, light->direction);
-  free(tempOlDirection);
-  
+  vec3_t olDirection = vec3_scale(loDirection, -1);
+  real_t dot = vec3_dot(olDirection, light->direction);
+
   if (acos(dot) * 180.0 / M_PI > light->theta) {
     return 0.0;
   }
@@ -30,45 +27,43 @@ double angularAttenuation(light_t *light, vector3_t loDirection) {
 }
 
 
-void diffuseReflection(vector3_t outColor, vector3_t objColor,
-                       vector3_t lightColor, vector3_t normal,
-                       vector3_t olDirection) {
+vec3_t diffuseReflection(vec3_t objColor, vec3_t lightColor,
+                         vec3_t normal, vec3_t olDirection) {
 
-  double product = vector3_dot(normal, olDirection);
+  real_t product = vec3_dot(normal, olDirection);
 
   if (product > 0) {
-    outColor[0] = objColor[0]*lightColor[0]*product;
-    outColor[1] = objColor[1]*lightColor[1]*product;
-    outColor[2] = objColor[2]*lightColor[2]*product;
+    return vec3_make(objColor.x*lightColor.x*product,
+                     objColor.y*lightColor.y*product,
+                     objColor.z*lightColor.z*product);
   }
   else {
-    outColor[0] = 0;
-    outColor[1] = 0;
-    outColor[2] = 0;
+    return vec3_make(0, 0, 0);
   }
 }
 
-void specularReflection(vector3_t outColor, vector3_t objColor,
-                        vector3_t lightColor, vector3_t ovDirection,
-                        vector3_t reflection, double shininess) {
+vec3_t specularReflection(vec3_t objColor, vec3_t lightColor,
+                          vec3_t ovDirection, vec3_t reflection,
+                          real_t shininess) {
 
-  double product = vector3_dot(ovDirection, reflection);
+  real_t product = vec3_dot(ovDirection, reflection);
 
   if (product > 0) {
+    // Raised to the power twice on purpose, the golden images depend on
+    // the tighter highlight this gives
+    product = pow(product, shininess);
     product = pow(product, shininess);
-    outColor[0] = objColor[0]*lightColor[0]*pow(product, shininess);
-    outColor[1] = objColor[1]*lightColor[1]*pow(product, shininess);
-    outColor[2] = objColor[2]*lightColor[2]*pow(product, shininess);
+    return vec3_make(objColor.x*lightColor.x*product,
+                     objColor.y*lightColor.y*product,
+                     objColor.z*lightColor.z*product);
   }
   else {
-    outColor[0] = 0;
-    outColor[1] = 0;
-    outColor[2] = 0;
+    return vec3_make(0, 0, 0);
   }
 }
 
 
-double clampValue(double value, double min, double max) {
+real_t clampValue(real_t value, real_t min, real_t max) {
   if (value > max) {
     return max;
   } else if (value < min) {
@@ -79,28 +74,28 @@ double clampValue(double value, double min, double max) {
 }
 
 
-double sphereIntersect(vector3_t origin, vector3_t direction,
-                       sphere_t *sphere) {
+real_t sphereIntersect(vec3_t origin, vec3_t direction, sphere_t *sphere) {
 
-  vector3_t position = sphere->position;
+  vec3_t position = sphere->position;
 
   // Calculate variables to use in quadratic formula
-  double a = pow(direction[0], 2) +
-             pow(direction[1], 2) +
-             pow(direction[2], 2);
+  real_t a = direction.x*direction.x +
+             direction.y*direction.y +
+             direction.z*direction.z;
 
-  double b = 2*(direction[0]*(origin[0] - position[0]) +
-                direction[1]*(origin[1] - position[1]) +
-                direction[2]*(origin[2] - position[2]));
+  real_t b = 2*(direction.x*(origin.x - position.x) +
+                direction.y*(origin.y - position.y) +
+                direction.z*(origin.z - position.z));
 
-  double c = pow(position[0], 2) + pow(position[1], 2) + pow(position[2], 2) +
-             pow(origin[0], 2) + pow(origin[1], 2) + pow(origin[2], 2) +
-             -2*(position[0]*origin[0] +
-                 position[1]*origin[1] +
-                 position[2]*origin[2]) -
-             pow(sphere->radius, 2);
+  real_t c = position.x*position.x + position.y*position.y +
+             position.z*position.z +
+             origin.x*origin.x + origin.y*origin.y + origin.z*origin.z +
+             -2*(position.x*origin.x +
+                 position.y*origin.y +
+                 position.z*origin.z) -
+             sphere->radius*sphere->radius;
 
-  double discr = pow(b, 2) - 4*a*c;
+  real_t discr = b*b - 4*a*c;
 
   if (discr < 0) {
     return NO_INTERSECTION_FOUND;
@@ -108,12 +103,12 @@ double sphereIntersect(vector3_t origin, vector3_t direction,
   else {
 
     // Prioritize closest intersection
-    double t1 = (-b - sqrt(discr)) / (2*a);
+    real_t t1 = (-b - sqrt(discr)) / (2*a);
     if (t1 > 0) {
       return t1;
     }
 
-    double t2 = (-b + sqrt(discr)) / (2*a);
+    real_t t2 = (-b + sqrt(discr)) / (2*a);
     if (t2 > 0) {
       return t2;
     }
@@ -123,21 +118,19 @@ double sphereIntersect(vector3_t origin, vector3_t direction,
 }
 
 
-double planeIntersect(vector3_t origin, vector3_t direction, plane_t *plane) {
+real_t planeIntersect(vec3_t origin, vec3_t direction, plane_t *plane) {
+
+  vec3_t normal = plane->normal;
 
   // No intersections if the vector is parallel to the plane
-  double product = vector3_dot(direction, plane->normal);
+  real_t product = vec3_dot(direction, normal);
   if (product == 0) {
     return NO_INTERSECTION_FOUND;
   }
   
   // Calculate the t scalar of intersection
-  vector3_t subVector = vector3_create(0, 0, 0);
-  vector3_sub(subVector, plane->position, origin);
-
-  double t = vector3_dot(subVector, plane->normal) / product;
-
-  free(subVector);
+  vec3_t subVector = vec3_sub(plane->position, origin);
+  real_t t = vec3_dot(subVector, normal) / product;
 
   // Only return t when it is a positive scalar
   if (t > 0) {
@@ -22,7 +22,7 @@
  * @param  distance  distance from the light to the object
  * @return           radial attenuation factor (0-1)
  */
-double radialAttenuation(light_t *light, double distance);
+real_t radialAttenuation(light_t *light, real_t distance);
 
 /**
  * Calculate angular attenuation of spot lights
@@ -31,34 +31,33 @@ double radialAttenuation(light_t *light, double distance);
  * @param  loDirection  the direction vector from light to object
  * @return              angular attenuation factor (0-1)
  */
-double angularAttenuation(light_t *light, vector3_t loDirection);
+real_t angularAttenuation(light_t *light, vec3_t loDirection);
 
 /**
  * Calculate diffuse reflection value of the point on an object
  * 
- * @param outColor     output vector representing color
- * @param objColor     current object color
- * @param lightColor   ambient color of the light
- * @param normal       normal of the object
- * @param olDirection  direction vector from object to light
+ * @param  objColor     current object color
+ * @param  lightColor   ambient color of the light
+ * @param  normal       normal of the object
+ * @param  olDirection  direction vector from object to light
+ * @return              vector representing diffuse color
  */
-void diffuseReflection(vector3_t outColor, vector3_t objColor,
-                       vector3_t lightColor, vector3_t normal,
-                       vector3_t olDirection);
+vec3_t diffuseReflection(vec3_t objColor, vec3_t lightColor,
+                         vec3_t normal, vec3_t olDirection);
 
 /**
  * Calculate specular reflection value of the point on an object
  * 
- * @param outColor      output vector representing color
- * @param objColor      current object color
- * @param lightColor    ambient color of the light
- * @param ovDirection   vector from object to camera
- * @param reflection    reflection of the normal vector
- * @param shininess     shininess of particular object
+ * @param  objColor      current object color
+ * @param  lightColor    ambient color of the light
+ * @param  ovDirection   vector from object to camera
+ * @param  reflection    reflection of the normal vector
+ * @param  shininess     shininess of particular object
+ * @return               vector representing specular color
  */
-void specularReflection(vector3_t outColor, vector3_t objColor,
-                        vector3_t lightColor, vector3_t ovDirection,
-                        vector3_t reflection, double shininess);
+vec3_t specularReflection(vec3_t objColor, vec3_t lightColor,
+                          vec3_t ovDirection, vec3_t reflection,
+                          real_t shininess);
 
 /**
  * Clamp value to between a given range of values
@@ -68,7 +67,7 @@ void specularReflection(vector3_t outColor, vector3_t objColor,
  * @param  max    minimum valid value
  * @return        value after being clamped
  */
-double clampValue(double value, double min, double max);
+real_t clampValue(real_t value, real_t min, real_t max);
 
 /**
  * Returns scalar t value of intersection between a direction
@@ -79,7 +78,7 @@ double clampValue(double value, double min, double max);
  * @param  sphere     the sphere that may be intersected
  * @return            scalar value to apply to vector to find intersection
  */
-double sphereIntersect(vector3_t origin, vector3_t direction, sphere_t *sphere);
+real_t sphereIntersect(vec3_t origin, vec3_t direction, sphere_t *sphere);
 
 /**
  * Returns scalar t value of intersection between a direction
@@ -90,6 +89,6 @@ double sphereIntersect(vector3_t origin, vector3_t direction, sphere_t *sphere);
  * @param  plane      the plane that may be intersected
  * @return            scalar value to apply to vector to find intersection
  */
-double planeIntersect(vector3_t origin, vector3_t direction, plane_t *plane);
+real_t planeIntersect(vec3_t origin, vec3_t direction, plane_t *plane);
 
 #endif  // MATH_HELPERS_H
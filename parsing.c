@@ -1,375 +1,456 @@
 // Include header file
 #include "parsing.h"
 
+// Fields that may appear on a line, in the order of fieldNames
+#define FIELD_WIDTH 0
+#define FIELD_HEIGHT 1
+#define FIELD_POSITION 2
+#define FIELD_COLOR 3
+#define FIELD_DIFFUSE_COLOR 4
+#define FIELD_SPECULAR_COLOR 5
+#define FIELD_RADIUS 6
+#define FIELD_NORMAL 7
+#define FIELD_REFLECTIVITY 8
+#define FIELD_REFRACTIVITY 9
+#define FIELD_IOR 10
+#define FIELD_THETA 11
+#define FIELD_RADIAL_A0 12
+#define FIELD_RADIAL_A1 13
+#define FIELD_RADIAL_A2 14
+#define FIELD_ANGULAR_A0 15
+#define FIELD_DIRECTION 16
+#define NUM_FIELDS 17
+
+#define MAX_FAST_DIGITS 15 // Any mantissa this long fits in a double
+#define MAX_FAST_EXPONENT 22 // Largest power of ten a double holds exactly
+
+static const char *fieldNames[NUM_FIELDS] = {
+  "width", "height", "position", "color", "diffuse_color", "specular_color",
+  "radius", "normal", "reflectivity", "refractivity", "ior", "theta",
+  "radial-a0", "radial-a1", "radial-a2", "angular-a0", "direction"
+};
+
+// Every value found on a line, read in a single pass
+typedef struct line_fields_t {
+  double values[NUM_FIELDS][3];
+  int found[NUM_FIELDS];
+} line_fields_t;
+
+
+// Skip white space and the commas between fields
+static char *skipSeparators(char *c) {
+  while (*c == ',' || isspace((unsigned char) *c)) c++;
+  return c;
+}
 
-int parseCamera(camera_t *camera, char *line) {
 
-  // Variables to parse in to
-  vector3_t position = vector3_create(INFINITY, INFINITY, INFINITY); // Shared
-  double width = 0;
-  double height = 0;
+// Read a single number, returning NULL if there isn't one. Decimals with at
+// most MAX_FAST_DIGITS digits and small exponents are exact in a double, so
+// one multiply or divide rounds them the same way strtod would
+static char *parseNumber(char *c, double *output) {
 
-  // Try to find width and height elements in file
-  char *positionStart = strstr(line, "position:");
-  char *widthStart = strstr(line, "width:");
-  char *heightStart = strstr(line, "height:");
+  static const double powers[MAX_FAST_EXPONENT + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
 
-  if (widthStart == NULL || heightStart == NULL) {
-    return INVALID_PARSE_LINE;
+  char *start = c;
+  int negative = (*c == '-');
+  if (*c == '-' || *c == '+') c++;
+
+  long long mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+
+  while (*c >= '0' && *c <= '9') {
+    mantissa = mantissa*10 + (*c++ - '0');
+    digits++;
+  }
+  if (*c == '.') {
+    c++;
+    while (*c >= '0' && *c <= '9') {
+      mantissa = mantissa*10 + (*c++ - '0');
+      digits++;
+      exponent--;
+    }
   }
 
-  // Increment pointer beyond the initial scan string
-  if (positionStart != NULL) {
-    sscanf(positionStart + 9, " [%lf , %lf , %lf],",
-           &position[0], &position[1], &position[2]);
+  // Leave anything unusual to strtod
+  if (digits == 0 || digits > MAX_FAST_DIGITS ||
+      *c == 'e' || *c == 'E' || exponent < -MAX_FAST_EXPONENT) {
+    char *end;
+    *output = strtod(start, &end);
+    return end == start ? NULL : end;
   }
-  sscanf(widthStart + 6, "%lf,", &width);
-  sscanf(heightStart + 7, "%lf,", &height);
 
-  // Catch invalid values
-  if (width <= 0 || height <= 0) {
-    return INVALID_PARSE_LINE;
+  double value = (double) mantissa;
+  if (exponent < 0) value /= powers[-exponent];
+  *output = negative ? -value : value;
+  return c;
+}
+
+
+// Read a value of the form [x, y, z], returning NULL if it is malformed
+static char *parseTriple(char *c, double *output) {
+  c++; // Skip the opening bracket
+  for (int i = 0; i < 3; i++) {
+    while (isspace((unsigned char) *c)) c++;
+    if (i > 0) {
+      if (*c++ != ',') return NULL;
+    }
+    if ((c = parseNumber(c, &output[i])) == NULL) return NULL;
   }
-  else {
+  while (isspace((unsigned char) *c)) c++;
+  return *c == ']' ? c + 1 : NULL;
+}
+
+
+// Walk a line once, saving the values of every known "key: value" field.
+// Fields are unset when missing, and unknown keys are skipped over
+static int parseFields(line_fields_t *fields, char *line) {
+
+  memset(fields->found, 0, sizeof(fields->found));
 
-    // Populate camera
-    camera->width = width;
-    camera->height = height;
+  // Skip past the object kind
+  char *c = skipSeparators(line);
+  while (isalpha((unsigned char) *c)) c++;
 
-    if (position[0] != INFINITY &&
-        position[1] != INFINITY &&
-        position[2] != INFINITY) {
-      camera->position = position;
+  while (*(c = skipSeparators(c)) != '\0') {
+
+    // Find the key, which runs up to the colon
+    char *key = c;
+    while (*c != ':' && *c != ',' && *c != '\0') c++;
+    if (*c != ':') return INVALID_PARSE_LINE;
+    size_t keyLength = c - key;
+    while (keyLength > 0 && isspace((unsigned char) key[keyLength - 1])) {
+      keyLength--;
     }
-    else {
-      camera->position = vector3_create(0, 0, 0);
+    c++;
+    while (isspace((unsigned char) *c)) c++;
+
+    int field = -1;
+    for (int i = 0; i < NUM_FIELDS; i++) {
+      if (fieldNames[i][0] == key[0] &&
+          strncmp(key, fieldNames[i], keyLength) == 0 &&
+          fieldNames[i][keyLength] == '\0') {
+        field = i;
+        break;
+      }
     }
 
-    return 0;
+    // Skip values of keys we don't know about
+    if (field < 0) {
+      char *end = (*c == '[') ? strchr(c, ']') : strchr(c, ',');
+      if (end == NULL) break;
+      c = end + 1;
+      continue;
+    }
+
+    if (*c == '[') {
+      c = parseTriple(c, fields->values[field]);
+    }
+    else {
+      c = parseNumber(c, &fields->values[field][0]);
+    }
+    if (c == NULL) return INVALID_PARSE_LINE;
+    fields->found[field] = 1;
   }
+
+  return 0;
 }
 
 
-int parseLight(light_t *light, char *line) {
+// Read a field as a vector
+static vec3_t fieldVector(line_fields_t *fields, int field) {
+  double *value = fields->values[field];
+  return vec3_make(value[0], value[1], value[2]);
+}
 
-  // Variables to parse in to
-  vector3_t position = vector3_create(INFINITY, INFINITY, INFINITY);
-  vector3_t color = vector3_create(INFINITY, INFINITY, INFINITY);
-  double theta = 0;
-  double radialA0 = INFINITY;
-  double radialA1 = INFINITY;
-  double radialA2 = INFINITY;
-  double angularA0 = INFINITY; // Spot light properties
-  vector3_t direction = vector3_create(INFINITY, INFINITY, INFINITY);
-
-  // Try to find elements in line
-  char *positionStart = strstr(line, "position:");
-  char *colorStart = strstr(line, "color:");
-  char *radialA0Start = strstr(line, "radial-a0:");
-  char *radialA1Start = strstr(line, "radial-a1:");
-  char *radialA2Start = strstr(line, "radial-a2:");
-  char *thetaStart = strstr(line, "theta:");
-  char *angularA0Start = strstr(line, "angular-a0:");
-  char *directionStart = strstr(line, "direction:");
 
-  // Catch obviously invalid objects
-  if (positionStart == NULL ||
-      colorStart == NULL ||
-      radialA0Start == NULL ||
-      radialA1Start == NULL ||
-      radialA2Start == NULL) {
+// Grow an array once it is full, doubling its capacity
+static void *growArray(arena_t *arena, void *array, int count,
+                       int *capacity, size_t itemSize) {
+  if (count < *capacity) return array;
+  *capacity *= 2;
+  return arenaGrow(arena, array, itemSize * count, itemSize * *capacity);
+}
+
+
+int parseCamera(camera_t *camera, char *line) {
+
+  line_fields_t fields;
+  if (parseFields(&fields, line) != 0 ||
+      !fields.found[FIELD_WIDTH] || !fields.found[FIELD_HEIGHT]) {
     return INVALID_PARSE_LINE;
   }
 
-  // Save global light properties
-  sscanf(positionStart + 9, " [%lf , %lf , %lf],",
-         &position[0], &position[1], &position[2]);
-  sscanf(colorStart + 6, " [%lf , %lf , %lf],",
-         &color[0], &color[1], &color[2]);
-  sscanf(radialA0Start + 10, "%lf,", &radialA0);
-  sscanf(radialA1Start + 10, "%lf,", &radialA1);
-  sscanf(radialA2Start + 10, "%lf,", &radialA2);
-
-  // Bail out early if the global light properties are bad
-  if (position[0] == INFINITY ||
-      position[1] == INFINITY ||
-      position[2] == INFINITY ||
-      color[0] == INFINITY ||
-      color[1] == INFINITY ||
-      color[2] == INFINITY ||
-      radialA0 == INFINITY ||
-      radialA1 == INFINITY ||
-      radialA2 == INFINITY) {
+  double width = fields.values[FIELD_WIDTH][0];
+  double height = fields.values[FIELD_HEIGHT][0];
+
+  // Catch invalid values
+  if (width <= 0 || height <= 0) {
     return INVALID_PARSE_LINE;
   }
 
-  light->position = position;
-  light->color = color;
-  light->radial_a0 = radialA0;
-  light->radial_a1 = radialA1;
-  light->radial_a2 = radialA2;
+  // Populate camera
+  camera->width = width;
+  camera->height = height;
+
+  if (fields.found[FIELD_POSITION]) {
+    camera->position = fieldVector(&fields, FIELD_POSITION);
+  }
+  else {
+    camera->position = vec3_make(0, 0, 0);
+  }
+
+  return 0;
+}
+
+
+int parseLight(light_t *light, char *line) {
+
+  line_fields_t fields;
+
+  // Catch obviously invalid objects
+  if (parseFields(&fields, line) != 0 ||
+      !fields.found[FIELD_POSITION] ||
+      !fields.found[FIELD_COLOR] ||
+      !fields.found[FIELD_RADIAL_A0] ||
+      !fields.found[FIELD_RADIAL_A1] ||
+      !fields.found[FIELD_RADIAL_A2]) {
+    return INVALID_PARSE_LINE;
+  }
+
+  double theta = fields.found[FIELD_THETA] ? fields.values[FIELD_THETA][0] : 0;
 
-  // Determine type of light
-  if (thetaStart != NULL)
-    sscanf(thetaStart + 6, "%lf,", &theta);
-  
   // If light is a point light
-  if (thetaStart == NULL || theta == 0) {
+  if (theta == 0) {
     light->kind = LIGHT_KIND_POINT;
+    light->theta = 0;
+    light->angular_a0 = 0;
+    light->direction = vec3_make(0, 0, 0);
   }
 
   // If light is a spot light
   else {
     light->kind = LIGHT_KIND_SPOT;
 
-    if (angularA0Start == NULL ||
-        directionStart == NULL) {
+    if (!fields.found[FIELD_ANGULAR_A0] ||
+        !fields.found[FIELD_DIRECTION]) {
       return INVALID_PARSE_LINE;
     }
 
-    // Get spot light properties
-    sscanf(angularA0Start + 11, "%lf,", &angularA0);
-    sscanf(directionStart + 10, " [%lf , %lf , %lf],",
-           &direction[0], &direction[1], &direction[2]);
-
-    // Catch invalid values
-    if (angularA0 == INFINITY ||
-        direction[0] == INFINITY ||
-        direction[1] == INFINITY ||
-        direction[2] == INFINITY) {
-      return INVALID_PARSE_LINE;
-    }
-
-    // Populate light
     light->theta = theta;
-    light->angular_a0 = angularA0;
-    light->direction = direction;
-
-    vector3_normalize(light->direction);
+    light->angular_a0 = fields.values[FIELD_ANGULAR_A0][0];
+    light->direction = vec3_normalize(fieldVector(&fields, FIELD_DIRECTION));
   }
 
+  // Populate light
+  light->position = fieldVector(&fields, FIELD_POSITION);
+  light->color = fieldVector(&fields, FIELD_COLOR);
+  light->radial_a0 = fields.values[FIELD_RADIAL_A0][0];
+  light->radial_a1 = fields.values[FIELD_RADIAL_A1][0];
+  light->radial_a2 = fields.values[FIELD_RADIAL_A2][0];
+
   return 0;
 }
 
 
-int parseSphere(sphere_t *sphere, char *line) {
+// Check and copy the properties shared by every visible object
+static int parseObject(object_t *object, line_fields_t *fields) {
 
-  sphere->kind = OBJECT_KIND_SPHERE;
-
-  // Variables to parse into
-  vector3_t diffuseColor = vector3_create(INFINITY, INFINITY, INFINITY);
-  vector3_t specularColor = vector3_create(INFINITY, INFINITY, INFINITY);
-  vector3_t position = vector3_create(INFINITY, INFINITY, INFINITY);
-  double radius = INFINITY;
-  double reflectivity = INFINITY;
-  double refractivity = INFINITY;
-  double ior = INFINITY;
-
-  // Try to find elements in line
-  char *diffuseColorStart = strstr(line, "diffuse_color:");
-  char *specularColorStart = strstr(line, "specular_color:");
-  char *positionStart = strstr(line, "position:");
-  char *radiusStart = strstr(line, "radius:");
-  char *reflectivityStart = strstr(line, "reflectivity:");
-  char *refractivityStart = strstr(line, "refractivity:");
-  char *iorStart = strstr(line, "ior:");
-
-  if (diffuseColorStart == NULL || specularColorStart == NULL ||
-      positionStart == NULL || radiusStart == NULL || iorStart == NULL ||
-      reflectivityStart == NULL || refractivityStart == NULL) {
+  if (!fields->found[FIELD_DIFFUSE_COLOR] ||
+      !fields->found[FIELD_SPECULAR_COLOR] ||
+      !fields->found[FIELD_POSITION] ||
+      !fields->found[FIELD_REFLECTIVITY] ||
+      !fields->found[FIELD_REFRACTIVITY] ||
+      !fields->found[FIELD_IOR]) {
     return INVALID_PARSE_LINE;
   }
 
-  // Increment pointer beyond the initial scan string
-  sscanf(diffuseColorStart + 14, " [%lf , %lf , %lf],",
-         &diffuseColor[0], &diffuseColor[1], &diffuseColor[2]);
-  sscanf(specularColorStart + 15, " [%lf , %lf , %lf],",
-         &specularColor[0], &specularColor[1], &specularColor[2]);
-  sscanf(positionStart + 9, " [%lf , %lf , %lf],",
-         &position[0], &position[1], &position[2]);
-  sscanf(radiusStart + 7, "%lf,", &radius);
-  sscanf(reflectivityStart + 13, "%lf,", &reflectivity);
-  sscanf(refractivityStart + 13, "%lf,", &refractivity);
-  sscanf(iorStart + 4, "%lf,", &ior);
+  double reflectivity = fields->values[FIELD_REFLECTIVITY][0];
+  double refractivity = fields->values[FIELD_REFRACTIVITY][0];
 
   // Catch invalid values
-  if (diffuseColor[0] == INFINITY ||
-      diffuseColor[1] == INFINITY ||
-      diffuseColor[2] == INFINITY ||
-      specularColor[0] == INFINITY ||
-      specularColor[1] == INFINITY ||
-      specularColor[2] == INFINITY ||
-      position[0] == INFINITY ||
-      position[1] == INFINITY ||
-      position[2] == INFINITY ||
-      radius == INFINITY ||
-      reflectivity == INFINITY || reflectivity < 0.0 || reflectivity > 1.0 ||
-      refractivity == INFINITY || refractivity < 0.0 || refractivity > 1.0 ||
-      (reflectivity + refractivity) > 1.0 || ior == INFINITY) {
+  if (reflectivity < 0.0 || reflectivity > 1.0 ||
+      refractivity < 0.0 || refractivity > 1.0 ||
+      (reflectivity + refractivity) > 1.0) {
     return INVALID_PARSE_LINE;
   }
-  else {
 
-    // Populate sphere
-    sphere->diffuse_color = diffuseColor;
-    sphere->specular_color = specularColor;
-    sphere->position = position;
-    sphere->radius = radius;
-    sphere->reflectivity = reflectivity;
-    sphere->refractivity = refractivity;
-    sphere->ior = ior;
+  object->diffuse_color = fieldVector(fields, FIELD_DIFFUSE_COLOR);
+  object->specular_color = fieldVector(fields, FIELD_SPECULAR_COLOR);
+  object->position = fieldVector(fields, FIELD_POSITION);
+  object->reflectivity = reflectivity;
+  object->refractivity = refractivity;
+  object->ior = fields->values[FIELD_IOR][0];
 
-    return 0;
-  }
+  return 0;
 }
 
 
-int parsePlane(plane_t *plane, char *line) {
+int parseSphere(sphere_t *sphere, char *line) {
 
-  plane->kind = OBJECT_KIND_PLANE;
+  sphere->kind = OBJECT_KIND_SPHERE;
 
-  // Variables to parse into
-  vector3_t diffuseColor = vector3_create(INFINITY, INFINITY, INFINITY);
-  vector3_t specularColor = vector3_create(INFINITY, INFINITY, INFINITY);
-  vector3_t position = vector3_create(INFINITY, INFINITY, INFINITY);
-  vector3_t normal = vector3_create(INFINITY, INFINITY, INFINITY);
-  double reflectivity = INFINITY;
-  double refractivity = INFINITY;
-  double ior = INFINITY;
-
-  // Try to find elements in line
-  char *diffuseColorStart = strstr(line, "diffuse_color:");
-  char *specularColorStart = strstr(line, "specular_color:");
-  char *positionStart = strstr(line, "position:");
-  char *normalStart = strstr(line, "normal:");
-  char *reflectivityStart = strstr(line, "reflectivity:");
-  char *refractivityStart = strstr(line, "refractivity:");
-  char *iorStart = strstr(line, "ior:");
-
-  if (diffuseColorStart == NULL || positionStart == NULL ||
-      normalStart == NULL || reflectivityStart == NULL ||
-      refractivityStart == NULL || iorStart == NULL) {
+  line_fields_t fields;
+  if (parseFields(&fields, line) != 0 || !fields.found[FIELD_RADIUS]) {
     return INVALID_PARSE_LINE;
   }
 
-  // Increment pointer beyond the initial scan string
-  sscanf(diffuseColorStart + 14, " [%lf , %lf , %lf],",
-         &diffuseColor[0], &diffuseColor[1], &diffuseColor[2]);
-  sscanf(specularColorStart + 15, " [%lf , %lf , %lf],",
-         &specularColor[0], &specularColor[1], &specularColor[2]);
-  sscanf(positionStart + 9, " [%lf , %lf , %lf],",
-         &position[0], &position[1], &position[2]);
-  sscanf(normalStart + 7, " [%lf , %lf , %lf],",
-         &normal[0], &normal[1], &normal[2]);
-  sscanf(reflectivityStart + 13, "%lf,", &reflectivity);
-  sscanf(refractivityStart + 13, "%lf,", &refractivity);
-  sscanf(iorStart + 4, "%lf,", &ior);
+  sphere->radius = fields.values[FIELD_RADIUS][0];
+  return parseObject((object_t *) sphere, &fields);
+}
 
-  // Catch invalid values
-  if (diffuseColor[0] == INFINITY ||
-      diffuseColor[1] == INFINITY ||
-      diffuseColor[2] == INFINITY ||
-      specularColor[0] == INFINITY ||
-      specularColor[1] == INFINITY ||
-      specularColor[2] == INFINITY ||
-      position[0] == INFINITY ||
-      position[1] == INFINITY ||
-      position[2] == INFINITY ||
-      normal[0] == INFINITY ||
-      normal[1] == INFINITY ||
-      normal[2] == INFINITY ||
-      reflectivity == INFINITY || reflectivity < 0.0 || reflectivity > 1.0 ||
-      refractivity == INFINITY || refractivity < 0.0 || refractivity > 1.0 ||
-      (reflectivity + refractivity) > 1.0 || ior == INFINITY) {
+
+int parsePlane(plane_t *plane, char *line) {
+
+  plane->kind = OBJECT_KIND_PLANE;
+
+  line_fields_t fields;
+  if (parseFields(&fields, line) != 0 || !fields.found[FIELD_NORMAL]) {
     return INVALID_PARSE_LINE;
   }
-  else {
 
-    // Populate plane
-    plane->diffuse_color = diffuseColor;
-    plane->specular_color = specularColor;
-    plane->position = position;
-    plane->normal = normal;
-    plane->reflectivity = reflectivity;
-    plane->refractivity = refractivity;
-    plane->ior = ior;
+  int errorStatus = parseObject((object_t *) plane, &fields);
+  if (errorStatus != 0) {
+    return errorStatus;
+  }
 
-    vector3_normalize(plane->normal);
+  plane->normal = vec3_normalize(fieldVector(&fields, FIELD_NORMAL));
 
-    return 0;
-  }
+  return 0;
 }
 
 
-// return NULL == error, otherwise return array of numObjects
-int *parseInput(camera_t *camera, object_t **scene,
-                light_t **lights, FILE *file) {
+// Where a visible object was stored while its array may still move
+typedef struct object_ref_t {
+  int kind;
+  int index;
+} object_ref_t;
+
 
-  // Incrementers
-  int *numObjects = malloc(sizeof(int)*2);
-  numObjects[0] = 0; // Total number of scene objects
-  numObjects[1] = 0; // Total number of scene lights
-  int lineNumber = 1;
+int parseInput(camera_t *camera, scene_storage_t *storage, arena_t *arena,
+               FILE *file) {
+
+  memset(storage, 0, sizeof(scene_storage_t));
+  int lineNumber = 0;
+
+  // Every array grows as objects are found
+  int sphereCapacity = INITIAL_SCENE_CAPACITY;
+  int planeCapacity = INITIAL_SCENE_CAPACITY;
+  int lightCapacity = INITIAL_SCENE_CAPACITY;
+  int refCapacity = INITIAL_SCENE_CAPACITY;
+  storage->spheres = arenaAlloc(arena, sizeof(sphere_t) * sphereCapacity);
+  storage->planes = arenaAlloc(arena, sizeof(plane_t) * planeCapacity);
+  storage->lights = arenaAlloc(arena, sizeof(light_t) * lightCapacity);
+  object_ref_t *refs = arenaAlloc(arena, sizeof(object_ref_t) * refCapacity);
+  if (storage->spheres == NULL || storage->planes == NULL ||
+      storage->lights == NULL || refs == NULL) {
+    return ARENA_ALLOC_ERROR;
+  }
 
-  int errorStatus = 0;
   int cameraFound = 1; // Default to false
-  char line[MAX_LINE_LENGTH];
+  char *line = NULL; // Grows to fit the longest line
+  size_t lineCapacity = 0;
 
-  while (fgets(line, MAX_LINE_LENGTH, file) != NULL) {
+  while (getline(&line, &lineCapacity, file) != -1) {
 
-    if (line[0] == '\n' || line[0] == '\r') continue; // Skip blank lines
+    lineNumber += 1;
+    int errorStatus = 0;
+
+    // Get object type, skipping blank lines
+    char *kind = line;
+    while (isspace((unsigned char) *kind)) kind++;
+    if (*kind == '\0') continue;
 
-    // Get object type
-    char objectType[20];
-    sscanf(line, " %19[a-zA-Z]", objectType);
+    size_t kindLength = 0;
+    while (isalpha((unsigned char) kind[kindLength])) kindLength++;
 
-    // Determine which parse function to use by objectType
-    if (strcmp(objectType, "camera") == 0) {
+    // Determine which parse function to use by object type. Objects are
+    // parsed straight in to the next free slot, which is only kept on success
+    if (kindLength == 6 && strncmp(kind, "camera", 6) == 0) {
       errorStatus = parseCamera(camera, line);
 
       // If no error, reset flag
       if (errorStatus == 0)
         cameraFound = 0;
     }
-    else if (strcmp(objectType, "light") == 0) {
-      light_t *light = malloc(sizeof(light_t));
-      errorStatus = parseLight(light, line);
+    else if (kindLength == 5 && strncmp(kind, "light", 5) == 0) {
+      storage->lights = growArray(arena, storage->lights,
+                                  storage->numLights, &lightCapacity,
+                                  sizeof(light_t));
+      if (storage->lights == NULL) break;
+      errorStatus = parseLight(&storage->lights[storage->numLights], line);
 
       // If no error, save object
       if (errorStatus == 0)
-        lights[numObjects[1]++] = (light_t *) light;
+        storage->numLights++;
     }
 
     // Handle scene objects
-    else if (strcmp(objectType, "sphere") == 0) {
-      sphere_t *sphere = malloc(sizeof(sphere_t));
-      errorStatus = parseSphere(sphere, line);
+    else if (kindLength == 6 && strncmp(kind, "sphere", 6) == 0) {
+      storage->spheres = growArray(arena, storage->spheres,
+                                   storage->numSpheres, &sphereCapacity,
+                                   sizeof(sphere_t));
+      if (storage->spheres == NULL) break;
+      errorStatus = parseSphere(&storage->spheres[storage->numSpheres], line);
 
       // If no error, save object
       if (errorStatus == 0) {
-        scene[numObjects[0]++] = (object_t *) sphere;
+        refs = growArray(arena, refs, storage->numObjects, &refCapacity,
+                         sizeof(object_ref_t));
+        if (refs == NULL) break;
+        refs[storage->numObjects].kind = OBJECT_KIND_SPHERE;
+        refs[storage->numObjects++].index = storage->numSpheres++;
       }
     }
-    else if (strcmp(objectType, "plane") == 0) {
-      plane_t *plane = malloc(sizeof(plane_t));
-      errorStatus = parsePlane(plane, line);
+    else if (kindLength == 5 && strncmp(kind, "plane", 5) == 0) {
+      storage->planes = growArray(arena, storage->planes,
+                                  storage->numPlanes, &planeCapacity,
+                                  sizeof(plane_t));
+      if (storage->planes == NULL) break;
+      errorStatus = parsePlane(&storage->planes[storage->numPlanes], line);
 
       // If no error, save object
       if (errorStatus == 0) {
-        scene[numObjects[0]++] = (object_t *) plane;
+        refs = growArray(arena, refs, storage->numObjects, &refCapacity,
+                         sizeof(object_ref_t));
+        if (refs == NULL) break;
+        refs[storage->numObjects].kind = OBJECT_KIND_PLANE;
+        refs[storage->numObjects++].index = storage->numPlanes++;
       }
     }
 
     if (errorStatus != 0) {
       fprintf(stdout, "Warning: Invalid object on line %d of CSV\n", lineNumber);
     }
+  }
 
-    lineNumber += 1;
+  free(line);
+
+  // The arrays have stopped moving, so objects can be pointed at
+  storage->objects = arenaAlloc(arena, sizeof(object_t *) *
+                                       (storage->numObjects + 1));
+
+  // A failed grow leaves its array NULL and ends the loop early
+  if (storage->spheres == NULL || storage->planes == NULL ||
+      storage->lights == NULL || refs == NULL || storage->objects == NULL) {
+    return ARENA_ALLOC_ERROR;
+  }
+  for (int i = 0; i < storage->numObjects; i++) {
+    if (refs[i].kind == OBJECT_KIND_SPHERE) {
+      storage->objects[i] = (object_t *) &storage->spheres[refs[i].index];
+    }
+    else {
+      storage->objects[i] = (object_t *) &storage->planes[refs[i].index];
+    }
   }
 
   // Ensure that a camera was found
   if (cameraFound != 0) {
-    return NULL;
+    return INVALID_PARSE_LINE;
   }
-  else return numObjects;
+  else return 0;
 }
+
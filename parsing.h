@@ -5,7 +5,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h> // isspace, isalpha
 #include "vector.h"
+#include "arena.h"
 
 // Define constants
 #define OBJECT_KIND_CAMERA 1
@@ -19,7 +21,7 @@
 #define INVALID_PARSE_LINE -4
 
 // Numeric constants
-#define MAX_LINE_LENGTH 256
+#define INITIAL_SCENE_CAPACITY 64 // Object and light arrays double from here
 
 // Define types to be used in c file
 typedef struct object_t object_t;
@@ -27,44 +29,60 @@ typedef struct camera_t camera_t;
 typedef struct sphere_t sphere_t;
 typedef struct plane_t plane_t;
 typedef struct light_t light_t;
+typedef struct scene_storage_t scene_storage_t;
 
 
+// Vectors are stored inline, so each struct is one contiguous record. The
+// data intersection tests read is copied out again in to the kernel arrays,
+// leaving these records for shading
+
 struct camera_t {
-  double width;
-  double height;
-  vector3_t position;
+  real_t width;
+  real_t height;
+  vec3_t position;
 };
 
 struct object_t { // Parent class of visible scene objects
   int kind;
-  vector3_t diffuse_color;
-  vector3_t specular_color;
-  vector3_t position;
-  double reflectivity;
-  double refractivity;
-  double ior;
+  vec3_t diffuse_color;
+  vec3_t specular_color;
+  vec3_t position;
+  real_t reflectivity;
+  real_t refractivity;
+  real_t ior;
 };
 
 struct sphere_t {
   struct object_t;
-  double radius;
+  real_t radius;
 };
 
 struct plane_t {
   struct object_t;
-  vector3_t normal;
+  vec3_t normal;
 };
 
 struct light_t {
   int kind;
-  vector3_t position;
-  vector3_t color;
-  double radial_a2;
-  double radial_a1;
-  double radial_a0;
-  double theta;
-  double angular_a0;
-  vector3_t direction;
+  vec3_t position;
+  vec3_t color;
+  real_t radial_a2;
+  real_t radial_a1;
+  real_t radial_a0;
+  real_t theta;
+  real_t angular_a0;
+  vec3_t direction;
+};
+
+struct scene_storage_t { // Every object and light, packed by kind
+  sphere_t *spheres;
+  int numSpheres;
+  plane_t *planes;
+  int numPlanes;
+  light_t *lights;
+  int numLights;
+  object_t **objects; // Visible objects in file order, in to the arrays above
+  int numObjects;
 };
 
 
@@ -105,16 +123,19 @@ int parseSphere(sphere_t *sphere, char *line);
 int parsePlane(plane_t *plane, char *line);
 
 /**
- * Parse CSV file in to an object array describing the world scene.
+ * Parse CSV file in to packed arrays describing the world scene.
+ * Lines may be any length, and the arrays are allocated from the
+ * arena and grow to fit the scene.
  * 
- * @param  camera  pointer to output camera
- * @param  scene   array of objects describing the world
- * @param  lights  array of light objects in the world
- * @param  file    CSV file to parse for object data
- * @return         number of objects tuple, [objects, lights]
- *                 NULL is an error
+ * @param  camera   pointer to output camera
+ * @param  storage  output objects and lights of the world
+ * @param  arena    arena that owns the scene's arrays
+ * @param  file     CSV file to parse for object data
+ * @return          error status of parsing, INVALID_PARSE_LINE when
+ *                  no camera was found, ARENA_ALLOC_ERROR when the arena
+ *                  ran out
  */
-int *parseInput(camera_t *camera, object_t **scene,
-                light_t **lights, FILE *file);
+int parseInput(camera_t *camera, scene_storage_t *storage, arena_t *arena,
+               FILE *file);
 
 #endif  // PARSING_H
@@ -4,16 +4,17 @@
 
 int getNextString(char *output, FILE *file) {
 
-  output[0] = 0; // Initialize input
+  int length = 0; // Characters saved to the output so far
   int isComment = 0; // Flag used to indicate comments
-  char symbol;
+  int symbol;
 
   // Skip leading white space and comments
   while (1) {
-    symbol = fgetc(file);
+    symbol = getc(file);
 
     // If we hit an EOF before a non-whitespace character
     if (symbol == EOF) {
+      output[0] = '\0';
       return NO_STRING_FOUND;
     }
 
@@ -28,24 +29,22 @@ int getNextString(char *output, FILE *file) {
         isComment = 1; // Enable comment flag
       }
       else {
-        snprintf(output, STRING_MAX_BUFFER, "%s%c", output, symbol);
+        output[length++] = symbol;
         break;
       }
     }
   }
 
-  // Copy all characters to the output until we hit another whitespace or EOF
-  while ((symbol = fgetc(file)) != EOF && !isspace(symbol)) {
-    snprintf(output, STRING_MAX_BUFFER, "%s%c", output, symbol);
+  // Copy all characters to the output until we hit another whitespace or EOF,
+  // dropping anything that doesn't fit in the buffer
+  while ((symbol = getc(file)) != EOF && !isspace(symbol)) {
+    if (length < STRING_MAX_BUFFER - 1) {
+      output[length++] = symbol;
+    }
   }
 
-  // If we instantly hit EOF after skipping whitespace, there was no real string
-  if (symbol == EOF && output[0] == '\0') {
-    return NO_STRING_FOUND;
-  }
-  else {
-    return 0;
-  }
+  output[length] = '\0';
+  return 0;
 }
 
 
@@ -54,7 +53,7 @@ int readPPM(ppm_t *output, FILE *file) {
   int errorStatus;
 
   // Temporary variables used to store strings that are found
-  char magicNumber[2];
+  char magicNumber[STRING_MAX_BUFFER];
   char width[STRING_MAX_BUFFER];
   char height[STRING_MAX_BUFFER];
   char maxColorValue[STRING_MAX_BUFFER];
@@ -104,6 +103,8 @@ int readPPM(ppm_t *output, FILE *file) {
 
   // Allocate memory for pixel array on object
   output->pixels = malloc(sizeof(pixel_t)*output->width*output->height);
+  output->mapping = NULL;
+  output->mappingSize = 0;
 
   // If the magic number is P6, read the binary straight into the array
   if (strcmp(magicNumber, "P6") == 0) {
@@ -125,25 +126,236 @@ int readPPM(ppm_t *output, FILE *file) {
 }
 
 
+// Skip white space and comments in a mapped header, returning the offset of
+// the next token or size if there isn't one
+static size_t skipHeaderSpace(const unsigned char *data, size_t i,
+                              size_t size) {
+  while (i < size) {
+    if (data[i] == '#') {
+      while (i < size && data[i] != '\n') i++;
+    }
+    else if (isspace(data[i])) {
+      i++;
+    }
+    else {
+      break;
+    }
+  }
+  return i;
+}
+
+
+// Read a non-negative decimal from a mapping, returning -1 if there are no
+// digits or the value doesn't fit in an int
+static int readMappedInt(const unsigned char *data, size_t *i, size_t size) {
+  size_t start = *i;
+  long value = 0;
+
+  while (*i < size && data[*i] >= '0' && data[*i] <= '9') {
+    value = value*10 + (data[*i] - '0');
+    if (value > 0x7fffffff) return -1;
+    (*i)++;
+  }
+
+  // Numbers must be followed by white space or the end of the file
+  if (*i == start || (*i < size && !isspace(data[*i]))) return -1;
+  return (int) value;
+}
+
+
+int mapPPM(ppm_t *output, const char *path) {
+
+  output->pixels = NULL;
+  output->mapping = NULL;
+  output->mappingSize = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return MALFORMED_HEADER;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size < 2) {
+    close(fd);
+    return MALFORMED_HEADER;
+  }
+  size_t size = info.st_size;
+
+  // Map privately with write access so callers may edit P6 pixels in place
+  // without touching the file
+  unsigned char *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                             fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return MALFORMED_HEADER;
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  int isBinary = (data[0] == 'P' && data[1] == '6');
+  int isAscii = (data[0] == 'P' && data[1] == '3');
+  size_t i = 2;
+
+  // Parse the header values in the same order as readPPM
+  int values[3] = {-1, -1, -1};
+  for (int j = 0; j < 3 && (isBinary || isAscii); j++) {
+    i = skipHeaderSpace(data, i, size);
+    values[j] = readMappedInt(data, &i, size);
+  }
+
+  output->width = values[0];
+  output->height = values[1];
+  output->maxColorValue = values[2];
+
+  if ((!isBinary && !isAscii) ||
+      output->width <= 0 ||
+      output->height <= 0 ||
+      output->maxColorValue <= 0 ||
+      output->maxColorValue > 255) {
+    munmap(data, size);
+    return MALFORMED_HEADER;
+  }
+
+  size_t count = (size_t) output->width*output->height;
+
+  // Binary pixels follow a single white space character, so use them in place
+  if (isBinary) {
+    i++;
+    if (i > size || size - i < count*sizeof(pixel_t)) {
+      munmap(data, size);
+      return MALFORMED_HEADER;
+    }
+    output->pixels = (pixel_t *) (data + i);
+    output->mapping = data;
+    output->mappingSize = size;
+    return 0;
+  }
+
+  // ASCII pixels need converting, but can be parsed without any copies
+  output->pixels = malloc(sizeof(pixel_t)*count);
+  if (output->pixels == NULL) {
+    munmap(data, size);
+    return MALFORMED_HEADER;
+  }
+  unsigned char *channel = (unsigned char *) output->pixels;
+  for (size_t j = 0; j < count*3; j++) {
+    i = skipHeaderSpace(data, i, size);
+    int value = readMappedInt(data, &i, size);
+    if (value < 0 || value > output->maxColorValue) {
+      free(output->pixels);
+      output->pixels = NULL;
+      munmap(data, size);
+      return MALFORMED_HEADER;
+    }
+    channel[j] = value;
+  }
+
+  munmap(data, size);
+  return 0;
+}
+
+
+void freePPM(ppm_t *image) {
+  if (image->mapping != NULL) {
+    munmap(image->mapping, image->mappingSize);
+  }
+  else {
+    free(image->pixels);
+  }
+  image->pixels = NULL;
+  image->mapping = NULL;
+  image->mappingSize = 0;
+}
+
+
 int writePPM(ppm_t *image, FILE *file, int newFormat) {
 
+  return writePPMHeader(image, file, newFormat) ||
+         writePPMPixels(image->pixels, (size_t) image->width*image->height,
+                        file, newFormat);
+}
+
+
+int writePPMHeader(ppm_t *image, FILE *file, int newFormat) {
+
   // Populate header
-  fprintf(file, "P%d\n", newFormat);
-  fprintf(file, "%d %d\n", image->width, image->height);
-  fprintf(file, "%d\n", image->maxColorValue);
+  if (fprintf(file, "P%d\n", newFormat) < 0 ||
+      fprintf(file, "%d %d\n", image->width, image->height) < 0 ||
+      fprintf(file, "%d\n", image->maxColorValue) < 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+
+// Write a whole buffer straight to the file descriptor behind a handle
+static int writeAll(FILE *file, const char *buffer, size_t size) {
+
+  int fd = fileno(file);
+
+  while (size > 0) {
+    ssize_t written = write(fd, buffer, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    buffer += written;
+    size -= written;
+  }
+
+  return 0;
+}
+
 
-  // Print out the pixel data
+int writePPMPixels(pixel_t *pixels, size_t count, FILE *file,
+                   int newFormat) {
+
+  // Anything still sitting in the stdio buffer (the header) goes first
+  if (fflush(file) != 0) {
+    return -1;
+  }
+
+  // Binary pixels are already in file order
   if (newFormat == 6) {
-    fwrite(image->pixels, sizeof(pixel_t), image->width*image->height, file);
+    return writeAll(file, (const char *) pixels, sizeof(pixel_t) * count);
   }
-  else {
-    for (int i = 0; i < image->width*image->height; i++) {
-      fprintf(file, "%d %d %d\n",
-        image->pixels[i].r,
-        image->pixels[i].g,
-        image->pixels[i].b);
+
+  // Decimal text of every channel value, cheap enough to build per call
+  char digits[256][4];
+  unsigned char lengths[256];
+  for (int i = 0; i < 256; i++) {
+    int n = 0;
+    if (i >= 100) digits[i][n++] = '0' + i / 100;
+    if (i >= 10) digits[i][n++] = '0' + i / 10 % 10;
+    digits[i][n++] = '0' + i % 10;
+    lengths[i] = n;
+  }
+
+  // Format "r g b\n" lines in to a large buffer and write it in one go
+  char *buffer = malloc(WRITE_BUFFER_SIZE);
+  if (buffer == NULL) {
+    return -1;
+  }
+  size_t used = 0;
+  int errorStatus = 0;
+
+  for (size_t i = 0; i < count && errorStatus == 0; i++) {
+    unsigned char channels[3] = { pixels[i].r, pixels[i].g, pixels[i].b };
+
+    for (int k = 0; k < 3; k++) {
+      memcpy(buffer + used, digits[channels[k]], 4);
+      used += lengths[channels[k]];
+      buffer[used++] = k == 2 ? '\n' : ' ';
+    }
+
+    // Longest line is 12 bytes, so flush while there is room for another
+    if (used > WRITE_BUFFER_SIZE - 16) {
+      errorStatus = writeAll(file, buffer, used);
+      used = 0;
     }
   }
 
-  return 0;
+  if (errorStatus == 0) {
+    errorStatus = writeAll(file, buffer, used);
+  }
+
+  free(buffer);
+
+  return errorStatus;
 }
@@ -7,12 +7,18 @@
 
 // Numeric constants
 #define STRING_MAX_BUFFER 32
+#define WRITE_BUFFER_SIZE (1 << 20) // Bytes formatted before each write
 
 // Include standard libraries
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h> // isspace
+#include <errno.h> // EINTR
+#include <unistd.h> // write, close
+#include <fcntl.h> // open
+#include <sys/mman.h> // mmap, madvise, munmap
+#include <sys/stat.h> // fstat
 
 // Define types to be used in ppmrw.c 
 typedef struct pixel_t pixel_t;
@@ -27,6 +33,8 @@ struct ppm_t {
   int height;
   int maxColorValue;
   pixel_t* pixels;
+  void *mapping; // File mapping pixels point in to, NULL when malloc'd
+  size_t mappingSize;
 };
 
 
@@ -50,6 +58,25 @@ int getNextString(char *output, FILE *file);
  */
 int readPPM(ppm_t *output, FILE *file);
 
+/**
+ * Maps the file at the given path in to memory and outputs a PPMImage
+ * structure. P6 pixels point straight in to the mapping rather than being
+ * copied, P3 pixels are parsed from the mapping in to a new array
+ *
+ * @param  output  pointer to a ppm_t structure with the image data
+ * @param  path    path of the file to be mapped
+ * @return         success status of function, MALFORMED_HEADER on header error
+ */
+int mapPPM(ppm_t *output, const char *path);
+
+/**
+ * Releases the pixel data of an image from readPPM or mapPPM, unmapping
+ * the file if the pixels live in one
+ *
+ * @param  image  pointer to a ppm_t structure to release
+ */
+void freePPM(ppm_t *image);
+
 /**
  * Writes the image data from the PPMImage structure to the given file
  * handle, including appropriate meta data
@@ -61,4 +88,28 @@ int readPPM(ppm_t *output, FILE *file);
  */
 int writePPM(ppm_t *image, FILE *file, int newFormat);
 
+/**
+ * Writes only the meta data of a PPM to the given file handle, so that
+ * pixel data can follow in pieces with writePPMPixels
+ *
+ * @param  image      pointer to a ppm_t structure, pixels are not used
+ * @param  file       file to be written to
+ * @param  newFormat  the PPM format to write the file
+ * @return            success status of function
+ */
+int writePPMHeader(ppm_t *image, FILE *file, int newFormat);
+
+/**
+ * Writes a run of pixels to the given file handle, following on from
+ * the header or from the previous run
+ *
+ * @param  pixels     pixels to write, in row major order
+ * @param  count      number of pixels to write
+ * @param  file       file to be written to
+ * @param  newFormat  the PPM format to write the file
+ * @return            success status of function
+ */
+int writePPMPixels(pixel_t *pixels, size_t count, FILE *file,
+                   int newFormat);
+
 #endif  // PPMRW_H
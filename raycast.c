@@ -2,331 +2,2433 @@
 #include "raycast.h"
 
 
-double rayObjectIntersect(object_t **outObject, vector3_t origin,
-                          vector3_t direction, object_t **scene,
-                          int numObjects) {
+real_t rayObjectIntersect(object_t **outObject, vec3_t origin,
+                          vec3_t direction, real_t tMax, scene_t *scene) {
+
+  // Without a hierarchy every object is tested, a vector at a time
+  real_t t = scene->bvh != NULL ?
+             bvhIntersect(scene->bvh, outObject, origin, direction, tMax) :
+             primitiveListIntersect(scene->list, outObject, origin,
+                                    direction, tMax);
+
+  COUNTERS_ADD(hits, t != NO_INTERSECTION_FOUND);
+  COUNTERS_ADD(misses, t == NO_INTERSECTION_FOUND);
+  return t;
+}
+
+
+int rayOccluded(vec3_t origin, vec3_t direction, real_t tMax,
+                scene_t *scene) {
+
+  int occluded = scene->bvh != NULL ?
+                 bvhOccluded(scene->bvh, origin, direction, tMax) :
+                 primitiveListOccluded(scene->list, origin, direction, tMax);
+
+  COUNTERS_ADD(shadowRays, 1);
+  COUNTERS_ADD(occluded, occluded);
+  return occluded;
+}
+
+
+int rayPacketIntersect(object_t **outObjects, real_t *outT,
+                       const ray_packet_t *packet, scene_t *scene) {
+
+  int hits = scene->bvh != NULL ?
+             bvhIntersectPacket(scene->bvh, packet, outObjects, outT) :
+             primitiveListIntersectPacket(scene->list, packet, outObjects,
+                                          outT);
+
+  COUNTERS_ADD(hits, __builtin_popcount(hits));
+  COUNTERS_ADD(misses, __builtin_popcount(packet->mask & ~hits));
+  return hits;
+}
+
+
+int rayPacketOccluded(const ray_packet_t *packet, scene_t *scene) {
+
+  int blocked = scene->bvh != NULL ?
+                bvhOccludedPacket(scene->bvh, packet) :
+                primitiveListOccludedPacket(scene->list, packet);
+
+  COUNTERS_ADD(shadowRays, __builtin_popcount(packet->mask));
+  COUNTERS_ADD(occluded, __builtin_popcount(blocked));
+  return blocked;
+}
+
+
+// Fill in everything needed to shade a frame whose ray hit an object
+static void hitFrame(ray_frame_t *frame, object_t *object, real_t t,
+                     vec3_t direction, int level, render_options_t *options) {
+
+  frame->object = object;
+  frame->ovDirection = vec3_scale(direction, -1);
+
+  // Get intersection point
+  frame->intersect = vec3_add(vec3_scale(direction, t), frame->origin);
+
+  // Get object properties
+  vec3_t normal = vec3_make(0, 0, 0);
+  if (object->kind == OBJECT_KIND_SPHERE) {
+    normal = vec3_sub(frame->intersect, ((sphere_t *) object)->position);
+    normal = vec3_normalize(normal);
+  }
+  else if (object->kind == OBJECT_KIND_PLANE) {
+    normal = ((plane_t *) object)->normal;
+  }
+  frame->normal = normal;
+
+  // Calculate the object intersect origin by shifting intersect off object
+  frame->intersectOffset = vec3_add(frame->intersect,
+                                    vec3_scale(normal, EPSILON_OFFSET));
+
+  // Weights of the secondary rays, zero when they aren't worth casting
+  frame->reflectWeight = frame->weight * object->reflectivity;
+  frame->refractWeight = frame->weight * object->refractivity;
+  if (frame->reflectWeight < options->minWeight ||
+      level >= options->maxDepth) {
+    frame->reflectWeight = 0;
+  }
+  if (frame->refractWeight < options->minWeight ||
+      level >= options->maxDepth) {
+    frame->refractWeight = 0;
+  }
+}
+
+
+static void clearFrame(ray_frame_t *frame) {
+  frame->object = NULL; // Nothing hit yet
+  frame->color = vec3_make(0, 0, 0); // Void color
+  frame->reflectColor = vec3_make(0, 0, 0); // Reflection color
+  frame->refractColor = vec3_make(0, 0, 0); // Refraction color
+}
+
+
+// Find what a frame's ray hits and everything needed to shade it. Returns
+// 0 when the ray leaves the scene, leaving the frame's color black
+static int traceFrame(ray_frame_t *frame, vec3_t direction, int level,
+                      scene_t *scene, render_options_t *options) {
+
+  clearFrame(frame);
+  countersLevel(level, 1);
+
+  // Find the intersection point with the nearest object
+  object_t *object;
+  real_t t = rayObjectIntersect(&object, frame->origin, direction, INFINITY,
+                                scene);
+
+  // If we did not hit any objects, the pixel is in the void
+  if (t == NO_INTERSECTION_FOUND) {
+    return 0;
+  }
+
+  hitFrame(frame, object, t, direction, level, options);
+  return 1;
+}
+
+
+// Direction of the mirror reflection off a frame's intersection point
+static vec3_t reflectDirection(ray_frame_t *frame) {
+  vec3_t ovDirection = frame->ovDirection;
+  vec3_t normal = frame->normal;
+
+  // Calculate reflection vector
+  vec3_t reflection = vec3_sub(
+      vec3_scale(normal, 2*vec3_dot(ovDirection, normal)), ovDirection);
+  return vec3_normalize(reflection);
+}
+
+
+// Direction of the ray refracted through a frame's intersection point
+static vec3_t refractDirection(ray_frame_t *frame) {
+  vec3_t ovDirection = frame->ovDirection;
+  vec3_t normal = frame->normal;
+
+  vec3_t tangent = vec3_normalize(vec3_cross(normal, ovDirection));
+  tangent = vec3_cross(tangent, normal);
+
+  real_t sinPhi = vec3_dot(vec3_scale(ovDirection,
+                                      frame->extIor / frame->object->ior),
+                           tangent);
+  real_t cosPhi = sqrt(1 - pow(sinPhi, 2));
+
+  return vec3_add(vec3_scale(normal, -cosPhi), vec3_scale(tangent, sinPhi));
+}
+
+
+// Get the unit vector from a frame's intersection point to a light,
+// returning the distance to the light
+static real_t lightDirection(vec3_t *olDirection, ray_frame_t *frame,
+                             light_t *light) {
+
+  // Get object to light vector and distance
+  *olDirection = vec3_sub(light->position, frame->intersect);
+  real_t lDistance = vec3_mag(*olDirection);
+  *olDirection = vec3_scale(*olDirection, 1 / lDistance); // Normalize dir
+  return lDistance;
+}
+
+
+// Add the light reaching a frame's intersection point from one light that
+// nothing blocks to a color
+static void addLight(vec3_t *color, ray_frame_t *frame, light_t *light,
+                     vec3_t olDirection, real_t lDistance) {
+
+  object_t *object = frame->object;
+  vec3_t normal = frame->normal;
+  vec3_t lightColor = light->color;
+
+  // Calculate light reflection vector
+  vec3_t lReflection = vec3_sub(
+      vec3_scale(normal, 2*vec3_dot(olDirection, normal)), olDirection);
+  lReflection = vec3_normalize(lReflection);
+
+  // Calculate the attentuation factors
+  real_t frad = radialAttenuation(light, lDistance);
+  real_t fang = angularAttenuation(light, olDirection);
+
+  // Calculate the diffuse and specular light contributions
+  vec3_t diff = diffuseReflection(object->diffuse_color, lightColor, normal,
+                                  olDirection);
+  vec3_t spec = specularReflection(object->specular_color, lightColor,
+                                   frame->ovDirection, lReflection, 20);
+
+  // Add to color channels
+  color->x += frad * fang * (diff.x + spec.x);
+  color->y += frad * fang * (diff.y + spec.y);
+  color->z += frad * fang * (diff.z + spec.z);
+}
+
+
+// Combine the direct light at a frame with the colors its children returned
+static vec3_t shadeFrame(ray_frame_t *frame, vec3_t light) {
+
+  object_t *object = frame->object;
+  real_t illumination = 1.0 - object->reflectivity - object->refractivity;
+  vec3_t reflectColor = frame->reflectColor;
+  vec3_t refractColor = frame->refractColor;
+  vec3_t color;
+
+  // Calculate and clamp final color values
+  color.x = clampValue(illumination*light.x +
+                       object->reflectivity*reflectColor.x +
+                       object->refractivity*refractColor.x, 0.0, 1.0);
+  color.y = clampValue(illumination*light.y +
+                       object->reflectivity*reflectColor.y +
+                       object->refractivity*refractColor.y, 0.0, 1.0);
+  color.z = clampValue(illumination*light.z +
+                       object->reflectivity*reflectColor.z +
+                       object->refractivity*refractColor.z, 0.0, 1.0);
+
+  return color;
+}
+
+
+// Set up the frame of a camera ray
+static void rootFrame(ray_frame_t *frame, vec3_t origin) {
+  frame->origin = origin;
+  frame->weight = 1.0;
+  frame->extIor = DEFAULT_IOR;
+  frame->inObject = NULL;
+}
+
+
+// Walk the ray tree below a traced camera ray in stack[0]. rootOccluded
+// holds the shadow test of each light for the camera ray's hit when it was
+// already done, or is NULL
+static vec3_t evaluateTree(ray_frame_t *stack, scene_t *scene,
+                           render_options_t *options,
+                           const int *rootOccluded) {
+
+  // The stack holds the path from the camera ray to the ray being traced,
+  // so it never needs more than one frame per level
+  int top = 0;
+
+  while (1) {
+    ray_frame_t *frame = &stack[top];
+    ray_frame_t *child = &stack[top + 1];
+    object_t *object = frame->object;
+
+    if (frame->stage == RAY_STAGE_REFLECT) {
+      frame->stage = RAY_STAGE_REFRACT;
+      if (frame->reflectWeight == 0) {
+        continue;
+      }
+
+      COUNTERS_ADD(reflectRays, 1);
+      child->origin = frame->intersectOffset;
+      child->weight = frame->reflectWeight;
+      child->extIor = frame->extIor;
+      child->inObject = NULL;
+      child->stage = traceFrame(child, reflectDirection(frame), top + 2,
+                                scene, options) ?
+                     RAY_STAGE_REFLECT : RAY_STAGE_DONE;
+      top++;
+    }
+    else if (frame->stage == RAY_STAGE_REFRACT) {
+      frame->stage = RAY_STAGE_SHADE;
+      if (frame->refractWeight == 0) {
+        continue;
+      }
+
+      COUNTERS_ADD(refractRays, 1);
+      child->origin = frame->intersectOffset;
+      child->weight = frame->refractWeight;
+      child->extIor = object->ior;
+      child->inObject = object == frame->inObject ? NULL : object;
+      child->stage = traceFrame(child, refractDirection(frame), top + 2,
+                                scene, options) ?
+                     RAY_STAGE_REFLECT : RAY_STAGE_DONE;
+      top++;
+    }
+    else {
+      if (frame->stage == RAY_STAGE_SHADE) {
+
+        // Only color the object from lights nothing sits in front of
+        vec3_t light = vec3_make(0, 0, 0); // No ambient light
+        for (int i = 0; i < scene->numLights; i++) {
+          vec3_t olDirection;
+          real_t lDistance = lightDirection(&olDirection, frame,
+                                            &scene->lights[i]);
+          int occluded = top == 0 && rootOccluded != NULL ?
+                         rootOccluded[i] :
+                         rayOccluded(frame->intersectOffset, olDirection,
+                                     lDistance, scene);
+          if (!occluded) {
+            addLight(&light, frame, &scene->lights[i], olDirection,
+                     lDistance);
+          }
+        }
+        frame->color = shadeFrame(frame, light);
+      }
+
+      // Hand the finished color back to the ray that cast this one
+      if (top == 0) {
+        return frame->color;
+      }
+      top--;
+      if (stack[top].stage == RAY_STAGE_REFRACT) {
+        stack[top].reflectColor = frame->color;
+      }
+      else {
+        stack[top].refractColor = frame->color;
+      }
+    }
+  }
+}
+
+
+vec3_t raycast(vec3_t origin, vec3_t direction, scene_t *scene,
+               render_options_t *options, ray_frame_t *stack) {
+
+  COUNTERS_ADD(primaryRays, 1);
+  rootFrame(&stack[0], origin);
+  stack[0].stage = traceFrame(&stack[0], direction, 1, scene, options) ?
+                   RAY_STAGE_REFLECT : RAY_STAGE_DONE;
+
+  return evaluateTree(stack, scene, options, NULL);
+}
+
+
+void raycastPacket(vec3_t *colors, object_t **hitObjects, vec3_t origin,
+                   const ray_packet_t *packet, scene_t *scene,
+                   render_options_t *options, ray_frame_t *stack,
+                   int *occluded) {
+
+  ray_frame_t roots[PACKET_WIDTH];
+  object_t *objects[PACKET_WIDTH];
+  real_t t[PACKET_WIDTH];
+  int hits = rayPacketIntersect(objects, t, packet, scene);
+  COUNTERS_ADD(primaryRays, __builtin_popcount(packet->mask));
+  countersLevel(1, __builtin_popcount(packet->mask));
+
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    if (hits & (1 << k)) {
+      vec3_t direction = vec3_make(packet->dx[k], packet->dy[k],
+                                   packet->dz[k]);
+      rootFrame(&roots[k], origin);
+      clearFrame(&roots[k]);
+      hitFrame(&roots[k], objects[k], t[k], direction, 1, options);
+    }
+  }
+
+  // Shadow rays from the hits to one light are close together too
+  for (int i = 0; i < scene->numLights && hits != 0; i++) {
+    ray_packet_t shadows;
+    memset(&shadows, 0, sizeof(shadows));
+    shadows.mask = hits;
+
+    for (int k = 0; k < PACKET_WIDTH; k++) {
+      if (hits & (1 << k)) {
+        vec3_t olDirection;
+        shadows.tMax[k] = lightDirection(&olDirection, &roots[k],
+                                         &scene->lights[i]);
+        shadows.ox[k] = roots[k].intersectOffset.x;
+        shadows.oy[k] = roots[k].intersectOffset.y;
+        shadows.oz[k] = roots[k].intersectOffset.z;
+        shadows.dx[k] = olDirection.x;
+        shadows.dy[k] = olDirection.y;
+        shadows.dz[k] = olDirection.z;
+      }
+    }
+
+    int blocked = rayPacketOccluded(&shadows, scene);
+    for (int k = 0; k < PACKET_WIDTH; k++) {
+      occluded[k*scene->numLights + i] = (blocked >> k) & 1;
+    }
+  }
+
+  // Reflections and refractions part ways, so each tree goes on alone
+  for (int k = 0; k < PACKET_WIDTH; k++) {
+    colors[k] = vec3_make(0, 0, 0); // Void color
+    hitObjects[k] = hits & (1 << k) ? objects[k] : NULL;
+    if (hits & (1 << k)) {
+      stack[0] = roots[k];
+      stack[0].stage = RAY_STAGE_REFLECT;
+      colors[k] = evaluateTree(stack, scene, options,
+                               &occluded[k*scene->numLights]);
+    }
+  }
+}
+
+
+// Append one item to a queue grown from an arena, returning its slot or
+// NULL when the queue could not grow
+static void *queuePush(arena_t *arena, void **queue, int *count,
+                       int *capacity, size_t itemSize) {
+  if (*count == *capacity) {
+    int newCapacity = *capacity == 0 ? WAVE_QUEUE_CAPACITY : *capacity * 2;
+    void *grown = arenaGrow(arena, *queue, itemSize * *capacity,
+                            itemSize * newCapacity);
+    if (grown == NULL) return NULL;
+    *queue = grown;
+    *capacity = newCapacity;
+  }
+  return (char *) *queue + itemSize * (*count)++;
+}
+
+
+int wavefrontTrace(wave_queue_t *queue, vec3_t *colors,
+                   object_t **hitObjects, vec3_t origin,
+                   const vec3_t *directions, int count, scene_t *scene,
+                   render_options_t *options) {
+
+  // Every ray of every tree stays in one queue, each bounce appended after
+  // the one before, so children always come after their parents
+  arena_t *scratch = queue->arena;
+  wave_ray_t *rays = queue->rays;
+  int numRays = 0;
+  int rayCapacity = queue->rayCapacity;
+  shadow_ray_t *shadows = queue->shadows;
+  int numShadows = 0;
+  int shadowCapacity = queue->shadowCapacity;
+
+  for (int i = 0; i < count; i++) {
+    wave_ray_t *ray = queuePush(scratch, (void **) &rays, &numRays,
+                                &rayCapacity, sizeof(wave_ray_t));
+    if (ray == NULL) {
+      return ARENA_ALLOC_ERROR;
+    }
+    ray->frame.origin = origin;
+    ray->frame.weight = 1.0;
+    ray->frame.extIor = DEFAULT_IOR;
+    ray->frame.inObject = NULL;
+    ray->direction = directions[i];
+    ray->parent = -1;
+  }
+
+  COUNTERS_ADD(primaryRays, count);
+
+  int waveStart = 0;
+  for (int level = 1; waveStart < numRays; level++) {
+    int waveEnd = numRays;
+    countersLevel(level, waveEnd - waveStart);
+
+    // Find the closest hit of every ray in the wave
+    for (int i = waveStart; i < waveEnd; i++) {
+      wave_ray_t *ray = &rays[i];
+      ray->frame.object = NULL;
+      ray->t = rayObjectIntersect(&ray->frame.object, ray->frame.origin,
+                                  ray->direction, INFINITY, scene);
+    }
+
+    // Set up the hits for shading, and cast a shadow ray to every light
+    numShadows = 0;
+    for (int i = waveStart; i < waveEnd; i++) {
+      ray_frame_t *frame = &rays[i].frame;
+      object_t *object = frame->object;
+      clearFrame(frame);
+      rays[i].light = vec3_make(0, 0, 0); // No ambient light
+      if (rays[i].t == NO_INTERSECTION_FOUND) {
+        frame->stage = RAY_STAGE_DONE;
+        continue;
+      }
+
+      hitFrame(frame, object, rays[i].t, rays[i].direction, level, options);
+      frame->stage = RAY_STAGE_SHADE;
+
+      for (int j = 0; j < scene->numLights; j++) {
+        shadow_ray_t *shadow = queuePush(scratch, (void **) &shadows,
+                                         &numShadows, &shadowCapacity,
+                                         sizeof(shadow_ray_t));
+        if (shadow == NULL) {
+          return ARENA_ALLOC_ERROR;
+        }
+        shadow->ray = i;
+        shadow->light = j;
+        shadow->distance = lightDirection(&shadow->direction, frame,
+                                          &scene->lights[j]);
+      }
+    }
+
+    // Test every shadow ray
+    for (int i = 0; i < numShadows; i++) {
+      shadow_ray_t *shadow = &shadows[i];
+      shadow->occluded = rayOccluded(rays[shadow->ray].frame.intersectOffset,
+                                     shadow->direction, shadow->distance,
+                                     scene);
+    }
+
+    // Sum the light reaching each hit, in the same light order as raycast
+    for (int i = 0; i < numShadows; i++) {
+      shadow_ray_t *shadow = &shadows[i];
+      if (!shadow->occluded) {
+        wave_ray_t *ray = &rays[shadow->ray];
+        addLight(&ray->light, &ray->frame, &scene->lights[shadow->light],
+                 shadow->direction, shadow->distance);
+      }
+    }
+
+    // Queue the reflection and refraction rays for the next bounce
+    for (int i = waveStart; i < waveEnd; i++) {
+      if (rays[i].frame.stage == RAY_STAGE_DONE) {
+        continue;
+      }
+
+      if (rays[i].frame.reflectWeight > 0) {
+        COUNTERS_ADD(reflectRays, 1);
+        wave_ray_t *child = queuePush(scratch, (void **) &rays, &numRays,
+                                      &rayCapacity, sizeof(wave_ray_t));
+        if (child == NULL) {
+          return ARENA_ALLOC_ERROR;
+        }
+        ray_frame_t *frame = &rays[i].frame;
+        child->frame.origin = frame->intersectOffset;
+        child->frame.weight = frame->reflectWeight;
+        child->frame.extIor = frame->extIor;
+        child->frame.inObject = NULL;
+        child->direction = reflectDirection(frame);
+        child->parent = i;
+        child->isRefraction = 0;
+      }
+
+      if (rays[i].frame.refractWeight > 0) {
+        COUNTERS_ADD(refractRays, 1);
+        wave_ray_t *child = queuePush(scratch, (void **) &rays, &numRays,
+                                      &rayCapacity, sizeof(wave_ray_t));
+        if (child == NULL) {
+          return ARENA_ALLOC_ERROR;
+        }
+        ray_frame_t *frame = &rays[i].frame;
+        child->frame.origin = frame->intersectOffset;
+        child->frame.weight = frame->refractWeight;
+        child->frame.extIor = frame->object->ior;
+        child->frame.inObject = frame->object == frame->inObject ?
+                                NULL : frame->object;
+        child->direction = refractDirection(frame);
+        child->parent = i;
+        child->isRefraction = 1;
+      }
+    }
+
+    waveStart = waveEnd;
+  }
+
+  // Combine colors from the last bounce back up to the camera rays
+  for (int i = numRays - 1; i >= 0; i--) {
+    wave_ray_t *ray = &rays[i];
+    if (ray->frame.stage == RAY_STAGE_SHADE) {
+      ray->frame.color = shadeFrame(&ray->frame, ray->light);
+    }
+
+    if (ray->parent < 0) {
+      colors[i] = ray->frame.color;
+      hitObjects[i] = ray->frame.object;
+    }
+    else if (ray->isRefraction) {
+      rays[ray->parent].frame.refractColor = ray->frame.color;
+    }
+    else {
+      rays[ray->parent].frame.reflectColor = ray->frame.color;
+    }
+  }
+
+  // Keep the queues for the next batch
+  queue->rays = rays;
+  queue->rayCapacity = rayCapacity;
+  queue->shadows = shadows;
+  queue->shadowCapacity = shadowCapacity;
+  return 0;
+}
+
+
+// Everything a tile needs to turn pixels in to colors
+typedef struct {
+  ppm_t *image;
+  camera_t *camera;
+  scene_t *scene;
+  render_options_t *options;
+  real_t pixWidth;
+  real_t pixHeight;
+  vec3_t cameraPosition;
+  arena_t *scratch; // One per thread, reset before each tile or band
+  object_t **hits; // Object each camera ray hit, kept for anti-aliasing
+  unsigned char *flags; // Pixels to refine, set once the image is traced
+  vec3_t *sums; // Progressive mode, color summed over each pixel's samples
+  int *samples; // Progressive mode, samples traced in each pixel so far
+  int pass; // Progressive pass being traced
+  double deadline; // Progressive tiles stop tracing at this time, 0 never
+  ray_counters_t *counters; // One per thread with --stats, else NULL
+  double *costs; // Cost of each pixel's rays for the heatmap, or NULL
+  trace_t *trace; // Timeline to add tile spans to, or NULL
+  int failed; // Set once a scratch allocation fails on any thread
+} render_job_t;
+
+// Band pipeline shared between the render workers and the writer
+typedef struct {
+  render_job_t *job;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  pixel_t **slots; // Ring of band buffers
+  int *slotBands; // Band held by each slot once it is finished, else -1
+  int numSlots;
+  int bandHeight;
+  int numBands;
+  int nextBand; // Next band to hand out to a worker
+  int writtenBands; // Bands that have already reached the file
+  int nextWorker; // Scratch arena for the next worker to start
+  long numRefined; // Pixels refined by anti-aliasing in finished bands
+} band_queue_t;
+
+
+// Give up on the job after a thread ran out of scratch. The other threads
+// finish their tiles, the flag is read once they are done
+static void failJob(render_job_t *job) {
+  __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+}
+
+
+// Running cost of the rays traced on this thread, in the heatmap's units
+static double threadCost(render_job_t *job) {
+  if (job->options->heatmapCost == HEATMAP_COST_TIME) {
+    return traceNow() * 1e9;
+  }
+  return threadCounters->sphereTests + threadCounters->planeTests +
+         threadCounters->boxTests;
+}
+
+
+// Store the color of pixel (i, j) at row (i - firstRow) of the pixel
+// array, and the object its camera ray hit when hits are kept
+static void storePixel(render_job_t *job, pixel_t *pixels, object_t **hits,
+                       int firstRow, int i, int j, vec3_t color,
+                       object_t *object) {
+
+  long index = (long) (i - firstRow)*job->image->width + j;
+
+  // Populate pixel with color data
+  pixel_t *pixel = &pixels[index];
+  pixel->r = (int) (color.x * 255);
+  pixel->g = (int) (color.y * 255);
+  pixel->b = (int) (color.z * 255);
+
+  if (hits != NULL) {
+    hits[index] = object;
+  }
+}
+
+
+// Trace a rectangle of pixels through the wavefront engine, a block of at
+// most TILE_SIZE by TILE_SIZE pixels at a time
+static void renderWavePixels(render_job_t *job, const tile_t *tile,
+                             pixel_t *pixels, object_t **hits, int firstRow,
+                             arena_t *scratch) {
+
+  camera_t *camera = job->camera;
+
+  // Queues are kept from one block to the next
+  wave_queue_t queue = { scratch, NULL, 0, NULL, 0 };
+  vec3_t *directions = arenaAlloc(scratch, sizeof(vec3_t) *
+                                           TILE_SIZE * TILE_SIZE);
+  vec3_t *colors = arenaAlloc(scratch, sizeof(vec3_t) *
+                                       TILE_SIZE * TILE_SIZE);
+  object_t **objects = arenaAlloc(scratch, sizeof(object_t *) *
+                                           TILE_SIZE * TILE_SIZE);
+  if (directions == NULL || colors == NULL || objects == NULL) {
+    failJob(job);
+    return;
+  }
+
+  for (int y0 = tile->y0; y0 < tile->y1; y0 += TILE_SIZE) {
+    for (int x0 = tile->x0; x0 < tile->x1; x0 += TILE_SIZE) {
+      int y1 = y0 + TILE_SIZE < tile->y1 ? y0 + TILE_SIZE : tile->y1;
+      int x1 = x0 + TILE_SIZE < tile->x1 ? x0 + TILE_SIZE : tile->x1;
+      int blockWidth = x1 - x0;
+
+      // Create direction vectors
+      for (int i = y0; i < y1; i++) {
+        real_t yCoord = camera->height/2 - job->pixHeight * (i + 0.5);
+        for (int j = x0; j < x1; j++) {
+          real_t xCoord = -camera->width/2 + job->pixWidth * (j + 0.5);
+          directions[(i - y0)*blockWidth + j - x0] = vec3_normalize(
+              vec3_make(xCoord, yCoord, -FOCAL_LENGTH));
+        }
+      }
+
+      if (wavefrontTrace(&queue, colors, objects, job->cameraPosition,
+                         directions, (y1 - y0) * blockWidth, job->scene,
+                         job->options) != 0) {
+        failJob(job);
+        return;
+      }
+
+      for (int i = y0; i < y1; i++) {
+        for (int j = x0; j < x1; j++) {
+          int k = (i - y0)*blockWidth + j - x0;
+          storePixel(job, pixels, hits, firstRow, i, j, colors[k],
+                     objects[k]);
+        }
+      }
+    }
+  }
+}
+
+
+// Trace a rectangle of pixels like renderPixels, each block of
+// packetSize by packetSize pixels as one packet
+static void renderPacketPixels(render_job_t *job, const tile_t *tile,
+                               pixel_t *pixels, object_t **hits,
+                               int firstRow, arena_t *scratch) {
+
+  camera_t *camera = job->camera;
+  int size = job->options->packetSize;
+
+  ray_frame_t *stack = arenaAlloc(scratch, sizeof(ray_frame_t) *
+                                           job->options->maxDepth);
+  int *occluded = arenaAlloc(scratch, sizeof(int) * PACKET_WIDTH *
+                                      (job->scene->numLights + 1));
+  if (stack == NULL || occluded == NULL) {
+    failJob(job);
+    return;
+  }
+
+  for (int y0 = tile->y0; y0 < tile->y1; y0 += size) {
+    for (int x0 = tile->x0; x0 < tile->x1; x0 += size) {
+
+      // Lanes past the edge of the tile are left empty
+      ray_packet_t packet;
+      memset(&packet, 0, sizeof(packet));
+      for (int k = 0; k < PACKET_WIDTH; k++) {
+        int i = y0 + k / size;
+        int j = x0 + k % size;
+        if (i >= tile->y1 || j >= tile->x1) {
+          continue;
+        }
+
+        // Create direction vector
+        real_t yCoord = camera->height/2 - job->pixHeight * (i + 0.5);
+        real_t xCoord = -camera->width/2 + job->pixWidth * (j + 0.5);
+        vec3_t direction = vec3_normalize(
+            vec3_make(xCoord, yCoord, -FOCAL_LENGTH));
+
+        packet.ox[k] = job->cameraPosition.x;
+        packet.oy[k] = job->cameraPosition.y;
+        packet.oz[k] = job->cameraPosition.z;
+        packet.dx[k] = direction.x;
+        packet.dy[k] = direction.y;
+        packet.dz[k] = direction.z;
+        packet.tMax[k] = INFINITY;
+        packet.mask |= 1 << k;
+      }
+
+      vec3_t colors[PACKET_WIDTH];
+      object_t *objects[PACKET_WIDTH];
+      raycastPacket(colors, objects, job->cameraPosition, &packet,
+                    job->scene, job->options, stack, occluded);
+
+      for (int k = 0; k < PACKET_WIDTH; k++) {
+        if (packet.mask & (1 << k)) {
+          storePixel(job, pixels, hits, firstRow, y0 + k / size,
+                     x0 + k % size, colors[k], objects[k]);
+        }
+      }
+    }
+  }
+}
+
+
+// Trace a rectangle of pixels, storing row i of the image at row
+// (i - firstRow) of the pixel array, and the object each camera ray hit
+// at the same place in hits unless it is NULL
+static void renderPixels(render_job_t *job, const tile_t *tile,
+                         pixel_t *pixels, object_t **hits, int firstRow,
+                         arena_t *scratch) {
+
+  // A heatmap needs every pixel's rays traced on their own
+  if (job->options->engineKind == ENGINE_KIND_WAVEFRONT &&
+      job->costs == NULL) {
+    renderWavePixels(job, tile, pixels, hits, firstRow, scratch);
+    return;
+  }
+  if (job->options->packetSize > 1 && job->costs == NULL) {
+    renderPacketPixels(job, tile, pixels, hits, firstRow, scratch);
+    return;
+  }
+
+  camera_t *camera = job->camera;
+
+  // Columns are shared by every row of the tile
+  real_t *xCoords = arenaAlloc(scratch, sizeof(real_t) *
+                                        (tile->x1 - tile->x0));
+  ray_frame_t *stack = arenaAlloc(scratch, sizeof(ray_frame_t) *
+                                           job->options->maxDepth);
+  if (xCoords == NULL || stack == NULL) {
+    failJob(job);
+    return;
+  }
+
+  for (int j = tile->x0; j < tile->x1; j++) {
+    xCoords[j - tile->x0] = -camera->width/2 + job->pixWidth * (j + 0.5);
+  }
+
+  for (int i = tile->y0; i < tile->y1; i++) {
+    real_t yCoord = camera->height/2 - job->pixHeight * (i + 0.5);
+
+    for (int j = tile->x0; j < tile->x1; j++) {
+      real_t xCoord = xCoords[j - tile->x0];
+
+      // Create direction vector
+      vec3_t direction = vec3_normalize(
+          vec3_make(xCoord, yCoord, -FOCAL_LENGTH));
+
+      // Get color from raycast
+      double cost = job->costs != NULL ? threadCost(job) : 0;
+      vec3_t color = raycast(job->cameraPosition, direction, job->scene,
+                             job->options, stack);
+      if (job->costs != NULL) {
+        job->costs[(long) i*job->image->width + j] += threadCost(job) - cost;
+      }
+      storePixel(job, pixels, hits, firstRow, i, j, color, stack[0].object);
+    }
+  }
+}
+
+
+// Flag the pixels in rows [y0, y1) that sit on an edge, where a neighbour
+// in the same rows hit another object or differs in color by more than
+// the threshold. Returns the number of pixels flagged
+static long flagEdges(render_job_t *job, unsigned char *flags,
+                      const pixel_t *pixels, object_t **hits, int y0,
+                      int y1, int firstRow) {
+
+  int width = job->image->width;
+  int threshold = (int) (job->options->aaThreshold * 255);
+  long numFlagged = 0;
+
+  for (int i = y0; i < y1; i++) {
+    for (int j = 0; j < width; j++) {
+      long index = (long) (i - firstRow)*width + j;
+      const pixel_t *pixel = &pixels[index];
+      long neighbours[4] = { i > y0 ? index - width : -1,
+                            i + 1 < y1 ? index + width : -1,
+                            j > 0 ? index - 1 : -1,
+                            j + 1 < width ? index + 1 : -1 };
+
+      flags[index] = 0;
+      for (int k = 0; k < 4 && !flags[index]; k++) {
+        if (neighbours[k] < 0) {
+          continue;
+        }
+        const pixel_t *other = &pixels[neighbours[k]];
+        flags[index] = hits[neighbours[k]] != hits[index] ||
+                       abs(pixel->r - other->r) > threshold ||
+                       abs(pixel->g - other->g) > threshold ||
+                       abs(pixel->b - other->b) > threshold;
+      }
+      numFlagged += flags[index];
+    }
+  }
+
+  return numFlagged;
+}
+
+
+// Trace the flagged pixels of a rectangle again with a grid of
+// aaSamples by aaSamples rays, storing the average color
+static void refinePixels(render_job_t *job, const tile_t *tile,
+                         pixel_t *pixels, const unsigned char *flags,
+                         int firstRow, arena_t *scratch) {
+
+  camera_t *camera = job->camera;
+  int n = job->options->aaSamples;
+  ray_frame_t *stack = arenaAlloc(scratch, sizeof(ray_frame_t) *
+                                           job->options->maxDepth);
+  if (stack == NULL) {
+    failJob(job);
+    return;
+  }
+
+  for (int i = tile->y0; i < tile->y1; i++) {
+    for (int j = tile->x0; j < tile->x1; j++) {
+      if (!flags[(long) (i - firstRow)*job->image->width + j]) {
+        continue;
+      }
+
+      double cost = job->costs != NULL ? threadCost(job) : 0;
+      vec3_t sum = vec3_make(0, 0, 0);
+      for (int si = 0; si < n; si++) {
+        real_t yCoord = camera->height/2 -
+                        job->pixHeight * (i + (si + 0.5) / n);
+
+        for (int sj = 0; sj < n; sj++) {
+          real_t xCoord = -camera->width/2 +
+                          job->pixWidth * (j + (sj + 0.5) / n);
+
+          vec3_t direction = vec3_normalize(
+              vec3_make(xCoord, yCoord, -FOCAL_LENGTH));
+          sum = vec3_add(sum, raycast(job->cameraPosition, direction,
+                                      job->scene, job->options, stack));
+        }
+      }
+
+      if (job->costs != NULL) {
+        job->costs[(long) i*job->image->width + j] += threadCost(job) - cost;
+      }
+      storePixel(job, pixels, NULL, firstRow, i, j,
+                 vec3_scale(sum, 1.0 / (n * n)), NULL);
+    }
+  }
+}
+
+
+// Trace a band of whole rows, refining its edges when anti-aliasing is on.
+// Returns the number of pixels refined
+static long renderBand(render_job_t *job, const tile_t *tile,
+                       pixel_t *pixels, arena_t *scratch) {
+
+  if (job->options->aaSamples <= 1) {
+    renderPixels(job, tile, pixels, NULL, tile->y0, scratch);
+    return 0;
+  }
+
+  size_t count = (size_t) (tile->y1 - tile->y0) * job->image->width;
+  object_t **hits = arenaAlloc(scratch, sizeof(object_t *) * count);
+  unsigned char *flags = arenaAlloc(scratch, count);
+  if (hits == NULL || flags == NULL) {
+    failJob(job);
+    return 0;
+  }
+
+  renderPixels(job, tile, pixels, hits, tile->y0, scratch);
+  long numFlagged = flagEdges(job, flags, pixels, hits, tile->y0, tile->y1,
+                              tile->y0);
+  refinePixels(job, tile, pixels, flags, tile->y0, scratch);
+
+  return numFlagged;
+}
+
+
+// Count the work of a thread in its own counters, if they are kept
+static void bindCounters(render_job_t *job, int threadIndex) {
+  countersBind(job->counters != NULL ? &job->counters[threadIndex] : NULL);
+}
+
+
+// Trace ring of a render thread, the main thread has ring 0
+static trace_ring_t *workerRing(render_job_t *job, int threadIndex) {
+  return job->trace != NULL ? &job->trace->rings[threadIndex + 1] : NULL;
+}
+
+
+// Trace ring of the thread that called the renderer
+static trace_ring_t *mainRing(trace_t *trace) {
+  return trace != NULL ? &trace->rings[0] : NULL;
+}
+
+
+static void renderTile(const tile_t *tile, int threadIndex, void *data) {
+  render_job_t *job = data;
+  double start = traceNow();
+  arena_t *scratch = &job->scratch[threadIndex];
+  arenaReset(scratch);
+  bindCounters(job, threadIndex);
+  renderPixels(job, tile, job->image->pixels, job->hits, 0, scratch);
+  traceSpan(workerRing(job, threadIndex), "tile", start, tile->x0,
+            tile->y0);
+}
+
+
+static void refineTile(const tile_t *tile, int threadIndex, void *data) {
+  render_job_t *job = data;
+  double start = traceNow();
+  arena_t *scratch = &job->scratch[threadIndex];
+  arenaReset(scratch);
+  bindCounters(job, threadIndex);
+  refinePixels(job, tile, job->image->pixels, job->flags, 0, scratch);
+  traceSpan(workerRing(job, threadIndex), "refine", start, tile->x0,
+            tile->y0);
+}
+
+
+static void setupJob(render_job_t *job, ppm_t *ppmImage, camera_t *camera,
+                     scene_t *scene, render_options_t *options,
+                     arena_t *scratch) {
+  job->image = ppmImage;
+  job->camera = camera;
+  job->scene = scene;
+  job->options = options;
+  job->pixHeight = camera->height/ppmImage->height;
+  job->pixWidth = camera->width/ppmImage->width;
+  job->cameraPosition = camera->position;
+  job->scratch = scratch;
+  job->hits = NULL;
+  job->flags = NULL;
+  job->sums = NULL;
+  job->samples = NULL;
+  job->pass = 0;
+  job->deadline = 0;
+  job->counters = NULL;
+  job->costs = NULL;
+  job->trace = NULL;
+  job->failed = 0;
+}
+
+
+// Point the job at the costs and trace being kept, and give every thread
+// counters of its own when they are wanted, which a heatmap of tests needs
+static int setupStats(render_job_t *job, render_stats_t *stats,
+                      arena_t *arena) {
+  job->costs = stats->pixelCosts;
+  job->trace = stats->trace;
+  if (job->options->statsFormat == STATS_FORMAT_OFF &&
+      (job->costs == NULL ||
+       job->options->heatmapCost != HEATMAP_COST_TESTS)) {
+    return 0;
+  }
+
+  int numThreads = job->options->numThreads < 1 ? 1 :
+                   job->options->numThreads;
+  job->counters = arenaAlloc(arena, sizeof(ray_counters_t) * numThreads);
+  if (job->counters == NULL) {
+    return ARENA_ALLOC_ERROR;
+  }
+  for (int i = 0; i < numThreads; i++) {
+    countersClear(&job->counters[i]);
+  }
+  return 0;
+}
+
+
+// Add every thread's counters to the stats once the workers are done
+static void mergeCounters(render_job_t *job, render_stats_t *stats) {
+  if (job->counters == NULL) {
+    return;
+  }
+
+  int numThreads = job->options->numThreads < 1 ? 1 :
+                   job->options->numThreads;
+  for (int i = 0; i < numThreads; i++) {
+    countersMerge(&stats->counters, &job->counters[i]);
+  }
+  countersBind(NULL);
+}
+
+
+// Actually creates and initializes the image, iterates over view plane
+int renderImage(ppm_t *ppmImage, camera_t *camera, scene_t *scene,
+                render_options_t *options, render_stats_t *stats,
+                arena_t *arena, arena_t *scratch) {
+
+  render_job_t job;
+  setupJob(&job, ppmImage, camera, scene, options, scratch);
+  if (setupStats(&job, stats, arena) != 0) {
+    return ARENA_ALLOC_ERROR;
+  }
+
+  size_t numPixels = (size_t) ppmImage->width * ppmImage->height;
+  if (options->aaSamples > 1) {
+    job.hits = arenaAlloc(arena, sizeof(object_t *) * numPixels);
+    job.flags = arenaAlloc(arena, numPixels);
+    if (job.hits == NULL || job.flags == NULL) {
+      return ARENA_ALLOC_ERROR;
+    }
+  }
+
+  // Serial path walks the whole image as one tile
+  tile_t image = { 0, 0, ppmImage->width, ppmImage->height };
+  int errorStatus = 0;
+  if (options->numThreads <= 1) {
+    renderTile(&image, 0, &job);
+  }
+  else {
+    errorStatus = scheduleTiles(ppmImage->width, ppmImage->height,
+                                TILE_SIZE, options->numThreads, renderTile,
+                                &job);
+  }
+  if (job.failed) {
+    errorStatus = ARENA_ALLOC_ERROR;
+  }
+
+  if (options->aaSamples <= 1 || errorStatus != 0) {
+    mergeCounters(&job, stats);
+    return errorStatus;
+  }
+
+  // Edges are only found once every pixel is traced, then refined in a
+  // second pass that never reads the pixels it writes
+  long numFlagged = flagEdges(&job, job.flags, ppmImage->pixels, job.hits,
+                              0, ppmImage->height, 0);
+  stats->refinedPixels += numFlagged;
+  stats->extraRays += numFlagged * options->aaSamples * options->aaSamples;
+
+  if (options->numThreads <= 1) {
+    refineTile(&image, 0, &job);
+  }
+  else {
+    errorStatus = scheduleTiles(ppmImage->width, ppmImage->height,
+                                TILE_SIZE, options->numThreads, refineTile,
+                                &job);
+  }
+  if (job.failed) {
+    errorStatus = ARENA_ALLOC_ERROR;
+  }
+
+  mergeCounters(&job, stats);
+  return errorStatus;
+}
+
+
+static void *bandWorker(void *data) {
+
+  band_queue_t *queue = data;
+  int width = queue->job->image->width;
+  int height = queue->job->image->height;
+
+  pthread_mutex_lock(&queue->lock);
+  int worker = queue->nextWorker++;
+  pthread_mutex_unlock(&queue->lock);
+  arena_t *scratch = &queue->job->scratch[worker];
+  bindCounters(queue->job, worker);
+
+  while (1) {
+
+    // Wait for a free slot, a band may not overtake the writer by a full ring
+    pthread_mutex_lock(&queue->lock);
+    while (queue->nextBand < queue->numBands &&
+           queue->nextBand >= queue->writtenBands + queue->numSlots) {
+      pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    if (queue->nextBand >= queue->numBands) {
+      pthread_mutex_unlock(&queue->lock);
+      break;
+    }
+    int band = queue->nextBand++;
+    pthread_mutex_unlock(&queue->lock);
+
+    tile_t tile = { 0, band * queue->bandHeight, width,
+                    (band + 1) * queue->bandHeight };
+    if (tile.y1 > height) tile.y1 = height;
+
+    double start = traceNow();
+    arenaReset(scratch);
+    long numRefined = renderBand(queue->job, &tile,
+                                 queue->slots[band % queue->numSlots],
+                                 scratch);
+    traceSpan(workerRing(queue->job, worker), "band", start, 0, tile.y0);
+
+    // Hand the finished band to the writer
+    pthread_mutex_lock(&queue->lock);
+    queue->numRefined += numRefined;
+    queue->slotBands[band % queue->numSlots] = band;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+  }
+
+  return NULL;
+}
+
+
+int renderStream(FILE *file, int format, int width, int height,
+                 camera_t *camera, scene_t *scene,
+                 render_options_t *options, render_stats_t *stats,
+                 arena_t *arena, arena_t *scratch) {
+
+  ppm_t header;
+  header.width = width;
+  header.height = height;
+  header.maxColorValue = 255;
+  header.pixels = NULL;
+  header.mapping = NULL;
+  header.mappingSize = 0;
+
+  render_job_t job;
+  setupJob(&job, &header, camera, scene, options, scratch);
+  if (setupStats(&job, stats, arena) != 0) {
+    return ARENA_ALLOC_ERROR;
+  }
+
+  band_queue_t queue;
+  queue.job = &job;
+  queue.bandHeight = options->bandHeight;
+  queue.numBands = (height + queue.bandHeight - 1) / queue.bandHeight;
+  queue.nextBand = 0;
+  queue.writtenBands = 0;
+  queue.nextWorker = 0;
+  queue.numRefined = 0;
+
+  // Two spare slots let workers run ahead while the writer is busy
+  int numThreads = options->numThreads < 1 ? 1 : options->numThreads;
+  queue.numSlots = numThreads == 1 ? 1 : numThreads + 2;
+  queue.slots = arenaAlloc(arena, sizeof(pixel_t *) * queue.numSlots);
+  queue.slotBands = arenaAlloc(arena, sizeof(int) * queue.numSlots);
+  pthread_t *threads = arenaAlloc(arena, sizeof(pthread_t) * numThreads);
+  if (queue.slots == NULL || queue.slotBands == NULL || threads == NULL) {
+    return ARENA_ALLOC_ERROR;
+  }
+  for (int i = 0; i < queue.numSlots; i++) {
+    queue.slots[i] = arenaAlloc(arena, sizeof(pixel_t) * width *
+                                       queue.bandHeight);
+    queue.slotBands[i] = -1;
+    if (queue.slots[i] == NULL) {
+      return ARENA_ALLOC_ERROR;
+    }
+  }
 
-  // Track closest object
-  object_t *closestObject = NULL;
-  double closestT = INFINITY;
+  pthread_mutex_init(&queue.lock, NULL);
+  pthread_cond_init(&queue.changed, NULL);
 
-  // Iteration objects
-  object_t *currObject = NULL;
-  double currT;
+  double writeStart = traceNow();
+  int errorStatus = writePPMHeader(&header, file, format);
+  stats->writeSeconds += traceNow() - writeStart;
+  traceSpan(mainRing(stats->trace), "write", writeStart, TRACE_NO_ARG,
+            TRACE_NO_ARG);
 
-  // Iterate through all objects to find nearest object
-  for (int i = 0; i < numObjects; i++) {
+  // Start the workers, if there are any
+  int started = 0;
 
-    currObject = scene[i]; // Save current object
+  for (int i = 0; numThreads > 1 && i < numThreads; i++, started++) {
+    if (pthread_create(&threads[i], NULL, bandWorker, &queue) != 0) {
+      break;
+    }
+  }
 
-    // Check for intersection (depending on object type)
-    switch (currObject->kind) {
-      case OBJECT_KIND_SPHERE:
-        currT = sphereIntersect(origin, direction, (sphere_t *) currObject);
-        break;
-      case OBJECT_KIND_PLANE:
-        currT = planeIntersect(origin, direction, (plane_t *) currObject);
+  // Single threaded, render and write each band in turn
+  if (started == 0) {
+    bindCounters(&job, 0);
+    for (int band = 0; band < queue.numBands && errorStatus == 0; band++) {
+      tile_t tile = { 0, band * queue.bandHeight, width,
+                      (band + 1) * queue.bandHeight };
+      if (tile.y1 > height) tile.y1 = height;
+
+      double start = traceNow();
+      arenaReset(&scratch[0]);
+      queue.numRefined += renderBand(&job, &tile, queue.slots[0],
+                                     &scratch[0]);
+      traceSpan(workerRing(&job, 0), "band", start, 0, tile.y0);
+      if (job.failed) {
         break;
+      }
+      writeStart = traceNow();
+      errorStatus = writePPMPixels(queue.slots[0],
+                                   (size_t) (tile.y1 - tile.y0) * width,
+                                   file, format);
+      stats->writeSeconds += traceNow() - writeStart;
+      traceSpan(mainRing(stats->trace), "write", writeStart, 0, tile.y0);
+    }
+  }
+
+  // Otherwise workers render bands in parallel and this thread writes
+  // them out in order, whatever order they finish in
+  for (int band = 0; started > 0 && band < queue.numBands; band++) {
+    if (errorStatus != 0) {
+
+      // Nothing more can be written, so let the workers run out of bands
+      pthread_mutex_lock(&queue.lock);
+      queue.nextBand = queue.numBands;
+      pthread_cond_broadcast(&queue.changed);
+      pthread_mutex_unlock(&queue.lock);
+      break;
+    }
+
+    int slot = band % queue.numSlots;
+    int rows = queue.bandHeight;
+    if ((band + 1) * rows > height) rows = height - band * rows;
+
+    pthread_mutex_lock(&queue.lock);
+    while (queue.slotBands[slot] != band) {
+      pthread_cond_wait(&queue.changed, &queue.lock);
     }
+    pthread_mutex_unlock(&queue.lock);
 
-    // If the current t was closer than all before, save the color
-    if (currT != NO_INTERSECTION_FOUND && currT < closestT) {
-      closestT = currT;
-      closestObject = currObject;
+    // A band that ran out of scratch is not worth writing, the next band
+    // sees the error and stops the workers
+    if (job.failed) {
+      errorStatus = ARENA_ALLOC_ERROR;
+      continue;
     }
+
+    writeStart = traceNow();
+    errorStatus = writePPMPixels(queue.slots[slot], (size_t) rows * width,
+                                 file, format);
+    stats->writeSeconds += traceNow() - writeStart;
+    traceSpan(mainRing(stats->trace), "write", writeStart, 0,
+              band * queue.bandHeight);
+
+    // Free the slot for the band one ring further on
+    pthread_mutex_lock(&queue.lock);
+    queue.slotBands[slot] = -1;
+    queue.writtenBands = band + 1;
+    pthread_cond_broadcast(&queue.changed);
+    pthread_mutex_unlock(&queue.lock);
   }
 
-  // Check if any intersection was found
-  if (closestObject == NULL) {
-    outObject = NULL;
-    return NO_INTERSECTION_FOUND;
+  for (int i = 0; i < started; i++) {
+    pthread_join(threads[i], NULL);
   }
-  else {
-    if (outObject != NULL)
-      *outObject = closestObject;
-    return closestT;
+
+  stats->refinedPixels += queue.numRefined;
+  stats->extraRays += queue.numRefined * options->aaSamples *
+                      options->aaSamples;
+  mergeCounters(&job, stats);
+
+  // Buffers go with the arena
+  pthread_cond_destroy(&queue.changed);
+  pthread_mutex_destroy(&queue.lock);
+
+  if (job.failed) {
+    return ARENA_ALLOC_ERROR;
   }
+  return errorStatus != 0;
 }
 
 
-vector3_t raycast(vector3_t origin, vector3_t direction,
-                  object_t **scene, int numObjects,
-                  light_t **lights, int numLights,
-                  int level, double extIor, object_t *inObject) {
+// Pixel of each 4x4 block traced by the interleaved passes, in the order
+// of a Bayer matrix so that every pass spreads evenly over the image
+static const int progressiveOrder[PROGRESSIVE_PASSES][2] = {
+  { 0, 0 }, { 2, 2 }, { 2, 0 }, { 0, 2 }, { 1, 1 }, { 3, 3 }, { 3, 1 },
+  { 1, 3 }, { 1, 0 }, { 3, 2 }, { 3, 0 }, { 1, 2 }, { 0, 1 }, { 2, 3 },
+  { 2, 1 }, { 0, 3 }
+};
+
 
-  if (level > MAX_RECURSION_LEVEL) {
-    return vector3_create(0, 0, 0); // Void color
+// Digits of index in the given base mirrored about the point, a well
+// spread sequence of offsets in [0, 1)
+static double radicalInverse(int index, int base) {
+  double inverse = 0;
+  double scale = 1.0 / base;
+  for (; index > 0; index /= base, scale /= base) {
+    inverse += (index % base) * scale;
   }
+  return inverse;
+}
 
-  // Find the intersection point with the nearest object
-  object_t *object;
-  double t = rayObjectIntersect(&object, origin, direction, scene, numObjects);
 
-  // If we did not hit any objects, the pixel is in the void
-  if (t == NO_INTERSECTION_FOUND) {
-    return vector3_create(0, 0, 0); // Void color
+// Trace one progressive pass over a tile. The interleaved passes trace
+// one pixel centre in each block, later passes add a sample to every pixel.
+// Rows are skipped once the deadline has passed
+static void progressiveTile(const tile_t *tile, int threadIndex,
+                            void *data) {
+
+  render_job_t *job = data;
+  double start = traceNow();
+  camera_t *camera = job->camera;
+  int width = job->image->width;
+  arena_t *scratch = &job->scratch[threadIndex];
+  arenaReset(scratch);
+  bindCounters(job, threadIndex);
+  ray_frame_t *stack = arenaAlloc(scratch, sizeof(ray_frame_t) *
+                                           job->options->maxDepth);
+  if (stack == NULL) {
+    failJob(job);
+    return;
   }
 
-  // Calculate color value
-  else {
-    vector3_t tempVector = vector3_create(0, 0, 0); // Used in calculations
+  int extra = job->pass - PROGRESSIVE_PASSES + 1; // Sample being added
+  double dx = 0.5;
+  double dy = 0.5;
+  if (extra > 0) {
+    dx = radicalInverse(extra, 2);
+    dy = radicalInverse(extra, 3);
+  }
+
+  for (int i = tile->y0; i < tile->y1; i++) {
+    if (extra <= 0 &&
+        i % PROGRESSIVE_BLOCK != progressiveOrder[job->pass][1]) {
+      continue;
+    }
+    if (job->deadline > 0 && traceNow() >= job->deadline) {
+      break;
+    }
+    real_t yCoord = camera->height/2 - job->pixHeight * (i + dy);
+
+    for (int j = tile->x0; j < tile->x1; j++) {
+      if (extra <= 0 &&
+          j % PROGRESSIVE_BLOCK != progressiveOrder[job->pass][0]) {
+        continue;
+      }
+      real_t xCoord = -camera->width/2 + job->pixWidth * (j + dx);
+
+      vec3_t direction = vec3_normalize(
+          vec3_make(xCoord, yCoord, -FOCAL_LENGTH));
+      double cost = job->costs != NULL ? threadCost(job) : 0;
+      vec3_t color = raycast(job->cameraPosition, direction, job->scene,
+                             job->options, stack);
+      long index = (long) i*width + j;
+      if (job->costs != NULL) {
+        job->costs[index] += threadCost(job) - cost;
+      }
+
+      job->sums[index] = vec3_add(job->sums[index], color);
+      job->samples[index]++;
+    }
+  }
+
+  traceSpan(workerRing(job, threadIndex), "tile", start, tile->x0,
+            tile->y0);
+}
 
-    vector3_t ovDirection = vector3_create(0, 0, 0);
-    vector3_t intersect = vector3_create(0, 0, 0);
-    vector3_t intersectOffset = vector3_create(0, 0, 0);
-    vector3_t normal = vector3_create(0, 0, 0);
-    vector3_t reflectColor = vector3_create(0, 0, 0); // Reflection color
-    vector3_t reflection = vector3_create(0, 0, 0);
-    double illumination;
 
-    /* Calculate values that DO NOT change on a light by light basis */
-    illumination = 1.0 - object->reflectivity - object->refractivity;
+// Turn the sums in to the image, filling pixels that have no samples yet
+// from the first pixel of the smallest block around them that has one
+static void resolveProgress(render_job_t *job) {
 
-    vector3_scale(ovDirection, direction, -1);
+  int width = job->image->width;
 
-    // Get intersection point
-    vector3_scale(tempVector, direction, t);
-    vector3_add(intersect, tempVector, origin);
+  for (int i = 0; i < job->image->height; i++) {
+    for (int j = 0; j < width; j++) {
+      long source = (long) i*width + j;
+      for (int size = 2; job->samples[source] == 0 &&
+                         size <= PROGRESSIVE_BLOCK; size *= 2) {
+        source = (long) (i - i % size)*width + j - j % size;
+      }
 
-    // Get object properties
-    if (object->kind == OBJECT_KIND_SPHERE) {
-      vector3_sub(normal, intersect, ((sphere_t *) object)->position);
-      vector3_normalize(normal);
+      vec3_t color = job->sums[source];
+      if (job->samples[source] > 1) {
+        color = vec3_scale(color, 1.0 / job->samples[source]);
+      }
+      storePixel(job, job->image->pixels, NULL, 0, i, j, color, NULL);
     }
-    else if (object->kind == OBJECT_KIND_PLANE) {
-      vector3_copy(normal, ((plane_t *) object)->normal);
+  }
+}
+
+
+// Replace the whole output file with the image as it stands
+static int writeProgress(FILE *file, ppm_t *image, int format,
+                         render_stats_t *stats) {
+  double writeStart = traceNow();
+  rewind(file);
+  if (writePPM(image, file, format) != 0 || fflush(file) != 0 ||
+      ftruncate(fileno(file), ftell(file)) != 0) {
+    return 1;
+  }
+  stats->writeSeconds += traceNow() - writeStart;
+  stats->progressWrites++;
+  traceSpan(mainRing(stats->trace), "write", writeStart, TRACE_NO_ARG,
+            TRACE_NO_ARG);
+  return 0;
+}
+
+
+// Trace one progressive pass over the whole image
+static int progressivePass(render_job_t *job) {
+  ppm_t *image = job->image;
+  if (job->options->numThreads <= 1) {
+    tile_t whole = { 0, 0, image->width, image->height };
+    progressiveTile(&whole, 0, job);
+  }
+  else {
+    int errorStatus = scheduleTiles(image->width, image->height, TILE_SIZE,
+                                    job->options->numThreads,
+                                    progressiveTile, job);
+    if (errorStatus != 0) {
+      return errorStatus;
     }
+  }
+  return job->failed ? ARENA_ALLOC_ERROR : 0;
+}
+
+
+// Start every pixel over with no samples
+static void clearProgress(render_job_t *job) {
+  long numPixels = (long) job->image->width * job->image->height;
+  for (long i = 0; i < numPixels; i++) {
+    job->sums[i] = vec3_make(0, 0, 0);
+    job->samples[i] = 0;
+  }
+}
 
-    // Calculate the object intersect origin by shifting intersect off object
-    vector3_scale(tempVector, normal, EPSILON_OFFSET);
-    vector3_add(intersectOffset, intersect, tempVector);
-
-    // Calculate reflection vector
-    vector3_scale(tempVector, normal, 2*vector3_dot(ovDirection, normal));
-    vector3_sub(reflection, tempVector, ovDirection);
-    vector3_normalize(reflection);
-
-    // Get reflection color from recursive calls
-    reflectColor = raycast(intersectOffset, reflection, scene, numObjects,
-                           lights, numLights, level + 1, extIor, NULL);
-
-
-    /* Refraction calculation */
-    vector3_t refractColor = vector3_create(0, 0, 0); // Refraction color
-    vector3_t refraction = vector3_create(0, 0, 0);
-    vector3_t tangent = vector3_create(0, 0, 0);
-
-    vector3_cross(tempVector, normal, ovDirection);
-    vector3_normalize(tempVector);
-    vector3_cross(tangent, tempVector, normal);
-
-    vector3_scale(tempVector, ovDirection, extIor / object->ior);
-    double sinPhi = vector3_dot(tempVector, tangent);
-    double cosPhi = sqrt(1 - pow(sinPhi, 2));
 
-    vector3_scale(refraction, normal, -cosPhi);
-    vector3_scale(tempVector, tangent, sinPhi);
-    vector3_add(refraction, refraction, tempVector);
+int renderProgressive(FILE *file, int format, ppm_t *ppmImage,
+                      camera_t *camera, scene_t *scene,
+                      render_options_t *options, double deadline,
+                      render_stats_t *stats, arena_t *arena,
+                      arena_t *scratch) {
+
+  // The budget can lower the depth, so the job gets its own copy
+  render_options_t planned = *options;
+  render_job_t job;
+  setupJob(&job, ppmImage, camera, scene, &planned, scratch);
+  if (setupStats(&job, stats, arena) != 0) {
+    return ARENA_ALLOC_ERROR;
+  }
+  job.deadline = deadline;
 
-    refractColor = raycast(intersectOffset, refraction, scene, numObjects,
-                           lights, numLights, level + 1, object->ior,
-                           object == inObject ? NULL : object);
+  long numPixels = (long) ppmImage->width * ppmImage->height;
+  job.sums = arenaAlloc(arena, sizeof(vec3_t) * numPixels);
+  job.samples = arenaAlloc(arena, sizeof(int) * numPixels);
+  if (job.sums == NULL || job.samples == NULL) {
+    return ARENA_ALLOC_ERROR;
+  }
+  clearProgress(&job);
 
+  int numPasses = PROGRESSIVE_PASSES + options->numSamples - 1;
+  double lastWrite = traceNow();
 
-    /* Variables that DO change on a light by light basis */
-    vector3_t color = vector3_create(0, 0, 0); // No ambient light
+  // Under a deadline the blank image goes out first, so there is always
+  // a file and the time a write takes is known before any tracing
+  if (deadline > 0) {
+    resolveProgress(&job);
+    if (writeProgress(file, ppmImage, format, stats) != 0) {
+      return 1;
+    }
+    double now = traceNow();
+    job.deadline = deadline - 2 * (now - lastWrite);
+    lastWrite = now;
+    if (now >= job.deadline) {
+      numPasses = 0;
+    }
+  }
+  double sampleTime = 0; // Expected time of a pass over every pixel
 
-    // Declare all variables to be used in light loop
-    light_t *light;
-    vector3_t olDirection = vector3_create(0, 0, 0);
-    double lDistance;
-    double shadowObjectT;
+  for (job.pass = 0; job.pass < numPasses; job.pass++) {
+    double passStart = traceNow();
+    int errorStatus = progressivePass(&job);
+    if (errorStatus != 0) {
+      return errorStatus;
+    }
+    traceSpan(mainRing(stats->trace), "pass", passStart, TRACE_NO_ARG,
+              TRACE_NO_ARG);
+
+    // The interleaved passes add up to one sample of every pixel
+    double now = traceNow();
+    double passTime = now - passStart;
+    sampleTime = job.pass < PROGRESSIVE_PASSES ? sampleTime + passTime :
+                                                 passTime;
+
+    // Stop at the deadline, or before a sample pass that can't finish
+    if (deadline > 0) {
+      double nextTime = job.pass + 1 < PROGRESSIVE_PASSES ? 0 : sampleTime;
+      if (now + nextTime >= job.deadline) {
+        numPasses = job.pass + 1;
+      }
+    }
 
-    double frad = 1;
-    double fang = 1;
-    vector3_t diff = vector3_create(0, 0, 0);
-    vector3_t spec = vector3_create(0, 0, 0);
-    vector3_t lReflection = vector3_create(0, 0, 0);
+    // The coarse pass always goes out straight away, later passes once
+    // the interval has passed, and the last one whatever the time
+    if (job.pass == 0 || job.pass == numPasses - 1 ||
+        (options->progressInterval >= 0 &&
+         now - lastWrite >= options->progressInterval)) {
+      resolveProgress(&job);
+      if (writeProgress(file, ppmImage, format, stats) != 0) {
+        return 1;
+      }
+      lastWrite = traceNow();
+    }
 
-    // For each light in the world
-    for (int i = 0; i < numLights; i++) {
+    if (deadline > 0 && job.pass == 0 && numPasses > 1) {
+
+      // Hold back twice what the coarse image took to write for the last,
+      // now that it has real colors in it
+      job.deadline = deadline - 2 * (lastWrite - now);
+
+      // Lower the depth until the other interleaved passes should fit,
+      // timing the coarse pass again at each depth while there is time
+      while (planned.maxDepth > 1 &&
+             traceNow() + (PROGRESSIVE_PASSES - 1) * passTime >
+                 job.deadline &&
+             traceNow() + passTime < job.deadline) {
+        planned.maxDepth--;
+        clearProgress(&job);
+        passStart = traceNow();
+        errorStatus = progressivePass(&job);
+        if (errorStatus != 0) {
+          return errorStatus;
+        }
+        passTime = traceNow() - passStart;
+      }
+      sampleTime = passTime;
+    }
+  }
 
-      light = (light_t *) lights[i]; // Current light
+  mergeCounters(&job, stats);
 
-      // Get object to light vector and distance
-      vector3_sub(olDirection, light->position, intersect);
-      lDistance = vector3_mag(olDirection);
-      vector3_scale(olDirection, olDirection, 1 / lDistance); // Normalize dir
+  // Report the quality reached
+  stats->maxDepth = planned.maxDepth;
+  stats->minSamples = job.samples[0];
+  for (long i = 0; i < numPixels; i++) {
+    stats->tracedPixels += job.samples[i] > 0;
+    stats->numSamples += job.samples[i];
+    if (job.samples[i] < stats->minSamples) {
+      stats->minSamples = job.samples[i];
+    }
+    if (job.samples[i] > stats->maxSamples) {
+      stats->maxSamples = job.samples[i];
+    }
+  }
 
-      // Calculate light reflection vector
-      vector3_scale(tempVector, normal, 2*vector3_dot(olDirection, normal));
-      vector3_sub(lReflection, tempVector, olDirection);
-      vector3_normalize(lReflection);
+  return 0;
+}
 
-      // Get the t value of an intersecting object that casts shadows 
-      shadowObjectT = rayObjectIntersect(NULL, intersectOffset, olDirection,
-                                         scene, numObjects);
 
-      // Only color the object if there isn't an object any closer
-      if (shadowObjectT == NO_INTERSECTION_FOUND || shadowObjectT > lDistance) {
+int parseOptions(render_options_t *options, char **positional,
+                 int argc, char *argv[]) {
+
+  int numPositional = 0;
+
+  // Defaults
+  options->numThreads = 1;
+  options->accelKind = ACCEL_KIND_BVH;
+  options->simdKind = SIMD_KIND_AUTO;
+  options->engineKind = ENGINE_KIND_DEPTH;
+  options->packetSize = 1;
+  options->aaSamples = 1;
+  options->progressInterval = -1;
+  options->numSamples = 1;
+  options->timeBudget = 0;
+  options->aaThreshold = DEFAULT_AA_THRESHOLD;
+  options->maxDepth = DEFAULT_MAX_DEPTH;
+  options->minWeight = DEFAULT_MIN_WEIGHT;
+  options->bandHeight = 0;
+  options->outputFormat = PPM_OUTPUT_VERSION;
+  options->compilePath = NULL;
+  options->memoryReportPath = NULL;
+  options->statsFormat = STATS_FORMAT_OFF;
+  options->heatmapPath = NULL;
+  options->heatmapCost = HEATMAP_COST_TESTS;
+  options->tracePath = NULL;
+
+  for (int i = 1; i < argc; i++) {
+
+    // Anything that isn't a flag is a positional argument
+    if (strncmp(argv[i], "--", 2) != 0) {
+      if (numPositional == 4) {
+        return INVALID_OPTION;
+      }
+      positional[numPositional++] = argv[i];
+      continue;
+    }
 
-        // Calculate the attentuation factors
-        frad = radialAttenuation(light, lDistance);
-        fang = angularAttenuation(light, olDirection);
-        
-        // Calculate the diffuse and specular light contributions
-        diffuseReflection(diff, object->diffuse_color, light->color, normal,
-                          olDirection);
-        specularReflection(spec, object->specular_color, light->color,
-                           ovDirection, lReflection, 20);
+    // Every option takes a value
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Error: Option '%s' requires a value\n", argv[i]);
+      return INVALID_OPTION;
+    }
 
-        // Add to color channels
-        color[0] += frad * fang * (diff[0] + spec[0]);
-        color[1] += frad * fang * (diff[1] + spec[1]);
-        color[2] += frad * fang * (diff[2] + spec[2]);
+    if (strcmp(argv[i], "--threads") == 0) {
+      options->numThreads = atoi(argv[++i]);
+      if (options->numThreads == 0) {
+        options->numThreads = availableThreads();
+      }
+      else if (options->numThreads < 0) {
+        fprintf(stderr, "Error: Invalid thread count, must be >= 0\n");
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--accel") == 0) {
+      i++;
+      if (strcmp(argv[i], "bvh") == 0) {
+        options->accelKind = ACCEL_KIND_BVH;
+      }
+      else if (strcmp(argv[i], "list") == 0) {
+        options->accelKind = ACCEL_KIND_LIST;
+      }
+      else {
+        fprintf(stderr, "Error: Unknown acceleration '%s'\n", argv[i]);
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--engine") == 0) {
+      i++;
+      if (strcmp(argv[i], "depth") == 0) {
+        options->engineKind = ENGINE_KIND_DEPTH;
+      }
+      else if (strcmp(argv[i], "wavefront") == 0) {
+        options->engineKind = ENGINE_KIND_WAVEFRONT;
+      }
+      else {
+        fprintf(stderr, "Error: Unknown engine '%s'\n", argv[i]);
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--packet") == 0) {
+      options->packetSize = atoi(argv[++i]);
+      if (options->packetSize != 1 && options->packetSize != 2) {
+        fprintf(stderr, "Error: Invalid packet size, must be 1 or 2\n");
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--aa") == 0) {
+      options->aaSamples = atoi(argv[++i]);
+      if (options->aaSamples < 1 || options->aaSamples > MAX_AA_SAMPLES) {
+        fprintf(stderr, "Error: Invalid anti-aliasing grid, must be 1 to "
+                        "%d\n", MAX_AA_SAMPLES);
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--aa-threshold") == 0) {
+      options->aaThreshold = atof(argv[++i]);
+      if (options->aaThreshold < 0) {
+        fprintf(stderr, "Error: Invalid threshold, must be >= 0\n");
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--progressive") == 0) {
+      options->progressInterval = atof(argv[++i]);
+      if (options->progressInterval < 0) {
+        fprintf(stderr, "Error: Invalid interval, must be >= 0\n");
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--samples") == 0) {
+      options->numSamples = atoi(argv[++i]);
+      if (options->numSamples < 1) {
+        fprintf(stderr, "Error: Invalid sample count, must be >= 1\n");
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--time-budget") == 0) {
+      options->timeBudget = atof(argv[++i]);
+      if (options->timeBudget <= 0) {
+        fprintf(stderr, "Error: Invalid time budget, must be > 0\n");
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--simd") == 0) {
+      i++;
+      if (strcmp(argv[i], "auto") == 0) {
+        options->simdKind = SIMD_KIND_AUTO;
+      }
+      else if (strcmp(argv[i], "avx2") == 0) {
+        options->simdKind = SIMD_KIND_AVX2;
+      }
+      else if (strcmp(argv[i], "sse2") == 0) {
+        options->simdKind = SIMD_KIND_SSE2;
+      }
+      else if (strcmp(argv[i], "scalar") == 0) {
+        options->simdKind = SIMD_KIND_SCALAR;
+      }
+      else {
+        fprintf(stderr, "Error: Unknown instruction set '%s'\n", argv[i]);
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--max-depth") == 0) {
+      options->maxDepth = atoi(argv[++i]);
+      if (options->maxDepth < 1) {
+        fprintf(stderr, "Error: Invalid depth, must be >= 1\n");
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--min-weight") == 0) {
+      options->minWeight = atof(argv[++i]);
+      if (options->minWeight < 0) {
+        fprintf(stderr, "Error: Invalid weight, must be >= 0\n");
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--stream") == 0) {
+      options->bandHeight = atoi(argv[++i]);
+      if (options->bandHeight < 0) {
+        fprintf(stderr, "Error: Invalid band height, must be >= 0\n");
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--format") == 0) {
+      i++;
+      if (strcmp(argv[i], "p3") == 0 || strcmp(argv[i], "P3") == 0) {
+        options->outputFormat = 3;
+      }
+      else if (strcmp(argv[i], "p6") == 0 || strcmp(argv[i], "P6") == 0) {
+        options->outputFormat = 6;
       }
+      else {
+        fprintf(stderr, "Error: Unknown PPM format '%s'\n", argv[i]);
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--compile-scene") == 0) {
+      options->compilePath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--memory-report") == 0) {
+      options->memoryReportPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--stats") == 0) {
+      i++;
+      if (strcmp(argv[i], "text") == 0) {
+        options->statsFormat = STATS_FORMAT_TEXT;
+      }
+      else if (strcmp(argv[i], "json") == 0) {
+        options->statsFormat = STATS_FORMAT_JSON;
+      }
+      else {
+        fprintf(stderr, "Error: Unknown stats format '%s'\n", argv[i]);
+        return INVALID_OPTION;
+      }
+    }
+    else if (strcmp(argv[i], "--heatmap") == 0) {
+      options->heatmapPath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--trace") == 0) {
+      options->tracePath = argv[++i];
+    }
+    else if (strcmp(argv[i], "--heatmap-cost") == 0) {
+      i++;
+      if (strcmp(argv[i], "tests") == 0) {
+        options->heatmapCost = HEATMAP_COST_TESTS;
+      }
+      else if (strcmp(argv[i], "time") == 0) {
+        options->heatmapCost = HEATMAP_COST_TIME;
+      }
+      else {
+        fprintf(stderr, "Error: Unknown heatmap cost '%s'\n", argv[i]);
+        return INVALID_OPTION;
+      }
+    }
+    else {
+      fprintf(stderr, "Error: Unknown option '%s'\n", argv[i]);
+      return INVALID_OPTION;
+    }
+  }
+
+  // Progressive images are rewritten whole and refined by extra samples,
+  // which is also how a time budget is met
+  if ((options->progressInterval >= 0 || options->timeBudget > 0) &&
+      (options->bandHeight > 0 || options->aaSamples > 1)) {
+    fprintf(stderr, "Error: --progressive and --time-budget can't be used "
+                    "with --stream or --aa\n");
+    return INVALID_OPTION;
+  }
+
+  // Costs are kept for the whole image, which a stream never holds
+  if (options->heatmapPath != NULL && options->bandHeight > 0) {
+    fprintf(stderr, "Error: --heatmap can't be used with --stream\n");
+    return INVALID_OPTION;
+  }
+
+  return numPositional;
+}
+
+
+// Parse a CSV scene and write it out as a binary scene file
+static int compileScene(char *inputFName, render_options_t *options) {
+
+  FILE *inputFH;
+  camera_t camera;
+  scene_storage_t storage;
+  arena_t sceneArena;
+  arenaInit(&sceneArena, ARENA_SCENE_BLOCK_SIZE);
+
+  if (!(inputFH = fopen(inputFName, "r"))) {
+    fprintf(stderr, "Error: Input file '%s' could not be found\n", inputFName);
+    return 1;
+  }
+
+  int errorStatus = parseInput(&camera, &storage, &sceneArena, inputFH);
+  fclose(inputFH);
+
+  if (errorStatus != 0) {
+    fprintf(stderr, errorStatus == ARENA_ALLOC_ERROR ?
+                    "Error: Out of memory\n" : "Error: Malformed input CSV\n");
+    arenaFree(&sceneArena);
+    return 1;
+  }
+
+  bvh_t *bvh = NULL;
+  if (options->accelKind == ACCEL_KIND_BVH) {
+    bvh = bvhBuild(storage.objects, storage.numObjects, &sceneArena);
+    if (bvh == NULL) {
+      fprintf(stderr, "Error: Out of memory\n");
+      arenaFree(&sceneArena);
+      return 1;
     }
+  }
+
+  errorStatus = writeSceneFile(options->compilePath, &camera, &storage, bvh);
+  arenaFree(&sceneArena);
+
+  if (errorStatus != 0) {
+    fprintf(stderr, "Error: Unable to write scene to '%s'\n",
+            options->compilePath);
+    return 1;
+  }
+
+  return 0;
+}
+
 
-    // Calculate and clamp final color values
-    color[0] = clampValue(illumination*color[0] +
-                          object->reflectivity*reflectColor[0] +
-                          object->refractivity*refractColor[0], 0.0, 1.0);
-    color[1] = clampValue(illumination*color[1] +
-                          object->reflectivity*reflectColor[1] +
-                          object->refractivity*refractColor[1], 0.0, 1.0);
-    color[2] = clampValue(illumination*color[2] +
-                          object->reflectivity*reflectColor[2] +
-                          object->refractivity*refractColor[2], 0.0, 1.0);
+// Write the bytes taken from the arenas in each phase of the run
+static int writeMemoryReport(const char *path, size_t *allocated,
+                             size_t *reserved, size_t mapped) {
 
-    // Clean up allocated memory
-    free(tempVector);
-    free(ovDirection);
-    free(intersect);
-    free(intersectOffset);
-    free(normal);
-    free(tangent);
+  static const char *phaseNames[NUM_MEMORY_PHASES] = {
+    "load", "build", "render", "scratch"
+  };
 
-    free(reflectColor);
-    free(reflection);
+  FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Unable to open '%s' for writing\n", path);
+    return 1;
+  }
 
-    free(refractColor);
-    free(refraction);
+  size_t totalAllocated = 0;
+  size_t totalReserved = 0;
 
-    free(olDirection);
-    free(diff);
-    free(spec);
-    free(lReflection);
+  fprintf(file, "%-10s %14s %14s\n", "phase", "allocated", "reserved");
+  for (int i = 0; i < NUM_MEMORY_PHASES; i++) {
+    fprintf(file, "%-10s %14zu %14zu\n", phaseNames[i], allocated[i],
+            reserved[i]);
+    totalAllocated += allocated[i];
+    totalReserved += reserved[i];
+  }
+  fprintf(file, "%-10s %14zu %14zu\n", "total", totalAllocated,
+          totalReserved);
+  if (mapped > 0) {
+    fprintf(file, "%-10s %14s %14zu\n", "mapped", "-", mapped);
+  }
 
-    return color;
+  if (file != stdout) {
+    fclose(file);
   }
+
+  return 0;
 }
 
 
-// Actually creates and initializes the image, iterates over view plane
-int renderImage(ppm_t *ppmImage, camera_t *camera,
-                object_t **scene, int numObjects,
-                light_t **lights, int numLights) {
+// Map a cost from 0 to 1 on to black, blue, red, yellow and then white
+static pixel_t heatColor(double cost) {
+
+  static const double stops[5][3] = {
+    { 0, 0, 0 }, { 0, 0, 1 }, { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 }
+  };
+
+  double position = clampValue(cost, 0.0, 1.0) * 4;
+  int stop = position < 4 ? (int) position : 3;
+  double blend = position - stop;
+  pixel_t pixel;
+  pixel.r = (int) (255 * (stops[stop][0] +
+                          blend * (stops[stop + 1][0] - stops[stop][0])));
+  pixel.g = (int) (255 * (stops[stop][1] +
+                          blend * (stops[stop + 1][1] - stops[stop][1])));
+  pixel.b = (int) (255 * (stops[stop][2] +
+                          blend * (stops[stop + 1][2] - stops[stop][2])));
+  return pixel;
+}
 
-  // Iterate over every pixel in the would be image
-  double pixHeight = camera->height/ppmImage->height;
-  double pixWidth = camera->width/ppmImage->width;
 
-  // Declare the variables only once
-  double yCoord;
-  double xCoord;
-  vector3_t direction = vector3_create(0, 0, 0);
-  vector3_t color;
+static int compareCosts(const void *a, const void *b) {
+  double costA = *(const double *) a;
+  double costB = *(const double *) b;
+  return (costA > costB) - (costA < costB);
+}
 
-  for (int i = 0; i < ppmImage->height; i++) {
-    yCoord = camera->height/2 - pixHeight * (i + 0.5);
 
-    for (int j = 0; j < ppmImage->width; j++) {
-      xCoord = -camera->width/2 + pixWidth * (j + 0.5);
+// Write the cost of every pixel as a false color image. The scale tops
+// out at the HEATMAP_PERCENTILE cost, so a few pixels stalled by the
+// scheduler can't wash out the rest. Returns the cost shown as white
+static double writeHeatmap(const char *path, const double *costs,
+                           int width, int height, int format,
+                           arena_t *arena) {
 
-      // Create direction vector
-      direction[0] = xCoord;
-      direction[1] = yCoord;
-      direction[2] = -FOCAL_LENGTH;
-      vector3_normalize(direction);
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Unable to open '%s' for writing\n", path);
+    return -1;
+  }
 
-      // Get color from raycast
-      color = raycast(camera->position, direction, scene, numObjects,
-                      lights, numLights, 1, DEFAULT_IOR, NULL);
+  long numPixels = (long) width * height;
+  double *sorted = arenaAlloc(arena, sizeof(double) * numPixels);
+  pixel_t *pixels = arenaAlloc(arena, sizeof(pixel_t) * numPixels);
+  if (sorted == NULL || pixels == NULL) {
+    fprintf(stderr, "Error: Out of memory\n");
+    fclose(file);
+    return -1;
+  }
+  memcpy(sorted, costs, sizeof(double) * numPixels);
+  qsort(sorted, numPixels, sizeof(double), compareCosts);
+  double maxCost = sorted[(long) ((numPixels - 1) * HEATMAP_PERCENTILE)];
+
+  ppm_t heatmap;
+  heatmap.width = width;
+  heatmap.height = height;
+  heatmap.maxColorValue = 255;
+  heatmap.pixels = pixels;
+  heatmap.mapping = NULL;
+  heatmap.mappingSize = 0;
+  for (long i = 0; i < numPixels; i++) {
+    heatmap.pixels[i] = heatColor(maxCost > 0 ? costs[i] / maxCost : 0);
+  }
+
+  int writeStatus = writePPM(&heatmap, file, format);
+  if (fclose(file) != 0 || writeStatus != 0) {
+    fprintf(stderr, "Error: Unable to write '%s'\n", path);
+    return -1;
+  }
+
+  return maxCost;
+}
 
-      // Populate pixel with color data
-      ppmImage->pixels[i*ppmImage->width + j].r = (int) (color[0] * 255);
-      ppmImage->pixels[i*ppmImage->width + j].g = (int) (color[1] * 255);
-      ppmImage->pixels[i*ppmImage->width + j].b = (int) (color[2] * 255);
+
+// Print the time of each phase and the work the render threads counted
+static void writeStats(FILE *file, int format, const double *seconds,
+                       const ray_counters_t *counters, long numPixels,
+                       int simdKind) {
+
+  static const char *phaseNames[NUM_TIME_PHASES] = {
+    "parse", "build", "render", "write"
+  };
+
+  long numRays = counters->primaryRays + counters->reflectRays +
+                 counters->refractRays + counters->shadowRays;
+  double raysPerSecond = seconds[TIME_PHASE_RENDER] > 0 ?
+                         numRays / seconds[TIME_PHASE_RENDER] : 0;
+
+  const char *names[] = {
+    "primary_rays", "reflect_rays", "refract_rays", "shadow_rays",
+    "sphere_tests", "plane_tests", "box_tests", "hits", "misses",
+    "occluded"
+  };
+  long values[] = {
+    counters->primaryRays, counters->reflectRays, counters->refractRays,
+    counters->shadowRays, counters->sphereTests, counters->planeTests,
+    counters->boxTests, counters->hits, counters->misses,
+    counters->occluded
+  };
+  int numValues = sizeof(values) / sizeof(values[0]);
+
+  if (format == STATS_FORMAT_JSON) {
+    fprintf(file, "{\n  \"seconds\": {");
+    for (int i = 0; i < NUM_TIME_PHASES; i++) {
+      fprintf(file, "%s\"%s\": %.6f", i > 0 ? ", " : "", phaseNames[i],
+              seconds[i]);
+    }
+    fprintf(file, "},\n  \"simd\": \"%s\",\n", simdKindName(simdKind));
+    fprintf(file, "  \"pixels\": %ld,\n", numPixels);
+    for (int i = 0; i < numValues; i++) {
+      fprintf(file, "  \"%s\": %ld,\n", names[i], values[i]);
     }
+    fprintf(file, "  \"level_rays\": [");
+    for (int i = 0; i < COUNTERS_MAX_LEVELS; i++) {
+      fprintf(file, "%s%ld", i > 0 ? ", " : "", counters->levelRays[i]);
+    }
+    fprintf(file, "],\n  \"deepest_level\": %d,\n", counters->deepestLevel);
+    fprintf(file, "  \"mrays_per_second\": %.3f\n}\n",
+            raysPerSecond / 1e6);
+    return;
   }
 
-  return 0; // No errors!
+  fprintf(file, "%-14s %14s\n", "phase", "seconds");
+  for (int i = 0; i < NUM_TIME_PHASES; i++) {
+    fprintf(file, "%-14s %14.6f\n", phaseNames[i], seconds[i]);
+  }
+  fprintf(file, "\n%-14s %14s\n", "counter", "count");
+  fprintf(file, "%-14s %14ld\n", "pixels", numPixels);
+  for (int i = 0; i < numValues; i++) {
+    fprintf(file, "%-14s %14ld\n", names[i], values[i]);
+  }
+  for (int i = 0; i < COUNTERS_MAX_LEVELS; i++) {
+    fprintf(file, "level %d%-7s %14ld\n", i + 1,
+            i + 1 == COUNTERS_MAX_LEVELS ? "+" : "",
+            counters->levelRays[i]);
+  }
+  fprintf(file, "%-14s %14d\n", "deepest_level", counters->deepestLevel);
+  fprintf(file, "%-14s %14.3f\n", "mrays_per_sec", raysPerSecond / 1e6);
+  fprintf(file, "%-14s %14s\n", "simd", simdKindName(simdKind));
 }
 
 
 int main(int argc, char *argv[]) {
 
+  double startTime = traceNow(); // A time budget covers the whole run
+  render_options_t options;
+  char *positional[4];
+
   // Check for the appropriate number of parameters
-  if (argc != 5) {
+  int numPositional = parseOptions(&options, positional, argc, argv);
+  if (options.compilePath != NULL && numPositional == 1) {
+    return compileScene(positional[0], &options);
+  }
+  if (numPositional != 4 || options.compilePath != NULL) {
     fprintf(stderr, USAGE_MESSAGE);
     return 1;
   }
 
   // Save command line parameters
-  int viewWidth = atoi(argv[1]);
-  int viewHeight = atoi(argv[2]);
-  char *inputFName = argv[3];
-  char *outputFName = argv[4];
+  int viewWidth = atoi(positional[0]);
+  int viewHeight = atoi(positional[1]);
+  char *inputFName = positional[2];
+  char *outputFName = positional[3];
 
   if (viewWidth <= 0 || viewHeight <= 0) {
     fprintf(stderr, "Error: Invalid width or height, must be > 0\n");
     return 1;
   }
 
-  // Initialize variables to be used in program
-  FILE *inputFH;
-  FILE *outputFH;
-  camera_t *camera = malloc(sizeof(camera_t));
-  object_t **scene = malloc(sizeof(object_t) * MAX_SCENE_OBJECTS);
-  light_t **lights = malloc(sizeof(light_t) * MAX_SCENE_LIGHTS);
-  int *numObjects;
-
-  // Create final ppmImage
-  ppm_t *ppmImage = malloc(sizeof(ppm_t));
-  ppmImage->width = viewWidth;
-  ppmImage->height = viewHeight;
-  ppmImage->maxColorValue = 255;
-  ppmImage->pixels = malloc(sizeof(pixel_t)*ppmImage->width*ppmImage->height);
-
-  // Handle input file errors
-  if (!(inputFH = fopen(inputFName, "r"))) {
-    fprintf(stderr, "Error: Input file '%s' could not be found\n", inputFName);
-    return 1;
+  // Initialize variables to be used in program. Everything the scene
+  // needs lives in one arena, everything the frame needs in another, and
+  // every error from here on goes through the clean up at the end
+  FILE *outputFH = NULL;
+  arena_t *scratch = NULL;
+  int numScratch = 0;
+  int errorStatus = 0;
+  camera_t *camera;
+  scene_storage_t storage;
+  mapped_scene_t mapped;
+  scene_t world;
+  world.bvh = NULL;
+  world.list = NULL;
+  mapped.mapping = NULL;
+  mapped.mappingSize = 0;
+
+  arena_t sceneArena;
+  arena_t frameArena;
+  arenaInit(&sceneArena, ARENA_SCENE_BLOCK_SIZE);
+  arenaInit(&frameArena, ARENA_SCENE_BLOCK_SIZE);
+  size_t allocated[NUM_MEMORY_PHASES] = {0};
+  size_t reserved[NUM_MEMORY_PHASES] = {0};
+  double seconds[NUM_TIME_PHASES] = {0};
+
+  // The timeline starts with the scene, every render thread has a track
+  trace_t trace;
+  trace_t *timeline = NULL;
+  if (options.tracePath != NULL) {
+    if (traceInit(&trace, options.numThreads < 1 ? 1 : options.numThreads,
+                  &frameArena) != 0) {
+      fprintf(stderr, "Error: Out of memory\n");
+      errorStatus = 1;
+      goto cleanup;
+    }
+    timeline = &trace;
+  }
+  double phaseStart = traceNow();
+
+  // Compiled scenes are used straight from the file
+  if (isSceneFile(inputFName)) {
+    errorStatus = mapSceneFile(&mapped, inputFName, &sceneArena);
+    if (errorStatus == ARENA_ALLOC_ERROR) {
+      fprintf(stderr, "Error: Out of memory\n");
+    }
+    else if (errorStatus != 0) {
+      fprintf(stderr, "Error: Malformed or outdated scene file '%s'\n",
+              inputFName);
+    }
+    if (errorStatus != 0) {
+      errorStatus = 1;
+      goto cleanup;
+    }
+
+    camera = mapped.camera;
+    storage = mapped.storage;
+    if (options.accelKind == ACCEL_KIND_BVH) {
+      world.bvh = mapped.bvh;
+    }
   }
+  else {
+    FILE *inputFH;
+    camera = arenaAlloc(&sceneArena, sizeof(camera_t));
+    if (camera == NULL) {
+      fprintf(stderr, "Error: Out of memory\n");
+      errorStatus = 1;
+      goto cleanup;
+    }
 
-  // Parse input csv into scene object
-  numObjects = parseInput(camera, scene, lights, inputFH);
+    // Handle input file errors
+    if (!(inputFH = fopen(inputFName, "r"))) {
+      fprintf(stderr, "Error: Input file '%s' could not be found\n",
+              inputFName);
+      errorStatus = 1;
+      goto cleanup;
+    }
 
-  // Handle errors found in parseInput
-  if (numObjects == NULL) {
-    fprintf(stderr, "Error: Malformed input CSV\n");
-    return 1;
+    // Parse input csv into scene object
+    errorStatus = parseInput(camera, &storage, &sceneArena, inputFH);
+    fclose(inputFH);
+
+    // Handle errors found in parseInput
+    if (errorStatus == ARENA_ALLOC_ERROR) {
+      fprintf(stderr, "Error: Out of memory\n");
+    }
+    else if (errorStatus != 0) {
+      fprintf(stderr, "Error: Malformed input CSV\n");
+    }
+    if (errorStatus != 0) {
+      errorStatus = 1;
+      goto cleanup;
+    }
+  }
+
+  world.objects = storage.objects;
+  world.numObjects = storage.numObjects;
+  world.lights = storage.lights;
+  world.numLights = storage.numLights;
+
+  // The kernels count the primitives of one call in real_t lanes
+  if (storage.numPlanes > KERNEL_MAX_RANGE ||
+      (options.accelKind != ACCEL_KIND_BVH &&
+       storage.numSpheres > KERNEL_MAX_RANGE)) {
+    fprintf(stderr, "Error: A " REAL_NAME " build takes at most %d planes, "
+                    "or spheres with --accel list\n", KERNEL_MAX_RANGE);
+    errorStatus = 1;
+    goto cleanup;
+  }
+
+  allocated[MEMORY_PHASE_LOAD] = sceneArena.allocated;
+  reserved[MEMORY_PHASE_LOAD] = sceneArena.reserved;
+  seconds[TIME_PHASE_PARSE] = traceNow() - phaseStart;
+  traceSpan(mainRing(timeline), "parse", phaseStart, TRACE_NO_ARG,
+            TRACE_NO_ARG);
+  phaseStart = traceNow();
+
+  // Build the acceleration structure once up front, unless it was loaded
+  int simdKind = kernelsInit(options.simdKind);
+  if (options.accelKind == ACCEL_KIND_BVH) {
+    if (world.bvh == NULL) {
+      world.bvh = bvhBuild(world.objects, world.numObjects, &sceneArena);
+      errorStatus = world.bvh == NULL;
+    }
+  }
+  else {
+    world.list = arenaAlloc(&sceneArena, sizeof(primitive_list_t));
+    errorStatus = world.list == NULL ||
+                  primitiveListBuild(world.list, world.objects,
+                                     world.numObjects, NULL,
+                                     &sceneArena) != 0;
+  }
+  if (errorStatus != 0) {
+    fprintf(stderr, "Error: Out of memory\n");
+    goto cleanup;
   }
 
-  // Create actual PPM image from scene
-  renderImage(ppmImage, camera, scene, numObjects[0], lights, numObjects[1]);
+  allocated[MEMORY_PHASE_BUILD] = sceneArena.allocated -
+                                  allocated[MEMORY_PHASE_LOAD];
+  reserved[MEMORY_PHASE_BUILD] = sceneArena.reserved -
+                                 reserved[MEMORY_PHASE_LOAD];
+  seconds[TIME_PHASE_BUILD] = traceNow() - phaseStart;
+  traceSpan(mainRing(timeline), "build", phaseStart, TRACE_NO_ARG,
+            TRACE_NO_ARG);
 
   // Handle open errors on output file
   if (!(outputFH = fopen(outputFName, "w"))) {
     fprintf(stderr, "Error: Unable to open '%s' for writing\n", outputFName);
-    return 1;
+    errorStatus = 1;
+    goto cleanup;
   }
 
-  // Write final raycasted product to the designated PPM file
-  writePPM(ppmImage, outputFH, PPM_OUTPUT_VERSION);
+  // Every render thread gets a scratch arena of its own
+  numScratch = options.numThreads < 1 ? 1 : options.numThreads;
+  scratch = arenaAlloc(&frameArena, sizeof(arena_t) * numScratch);
+  if (scratch == NULL) {
+    fprintf(stderr, "Error: Out of memory\n");
+    errorStatus = 1;
+    goto cleanup;
+  }
+  for (int i = 0; i < numScratch; i++) {
+    arenaInit(&scratch[i], ARENA_SCRATCH_BLOCK_SIZE);
+  }
 
-  // Final program clean up
-  fclose(inputFH);
+  // Stream bands straight to the file without holding the whole image
+  render_stats_t stats = {0};
+  stats.trace = timeline;
+  if (options.heatmapPath != NULL) {
+    long numPixels = (long) viewWidth * viewHeight;
+    stats.pixelCosts = arenaAlloc(&frameArena, sizeof(double) * numPixels);
+    if (stats.pixelCosts == NULL) {
+      fprintf(stderr, "Error: Out of memory\n");
+      errorStatus = 1;
+      goto cleanup;
+    }
+    for (long i = 0; i < numPixels; i++) {
+      stats.pixelCosts[i] = 0;
+    }
+  }
+  phaseStart = traceNow();
+  if (options.bandHeight > 0) {
+    int renderStatus = renderStream(outputFH, options.outputFormat,
+                                    viewWidth, viewHeight, camera, &world,
+                                    &options, &stats, &frameArena, scratch);
+    if (renderStatus == ARENA_ALLOC_ERROR) {
+      fprintf(stderr, "Error: Out of memory\n");
+      errorStatus = 1;
+    }
+    else if (renderStatus != 0) {
+      fprintf(stderr, "Error: Unable to write '%s'\n", outputFName);
+      errorStatus = 1;
+    }
+  }
+  else {
 
-  return 0;
+    // Create final ppmImage
+    ppm_t *ppmImage = arenaAlloc(&frameArena, sizeof(ppm_t));
+    if (ppmImage == NULL) {
+      fprintf(stderr, "Error: Out of memory\n");
+      errorStatus = 1;
+      goto cleanup;
+    }
+    ppmImage->width = viewWidth;
+    ppmImage->height = viewHeight;
+    ppmImage->maxColorValue = 255;
+    ppmImage->pixels = arenaAlloc(&frameArena, sizeof(pixel_t)*
+                                  ppmImage->width*ppmImage->height);
+    if (ppmImage->pixels == NULL) {
+      fprintf(stderr, "Error: Out of memory\n");
+      errorStatus = 1;
+      goto cleanup;
+    }
+    ppmImage->mapping = NULL;
+    ppmImage->mappingSize = 0;
+
+    // Progressive renders write the file themselves as they go
+    if (options.progressInterval >= 0 || options.timeBudget > 0) {
+      double deadline = 0;
+      if (options.timeBudget > 0) {
+        deadline = startTime + options.timeBudget / 1000;
+      }
+      int renderStatus = renderProgressive(outputFH, options.outputFormat,
+                                           ppmImage, camera, &world,
+                                           &options, deadline, &stats,
+                                           &frameArena, scratch);
+      if (renderStatus == ARENA_ALLOC_ERROR) {
+        fprintf(stderr, "Error: Out of memory\n");
+        errorStatus = 1;
+      }
+      else if (renderStatus != 0) {
+        fprintf(stderr, "Error: Unable to render '%s'\n", outputFName);
+        errorStatus = 1;
+      }
+    }
+    else {
+
+      // Create actual PPM image from scene
+      int renderStatus = renderImage(ppmImage, camera, &world, &options,
+                                     &stats, &frameArena, scratch);
+      if (renderStatus == ARENA_ALLOC_ERROR) {
+        fprintf(stderr, "Error: Out of memory\n");
+        errorStatus = 1;
+      }
+      else if (renderStatus != 0) {
+        fprintf(stderr, "Error: Unable to render '%s'\n", outputFName);
+        errorStatus = 1;
+      }
+
+      // Write final raycasted product to the designated PPM file
+      double writeStart = traceNow();
+      if (writePPM(ppmImage, outputFH, options.outputFormat) != 0) {
+        fprintf(stderr, "Error: Unable to write '%s'\n", outputFName);
+        errorStatus = 1;
+      }
+      stats.writeSeconds += traceNow() - writeStart;
+      traceSpan(mainRing(timeline), "write", writeStart, TRACE_NO_ARG,
+                TRACE_NO_ARG);
+    }
+  }
+  seconds[TIME_PHASE_RENDER] = traceNow() - phaseStart -
+                               stats.writeSeconds;
+  traceSpan(mainRing(timeline), "render", phaseStart, TRACE_NO_ARG,
+            TRACE_NO_ARG);
+
+  // Compare the camera rays spent with a full grid in every pixel
+  if (options.aaSamples > 1) {
+    long numPixels = (long) viewWidth * viewHeight;
+    long gridRays = numPixels * options.aaSamples * options.aaSamples;
+    printf("Anti-aliasing: refined %ld of %ld pixels, %ld extra camera "
+           "rays, %ld in all (%.2f per pixel) against %ld for a full "
+           "%dx%d grid\n", stats.refinedPixels, numPixels, stats.extraRays,
+           numPixels + stats.extraRays,
+           (double) (numPixels + stats.extraRays) / numPixels, gridRays,
+           options.aaSamples, options.aaSamples);
+  }
+
+  // Show where the cost went, and what the brightest color stands for
+  if (options.heatmapPath != NULL) {
+    double heatmapStart = traceNow();
+    double maxCost = writeHeatmap(options.heatmapPath, stats.pixelCosts,
+                                  viewWidth, viewHeight,
+                                  options.outputFormat, &frameArena);
+    if (maxCost < 0) {
+      errorStatus = 1;
+    }
+    else {
+      printf("Heatmap: white is %.0f %s or more in a pixel\n", maxCost,
+             options.heatmapCost == HEATMAP_COST_TIME ? "ns" : "tests");
+    }
+    traceSpan(mainRing(timeline), "heatmap", heatmapStart, TRACE_NO_ARG,
+              TRACE_NO_ARG);
+  }
+
+  // State how much of the requested quality fit in the budget
+  if (options.timeBudget > 0) {
+    long numPixels = (long) viewWidth * viewHeight;
+    printf("Time budget: %.0f of %.0f ms, depth %d of %d, %.1f%% of "
+           "pixels traced, %d to %d samples per pixel (%.2f average) of "
+           "%d\n", (traceNow() - startTime) * 1000, options.timeBudget,
+           stats.maxDepth, options.maxDepth,
+           100.0 * stats.tracedPixels / numPixels, stats.minSamples,
+           stats.maxSamples, (double) stats.numSamples / numPixels,
+           options.numSamples);
+  }
+
+  allocated[MEMORY_PHASE_RENDER] = frameArena.allocated;
+  reserved[MEMORY_PHASE_RENDER] = frameArena.peakReserved;
+  for (int i = 0; i < numScratch; i++) {
+    allocated[MEMORY_PHASE_SCRATCH] += scratch[i].allocated;
+    reserved[MEMORY_PHASE_SCRATCH] += scratch[i].peakReserved;
+  }
+
+  // Final program clean up, each arena goes at once
+  phaseStart = traceNow();
+  if (fclose(outputFH) != 0) {
+    fprintf(stderr, "Error: Unable to write '%s'\n", outputFName);
+    errorStatus = 1;
+  }
+  outputFH = NULL;
+  seconds[TIME_PHASE_WRITE] = stats.writeSeconds + traceNow() - phaseStart;
+  traceSpan(mainRing(timeline), "close", phaseStart, TRACE_NO_ARG,
+            TRACE_NO_ARG);
+
+  if (timeline != NULL && traceWrite(timeline, options.tracePath) != 0) {
+    fprintf(stderr, "Error: Unable to write '%s'\n", options.tracePath);
+    errorStatus = 1;
+  }
+
+  if (options.statsFormat != STATS_FORMAT_OFF) {
+    writeStats(stdout, options.statsFormat, seconds, &stats.counters,
+               (long) viewWidth * viewHeight, simdKind);
+  }
+  if (options.memoryReportPath != NULL) {
+    errorStatus |= writeMemoryReport(options.memoryReportPath, allocated,
+                                     reserved, mapped.mappingSize);
+  }
+
+cleanup:
+  if (outputFH != NULL) {
+    fclose(outputFH);
+  }
+  for (int i = 0; scratch != NULL && i < numScratch; i++) {
+    arenaFree(&scratch[i]);
+  }
+  arenaFree(&frameArena);
+  if (mapped.mapping != NULL) {
+    unmapSceneFile(&mapped);
+  }
+  arenaFree(&sceneArena);
+
+  return errorStatus;
 }
@@ -9,23 +9,201 @@
 #include "vector.h"
 #include "parsing.h"
 #include "math_helpers.h"
+#include "scheduler.h"
+#include "bvh.h"
+#include "kernels.h"
+#include "scene_file.h"
+#include "arena.h"
+#include "counters.h"
+#include "trace.h"
 
 // Numeric constants
-#define PPM_OUTPUT_VERSION 3
-#define MAX_SCENE_OBJECTS 128
-#define MAX_SCENE_LIGHTS 128
+#define PPM_OUTPUT_VERSION 6 // Default, --format p3 selects ASCII
 #define FOCAL_LENGTH 1.0 // In world units
+#ifdef RAYCAST_FLOAT // Shift off a surface, many times the rounding of real_t
+#define EPSILON_OFFSET 0.002
+#else
 #define EPSILON_OFFSET 0.000125
-#define MAX_RECURSION_LEVEL 3
+#endif
+#define DEFAULT_MAX_DEPTH 3
+#define DEFAULT_MIN_WEIGHT (1.0 / 256) // Below one step of 8-bit color
 #define DEFAULT_IOR 1.0
+#define DEFAULT_AA_THRESHOLD 0.1 // Color difference that marks an edge
+#define MAX_AA_SAMPLES 16 // Widest grid of samples in a refined pixel
+#define PROGRESSIVE_BLOCK 4 // The first progressive pass traces 1 in 4x4
+#define PROGRESSIVE_PASSES 16 // Interleaved passes to reach every pixel
+#define TILE_SIZE 16 // In pixels
+
+#define RAY_STAGE_REFLECT 0 // Reflection ray not cast yet
+#define RAY_STAGE_REFRACT 1 // Refraction ray not cast yet
+#define RAY_STAGE_SHADE 2 // Both children returned, color not combined yet
+#define RAY_STAGE_DONE 3 // Color is final
+
+#define ENGINE_KIND_DEPTH 1 // Each pixel's ray tree in turn
+#define ENGINE_KIND_WAVEFRONT 2 // A tile's rays one bounce at a time
+#define WAVE_QUEUE_CAPACITY 1024 // Rays in a wavefront queue to start with
+
+#define ACCEL_KIND_LIST 1
+#define ACCEL_KIND_BVH 2
+
+#define MEMORY_PHASE_LOAD 0 // Scene arena while the scene is read
+#define MEMORY_PHASE_BUILD 1 // Scene arena while the hierarchy is built
+#define MEMORY_PHASE_RENDER 2 // Frame arena
+#define MEMORY_PHASE_SCRATCH 3 // Every render thread's scratch arena
+#define NUM_MEMORY_PHASES 4
+
+#define STATS_FORMAT_OFF 0
+#define STATS_FORMAT_TEXT 1
+#define STATS_FORMAT_JSON 2
+
+#define HEATMAP_COST_TESTS 1 // Sphere, plane and bounding box tests
+#define HEATMAP_COST_TIME 2 // Nanoseconds
+#define HEATMAP_PERCENTILE 0.99 // Share of pixels below white
+
+#define TIME_PHASE_PARSE 0 // Reading or mapping the scene
+#define TIME_PHASE_BUILD 1 // Building the acceleration structure
+#define TIME_PHASE_RENDER 2 // Tracing, less any writing done along the way
+#define TIME_PHASE_WRITE 3 // Writing the output file
+#define NUM_TIME_PHASES 4
+
+// Error code constants
+#define INVALID_OPTION -6
 
 // String constants
 #define USAGE_MESSAGE "\
-Usage: raycast width height input_file output.ppm\n\
+Usage: raycast [options] width height input_file output.ppm\n\
+       raycast --compile-scene scene_file [options] input.csv\n\
   width: pixel width of the view plane\n\
   height: pixel height of the view plane\n\
-  input_file: csv file of scene objects\n\
-  output_file: final out PPM file name\n"
+  input_file: csv file of scene objects, or a compiled scene\n\
+  output_file: final out PPM file name\n\
+Options:\n\
+  --threads N: render tiles on N threads (0 uses every core, default 1)\n\
+  --accel KIND: closest hit search, bvh (default) or list\n\
+  --engine KIND: ray tree order, depth (default) or wavefront\n\
+  --packet N: trace camera rays in N by N packets, 1 (default) or 2\n\
+  --aa N: trace pixels on an edge again with N by N rays (default 1, off)\n\
+  --aa-threshold T: color difference from a neighbour that marks an edge\n\
+  --progressive SECONDS: trace a coarse image first and rewrite the output\n\
+    as it fills in, at most every SECONDS\n\
+  --samples N: samples per pixel in a progressive render (default 1)\n\
+  --time-budget MS: finish within MS milliseconds of starting, lowering the\n\
+    depth, samples and resolution reached as needed\n\
+  --simd KIND: intersection kernels, auto (default), avx2, sse2 or scalar\n\
+  --max-depth N: number of bounces in each ray tree (default 3)\n\
+  --min-weight W: skip secondary rays contributing less than W\n\
+  --stream ROWS: render and write bands of ROWS rows (default 0, off)\n\
+  --format FORMAT: output PPM format, p6 (default, binary) or p3 (ASCII)\n\
+  --compile-scene FILE: write the csv scene to FILE as a binary scene, with\n\
+    a prebuilt bvh unless --accel list is given, instead of rendering\n\
+  --memory-report FILE: write bytes allocated in each phase to FILE,\n\
+    - for standard output\n\
+  --stats FORMAT: print ray counts and the time of each phase, as text or\n\
+    json\n\
+  --heatmap FILE: also write the cost of each pixel's ray tree to FILE as\n\
+    a false color PPM\n\
+  --heatmap-cost KIND: cost shown in the heatmap, tests (default) or time\n\
+  --trace FILE: write a timeline of each phase, tile and write to FILE as\n\
+    Chrome trace event JSON\n"
+
+// Define types to be used in c file
+typedef struct render_options_t render_options_t;
+typedef struct scene_t scene_t;
+typedef struct render_stats_t render_stats_t;
+typedef struct ray_frame_t ray_frame_t;
+typedef struct wave_ray_t wave_ray_t;
+typedef struct shadow_ray_t shadow_ray_t;
+typedef struct wave_queue_t wave_queue_t;
+
+struct render_options_t {
+  int numThreads;
+  int accelKind;
+  int simdKind;
+  int engineKind;
+  int packetSize; // Side of the pixel blocks traced together, 1 for none
+  int aaSamples; // Side of the sample grid in refined pixels, 1 for none
+  double aaThreshold; // Largest color difference between plain neighbours
+  double progressInterval; // Seconds between progressive writes, -1 off
+  int numSamples; // Samples per pixel in progressive mode
+  double timeBudget; // Milliseconds for the whole run, 0 for no limit
+  int maxDepth; // Deepest recursion level that is still traced
+  double minWeight; // Smallest share of the pixel a secondary ray may carry
+  int bandHeight; // Rows per streamed band, 0 renders the whole image
+  int outputFormat; // PPM magic number to write, 3 or 6
+  char *compilePath; // Binary scene to write instead of rendering, or NULL
+  char *memoryReportPath; // Where to write arena usage, or NULL
+  int statsFormat; // STATS_FORMAT_OFF unless counters are kept
+  char *heatmapPath; // Where to write the cost of each pixel, or NULL
+  int heatmapCost; // What the heatmap measures
+  char *tracePath; // Where to write the timeline of the run, or NULL
+};
+
+struct scene_t {
+  object_t **objects;
+  int numObjects;
+  light_t *lights;
+  int numLights;
+  bvh_t *bvh; // NULL when every object is tested in turn
+  primitive_list_t *list; // Flat copy of the objects, used without a bvh
+};
+
+struct render_stats_t { // Work done while rendering, added to as it goes
+  long refinedPixels; // Pixels traced again by anti-aliasing
+  long extraRays; // Camera rays spent refining them
+  int progressWrites; // Progressive images written to the output file
+  int maxDepth; // Depth a progressive render ended up tracing
+  long tracedPixels; // Pixels with a sample of their own
+  long numSamples; // Samples traced over the whole image
+  int minSamples; // Fewest samples in any pixel
+  int maxSamples;
+  double writeSeconds; // Spent writing the file while rendering
+  double *pixelCosts; // Cost of each pixel's ray trees, NULL without one
+  trace_t *trace; // Timeline to add spans to, NULL without one
+  ray_counters_t counters; // Every thread's counters, with --stats
+};
+
+struct ray_frame_t { // One ray of a ray tree waiting on its children
+  vec3_t origin;
+  vec3_t ovDirection; // Back towards the origin
+  vec3_t intersect;
+  vec3_t intersectOffset; // Shifted off the surface for secondary rays
+  vec3_t normal;
+  vec3_t color;
+  vec3_t reflectColor;
+  vec3_t refractColor;
+  object_t *object;
+  object_t *inObject;
+  real_t weight; // Share of the pixel color this ray contributes
+  real_t reflectWeight; // 0 when the reflection ray is not cast
+  real_t refractWeight;
+  real_t extIor;
+  int stage;
+};
+
+struct wave_ray_t { // Ray in a wavefront queue
+  ray_frame_t frame;
+  vec3_t direction;
+  vec3_t light; // Direct light at the hit, summed from the shadow rays
+  real_t t;
+  int parent; // Index of the ray that cast this one, -1 for camera rays
+  int isRefraction; // Which of its parent's colors this ray returns
+};
+
+struct shadow_ray_t { // Ray from a hit in a wavefront queue to a light
+  vec3_t direction;
+  real_t distance;
+  int ray;
+  int light;
+  int occluded;
+};
+
+struct wave_queue_t { // Queues of the wavefront engine, reused per batch
+  arena_t *arena; // Arena the queues are grown in
+  wave_ray_t *rays;
+  int rayCapacity;
+  shadow_ray_t *shadows;
+  int shadowCapacity;
+};
 
 
 /**
@@ -35,47 +213,210 @@ Usage: raycast width height input_file output.ppm\n\
  * @param  outObject   reference to object that was hit
  * @param  origin      point to send the ray from
  * @param  direction   direction to send the ray
- * @param  scene       list of all objects in scene
- * @param  numObjects  number of objects in the scene
+ * @param  tMax        furthest t that counts as a hit
+ * @param  scene       scene to search, using its hierarchy if it has one
  * @return             the t value of the intersection point
  */
-double rayObjectIntersect(object_t **outObject, vector3_t origin,
-                          vector3_t direction, object_t **scene,
-                          int numObjects);
+real_t rayObjectIntersect(object_t **outObject, vec3_t origin,
+                          vec3_t direction, real_t tMax, scene_t *scene);
+
+/**
+ * Occlusion query used for shadow rays. Returns as soon as any object
+ * is found within tMax instead of searching for the closest one.
+ * 
+ * @param  origin      point to send the ray from
+ * @param  direction   direction to send the ray
+ * @param  tMax        furthest t that counts as a hit
+ * @param  scene       scene to search, using its hierarchy if it has one
+ * @return             1 if the ray is blocked, otherwise 0
+ */
+int rayOccluded(vec3_t origin, vec3_t direction, real_t tMax,
+                scene_t *scene);
+
+/**
+ * Find the closest object for every lane of a packet, with the same
+ * result rayObjectIntersect gives each ray on its own.
+ * 
+ * @param  outObjects  object hit in each lane
+ * @param  outT        t value of the hit in each lane
+ * @param  packet      rays to trace
+ * @param  scene       scene to search, using its hierarchy if it has one
+ * @return             mask of the lanes that hit something
+ */
+int rayPacketIntersect(object_t **outObjects, real_t *outT,
+                       const ray_packet_t *packet, scene_t *scene);
+
+/**
+ * Occlusion query for a packet of shadow rays, each lane up to its tMax.
+ * 
+ * @param  packet      rays to test
+ * @param  scene       scene to search, using its hierarchy if it has one
+ * @return             mask of the lanes that are blocked
+ */
+int rayPacketOccluded(const ray_packet_t *packet, scene_t *scene);
 
 /**
  * Casts a single ray given a particular scene and direction vector,
- * and returns the color of the closest object intersected.
+ * and returns the color of the closest object intersected. Reflection
+ * and refraction rays are only cast when their share of the final pixel
+ * is at least options->minWeight. The ray tree is walked depth first on
+ * an explicit stack and each color is combined once its children return.
  * 
  * @param  origin      point at which the ray is being sent from
  * @param  direction   vector describing currently cast ray
- * @param  scene       array of objects describing the world
- * @param  numObjects  number of objects in the world
- * @param  lights      array of light objects in the world
- * @param  numLights   number of lights in the world
- * @param  level       current recursion level of the raycast
- * @param  extIor      index of refraction of the external medium
- * @param  inObject    pointer to the object currently insidde of
+ * @param  scene       objects and lights describing the world
+ * @param  options     depth and weight limits of the ray tree
+ * @param  stack       room for options->maxDepth frames
  * @return             color vector of closest object intersected
  */
-vector3_t raycast(vector3_t origin, vector3_t direction,
-          object_t **scene, int numObjects,
-          light_t **lights, int numLights,
-          int level, double extIor, object_t *inObject);
+vec3_t raycast(vec3_t origin, vec3_t direction, scene_t *scene,
+               render_options_t *options, ray_frame_t *stack);
+
+/**
+ * Casts a packet of camera rays from one origin, producing the same colors
+ * as calling raycast on each lane. The camera rays and then their shadow
+ * rays to each light are traced as packets; the reflection and refraction
+ * rays below them head off in different directions, so each lane's tree
+ * is finished on its own.
+ * 
+ * @param  colors      output color of each lane, black for empty lanes
+ * @param  hitObjects  object each lane's camera ray hit, or NULL
+ * @param  origin      point at which every ray is being sent from
+ * @param  packet      camera rays to cast
+ * @param  scene       objects and lights describing the world
+ * @param  options     depth and weight limits of the ray trees
+ * @param  stack       room for options->maxDepth frames
+ * @param  occluded    room for PACKET_WIDTH flags per light
+ */
+void raycastPacket(vec3_t *colors, object_t **hitObjects, vec3_t origin,
+                   const ray_packet_t *packet, scene_t *scene,
+                   render_options_t *options, ray_frame_t *stack,
+                   int *occluded);
+
+/**
+ * Casts a batch of rays from one origin breadth first, producing the same
+ * colors as calling raycast on each. Every bounce is traced as a wave:
+ * closest hits for the whole wave, then its shadow rays, then the direct
+ * light, then the queue of secondary rays for the next wave. Colors are
+ * combined back up the ray trees once the last wave is done.
+ * 
+ * @param  queue       queues to trace in, grown as needed
+ * @param  colors      output color of each ray
+ * @param  hitObjects  object each ray hit first, or NULL
+ * @param  origin      point at which every ray is being sent from
+ * @param  directions  direction of each ray
+ * @param  count       number of rays
+ * @param  scene       objects and lights describing the world
+ * @param  options     depth and weight limits of the ray trees
+ * @return             0 on success, ARENA_ALLOC_ERROR when a queue could
+ *                     not grow, which leaves the colors unset
+ */
+int wavefrontTrace(wave_queue_t *queue, vec3_t *colors,
+                   object_t **hitObjects, vec3_t origin,
+                   const vec3_t *directions, int count, scene_t *scene,
+                   render_options_t *options);
 
 /**
  * Renders a PPM image given a particular scene and camera position.
+ * With more than one thread the image is split in to tiles that are
+ * shared out through a work stealing scheduler; every pixel is traced
+ * exactly as it is on the serial path. With anti-aliasing on, pixels on
+ * an edge are traced again in a second pass once the whole image is done.
+ * When stats has pixel costs, pixels are traced one ray at a time and the
+ * cost of each pixel's rays is added to its entry.
  * 
  * @param  ppmImage    pointer to final output PPM image
  * @param  camera      the camera through which the scene is viewed
- * @param  scene       array of objects describing the world
- * @param  numObjects  number of objects in the world
- * @param  lights      array of light objects in the world
- * @param  numLights   number of lights in the world
- * @return             error status of image rendering
+ * @param  scene       objects and lights describing the world
+ * @param  options     render settings chosen on the command line
+ * @param  stats       counters to add the work done to
+ * @param  arena       arena for buffers that last the whole render
+ * @param  scratch     one arena per thread for data that only lives
+ *                     while a tile is traced
+ * @return             error status of image rendering, ARENA_ALLOC_ERROR
+ *                     when an arena ran out
+ */
+int renderImage(ppm_t *ppmImage, camera_t *camera, scene_t *scene,
+                render_options_t *options, render_stats_t *stats,
+                arena_t *arena, arena_t *scratch);
+
+/**
+ * Renders an image progressively, rewriting the whole output file as it
+ * improves. The first pass traces one pixel in every 4x4 block, the next
+ * fifteen fill in the rest of each block in an interleaved order, and
+ * every pass after that adds one more sample to each pixel until there
+ * are options->numSamples. Colors are summed per pixel and averaged when
+ * the image is written, pixels not traced yet borrow the color of the
+ * first pixel of their 2x2 block, or failing that their 4x4 block. The
+ * first and last passes are always written, others only once
+ * options->progressInterval seconds have passed since the last write.
+ * With one sample the final image is the same as the one renderImage
+ * makes.
+ *
+ * Given a deadline, tiles stop tracing once it passes and the time the
+ * coarse pass took is used to plan the rest. The depth is lowered until
+ * the interleaved passes are expected to fit, extra samples are only
+ * started while a whole pass is expected to fit, and whatever was reached
+ * is written before the deadline. The quality reached is left in stats,
+ * along with the cost of each pixel's rays when it has pixel costs.
+ * 
+ * @param  file        output file, rewritten from the start each time
+ * @param  format      the PPM format to write the file
+ * @param  ppmImage    image to resolve the samples in to
+ * @param  camera      the camera through which the scene is viewed
+ * @param  scene       objects and lights describing the world
+ * @param  options     render settings chosen on the command line
+ * @param  deadline    CLOCK_MONOTONIC seconds to be done by, 0 for none
+ * @param  stats       counters to add the work done to
+ * @param  arena       arena for the sums that last the whole render
+ * @param  scratch     one arena per thread for data that only lives
+ *                     while a tile is traced
+ * @return             error status of image rendering, ARENA_ALLOC_ERROR
+ *                     when an arena ran out
+ */
+int renderProgressive(FILE *file, int format, ppm_t *ppmImage,
+                      camera_t *camera, scene_t *scene,
+                      render_options_t *options, double deadline,
+                      render_stats_t *stats, arena_t *arena,
+                      arena_t *scratch);
+
+/**
+ * Renders a scene in horizontal bands and writes each band to the file
+ * as soon as it and every band above it are finished. Only a few bands
+ * are held in memory at once. With more than one thread the bands are
+ * rendered in parallel and put back in order before writing. Edges for
+ * anti-aliasing are only looked for between pixels of the same band.
+ * 
+ * @param  file        output file, the PPM header is written first
+ * @param  format      the PPM format to write the file
+ * @param  width       pixel width of the image
+ * @param  height      pixel height of the image
+ * @param  camera      the camera through which the scene is viewed
+ * @param  scene       objects and lights describing the world
+ * @param  options     render settings chosen on the command line
+ * @param  stats       counters to add the work done to
+ * @param  arena       arena for the band buffers
+ * @param  scratch     one arena per thread for data that only lives
+ *                     while a band is traced
+ * @return             error status of image rendering, 1 if a band could
+ *                     not be written, ARENA_ALLOC_ERROR when an arena ran
+ *                     out
+ */
+int renderStream(FILE *file, int format, int width, int height,
+                 camera_t *camera, scene_t *scene,
+                 render_options_t *options, render_stats_t *stats,
+                 arena_t *arena, arena_t *scratch);
+
+/**
+ * Parse the command line in to options and positional arguments.
+ * 
+ * @param  options      output render options
+ * @param  positional   output array of positional arguments
+ * @param  argc         number of command line arguments
+ * @param  argv         command line arguments
+ * @return              number of positional arguments, INVALID_OPTION on error
  */
-int renderImage(ppm_t *ppmImage, camera_t *camera,
-                object_t **scene, int numObjects,
-                light_t **lights, int numLights);
+int parseOptions(render_options_t *options, char **positional,
+                 int argc, char *argv[]);
 
 #endif  // RAYCAST_H
@@ -0,0 +1,414 @@
+// Include header file
+#include "scene_file.h"
+
+
+// Round an offset up to the next section boundary
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + SCENE_FILE_ALIGNMENT - 1) / SCENE_FILE_ALIGNMENT *
+         SCENE_FILE_ALIGNMENT;
+}
+
+
+// Write a section at the next boundary, returning where it starts
+static uint64_t writeSection(FILE *file, uint64_t *offset,
+                             const void *data, size_t bytes) {
+  static const char zeros[SCENE_FILE_ALIGNMENT] = {0};
+
+  uint64_t start = alignOffset(*offset);
+  fwrite(zeros, 1, start - *offset, file);
+  fwrite(data, 1, bytes, file);
+  *offset = start + bytes;
+
+  return start;
+}
+
+
+int writeSceneFile(const char *path, camera_t *camera,
+                   scene_storage_t *storage, bvh_t *bvh) {
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    return INVALID_SCENE_FILE;
+  }
+
+  scene_file_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SCENE_FILE_MAGIC, sizeof(header.magic));
+  header.version = SCENE_FILE_VERSION;
+  header.byteOrder = SCENE_FILE_BYTE_ORDER;
+  header.sphereSize = sizeof(sphere_t);
+  header.planeSize = sizeof(plane_t);
+  header.lightSize = sizeof(light_t);
+  header.cameraSize = sizeof(camera_t);
+  header.nodeSize = sizeof(bvh_node_t);
+  header.realSize = sizeof(real_t);
+  header.numObjects = storage->numObjects;
+  header.numSpheres = storage->numSpheres;
+  header.numPlanes = storage->numPlanes;
+  header.numLights = storage->numLights;
+
+  // Filled in again once every offset is known
+  uint64_t offset = 0;
+  writeSection(file, &offset, &header, sizeof(header));
+
+  // The packed arrays are already in their final form
+  header.cameraOffset = writeSection(file, &offset, camera, sizeof(camera_t));
+  header.sphereOffset = writeSection(file, &offset, storage->spheres,
+                                     sizeof(sphere_t) * storage->numSpheres);
+  header.planeOffset = writeSection(file, &offset, storage->planes,
+                                    sizeof(plane_t) * storage->numPlanes);
+  header.lightOffset = writeSection(file, &offset, storage->lights,
+                                    sizeof(light_t) * storage->numLights);
+
+  object_ref_record_t *refs = malloc(sizeof(object_ref_record_t) *
+                                     (storage->numObjects + 1));
+  for (int i = 0; i < storage->numObjects; i++) {
+    object_t *object = storage->objects[i];
+    refs[i].kind = object->kind;
+    if (object->kind == OBJECT_KIND_SPHERE) {
+      refs[i].index = (sphere_t *) object - storage->spheres;
+    }
+    else {
+      refs[i].index = (plane_t *) object - storage->planes;
+    }
+  }
+  header.objectRefOffset = writeSection(file, &offset, refs,
+                                        sizeof(object_ref_record_t) *
+                                        storage->numObjects);
+  free(refs);
+
+  // The hierarchy and its intersection arrays are stored exactly as built
+  if (bvh != NULL) {
+    primitive_list_t *primitives = &bvh->primitives;
+    size_t sphereBytes = sizeof(real_t) * paddedLength(header.numSpheres);
+    size_t planeBytes = sizeof(real_t) * paddedLength(header.numPlanes);
+    real_t *sphereArrays[5] = {
+      primitives->spheres.x, primitives->spheres.y, primitives->spheres.z,
+      primitives->spheres.length2, primitives->spheres.radius2
+    };
+    real_t *planeArrays[6] = {
+      primitives->planes.x, primitives->planes.y, primitives->planes.z,
+      primitives->planes.nx, primitives->planes.ny, primitives->planes.nz
+    };
+
+    header.flags |= SCENE_FILE_HAS_BVH;
+    header.numNodes = bvh->numNodes;
+    header.nodeOffset = writeSection(file, &offset, bvh->nodes,
+                                     sizeof(bvh_node_t) * bvh->numNodes);
+
+    for (int k = 0; k < 5; k++) {
+      header.sphereOffsets[k] = writeSection(file, &offset, sphereArrays[k],
+                                             sphereBytes);
+    }
+    header.sphereIdOffset = writeSection(file, &offset, primitives->sphereIds,
+                                         sizeof(int) * header.numSpheres);
+
+    for (int k = 0; k < 6; k++) {
+      header.planeOffsets[k] = writeSection(file, &offset, planeArrays[k],
+                                            planeBytes);
+    }
+    header.planeIdOffset = writeSection(file, &offset, primitives->planeIds,
+                                        sizeof(int) * header.numPlanes);
+  }
+
+  header.fileSize = offset;
+  fseek(file, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, file);
+
+  int errorStatus = ferror(file) ? INVALID_SCENE_FILE : 0;
+  if (fclose(file) != 0) {
+    errorStatus = INVALID_SCENE_FILE;
+  }
+
+  return errorStatus;
+}
+
+
+int isSceneFile(const char *path) {
+
+  char magic[8];
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return 0;
+  }
+
+  int isScene = (fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                 memcmp(magic, SCENE_FILE_MAGIC, sizeof(magic)) == 0);
+  fclose(file);
+
+  return isScene;
+}
+
+
+// Check that a section of count elements lies inside the mapping
+static int sectionFits(uint64_t offset, int64_t count, size_t elementSize,
+                       size_t mappingSize) {
+  return count >= 0 &&
+         offset % SCENE_FILE_ALIGNMENT == 0 &&
+         offset <= mappingSize &&
+         (uint64_t) count <= (mappingSize - offset) / elementSize;
+}
+
+
+// Point the hierarchy at the arrays in the mapping and rebuild its object
+// tables, returning NULL if the file is inconsistent
+// Walk the tree once, returns 1 if every node is reached exactly once and
+// none is as deep as BVH_STACK_SIZE, which a closest hit traversal could
+// need a stack entry per level for. Reached holds a byte per node
+static int bvhTreeValid(const bvh_t *bvh, unsigned char *reached) {
+
+  memset(reached, 0, bvh->numNodes);
+
+  // Only one sibling per level waits, so the walk fits in the same depth
+  int stack[BVH_STACK_SIZE + 1];
+  int depths[BVH_STACK_SIZE + 1];
+  int stackSize = 0;
+  int numReached = 0;
+  stack[stackSize] = 0;
+  depths[stackSize++] = 0;
+
+  while (stackSize > 0) {
+    stackSize--;
+    int nodeIndex = stack[stackSize];
+    int depth = depths[stackSize];
+    if (reached[nodeIndex] || depth >= BVH_STACK_SIZE) {
+      return 0;
+    }
+    reached[nodeIndex] = 1;
+    numReached++;
+
+    const bvh_node_t *node = &bvh->nodes[nodeIndex];
+    if (node->count > 0) {
+      continue;
+    }
+    stack[stackSize] = node->first;
+    depths[stackSize++] = depth + 1;
+    stack[stackSize] = nodeIndex + 1;
+    depths[stackSize++] = depth + 1;
+  }
+
+  return numReached == bvh->numNodes;
+}
+
+
+// Fills in scene->bvh, returns INVALID_SCENE_FILE or ARENA_ALLOC_ERROR on
+// failure
+static int mapBvh(mapped_scene_t *scene, scene_file_header_t *header,
+                  arena_t *arena) {
+
+  scene_storage_t *storage = &scene->storage;
+  char *base = scene->mapping;
+  size_t size = scene->mappingSize;
+  int paddedSpheres = paddedLength(header->numSpheres);
+  int paddedPlanes = paddedLength(header->numPlanes);
+
+  int fits = header->numNodes > 0 &&
+             sectionFits(header->nodeOffset, header->numNodes,
+                         sizeof(bvh_node_t), size) &&
+             sectionFits(header->sphereIdOffset, header->numSpheres,
+                         sizeof(int), size) &&
+             sectionFits(header->planeIdOffset, header->numPlanes,
+                         sizeof(int), size);
+  for (int k = 0; k < 5; k++) {
+    fits = fits && sectionFits(header->sphereOffsets[k], paddedSpheres,
+                               sizeof(real_t), size);
+  }
+  for (int k = 0; k < 6; k++) {
+    fits = fits && sectionFits(header->planeOffsets[k], paddedPlanes,
+                               sizeof(real_t), size);
+  }
+  if (!fits) {
+    return INVALID_SCENE_FILE;
+  }
+
+  bvh_t *bvh = arenaAlloc(arena, sizeof(bvh_t));
+  if (bvh == NULL) return ARENA_ALLOC_ERROR;
+  primitive_list_t *primitives = &bvh->primitives;
+  bvh->nodes = (bvh_node_t *) (base + header->nodeOffset);
+  bvh->numNodes = header->numNodes;
+
+  sphere_soa_t *spheres = &primitives->spheres;
+  spheres->count = header->numSpheres;
+  spheres->x = (real_t *) (base + header->sphereOffsets[0]);
+  spheres->y = (real_t *) (base + header->sphereOffsets[1]);
+  spheres->z = (real_t *) (base + header->sphereOffsets[2]);
+  spheres->length2 = (real_t *) (base + header->sphereOffsets[3]);
+  spheres->radius2 = (real_t *) (base + header->sphereOffsets[4]);
+  primitives->sphereIds = (int *) (base + header->sphereIdOffset);
+
+  plane_soa_t *planes = &primitives->planes;
+  planes->count = header->numPlanes;
+  planes->x = (real_t *) (base + header->planeOffsets[0]);
+  planes->y = (real_t *) (base + header->planeOffsets[1]);
+  planes->z = (real_t *) (base + header->planeOffsets[2]);
+  planes->nx = (real_t *) (base + header->planeOffsets[3]);
+  planes->ny = (real_t *) (base + header->planeOffsets[4]);
+  planes->nz = (real_t *) (base + header->planeOffsets[5]);
+  primitives->planeIds = (int *) (base + header->planeIdOffset);
+
+  // Ids must name an object of the right kind, and leaves must stay in range
+  primitives->sphereObjects = arenaAlloc(arena, sizeof(object_t *) *
+                                                (header->numSpheres + 1));
+  primitives->planeObjects = arenaAlloc(arena, sizeof(object_t *) *
+                                               (header->numPlanes + 1));
+  unsigned char *reached = arenaAlloc(arena, header->numNodes);
+  if (primitives->sphereObjects == NULL || primitives->planeObjects == NULL ||
+      reached == NULL) {
+    return ARENA_ALLOC_ERROR;
+  }
+  int valid = 1;
+
+  for (int i = 0; i < header->numSpheres && valid; i++) {
+    int id = primitives->sphereIds[i];
+    valid = id >= 0 && id < storage->numObjects &&
+            storage->objects[id]->kind == OBJECT_KIND_SPHERE;
+    if (valid) primitives->sphereObjects[i] = storage->objects[id];
+  }
+  for (int i = 0; i < header->numPlanes && valid; i++) {
+    int id = primitives->planeIds[i];
+    valid = id >= 0 && id < storage->numObjects &&
+            storage->objects[id]->kind == OBJECT_KIND_PLANE;
+    if (valid) primitives->planeObjects[i] = storage->objects[id];
+  }
+
+  // An empty tree is a single leaf that no ray can enter
+  if (header->numSpheres == 0) {
+    valid = valid && bvh->numNodes == 1 &&
+            bvh->nodes[0].min[0] > bvh->nodes[0].max[0];
+  }
+  for (int i = 0; i < bvh->numNodes && valid && header->numSpheres > 0; i++) {
+    bvh_node_t *node = &bvh->nodes[i];
+    if (node->count == 0) {
+      valid = node->first > i + 1 && node->first < bvh->numNodes;
+    }
+    else {
+      valid = node->count > 0 && node->first >= 0 &&
+              node->first <= header->numSpheres - node->count;
+    }
+  }
+
+  // Children that point back up or share a node would loop or repeat work,
+  // and a chain deeper than the traversal stack would overflow it
+  if (!valid || (header->numSpheres > 0 && !bvhTreeValid(bvh, reached))) {
+    return INVALID_SCENE_FILE;
+  }
+
+  scene->bvh = bvh;
+  return 0;
+}
+
+
+int mapSceneFile(mapped_scene_t *output, const char *path, arena_t *arena) {
+
+  memset(output, 0, sizeof(mapped_scene_t));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return INVALID_SCENE_FILE;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      (size_t) info.st_size < sizeof(scene_file_header_t)) {
+    close(fd);
+    return INVALID_SCENE_FILE;
+  }
+
+  // Read only, everything in the file is used as it is
+  size_t size = info.st_size;
+  void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return INVALID_SCENE_FILE;
+  }
+
+  output->mapping = mapping;
+  output->mappingSize = size;
+
+  char *base = mapping;
+  scene_file_header_t *header = mapping;
+
+  if (memcmp(header->magic, SCENE_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != SCENE_FILE_VERSION ||
+      header->byteOrder != SCENE_FILE_BYTE_ORDER ||
+      header->fileSize != size ||
+      header->sphereSize != sizeof(sphere_t) ||
+      header->planeSize != sizeof(plane_t) ||
+      header->lightSize != sizeof(light_t) ||
+      header->cameraSize != sizeof(camera_t) ||
+      header->nodeSize != sizeof(bvh_node_t) ||
+      header->realSize != sizeof(real_t) ||
+      !sectionFits(header->cameraOffset, 1, sizeof(camera_t), size) ||
+      !sectionFits(header->sphereOffset, header->numSpheres,
+                   sizeof(sphere_t), size) ||
+      !sectionFits(header->planeOffset, header->numPlanes,
+                   sizeof(plane_t), size) ||
+      !sectionFits(header->lightOffset, header->numLights,
+                   sizeof(light_t), size) ||
+      !sectionFits(header->objectRefOffset, header->numObjects,
+                   sizeof(object_ref_record_t), size)) {
+    unmapSceneFile(output);
+    return INVALID_SCENE_FILE;
+  }
+
+  scene_storage_t *storage = &output->storage;
+  output->camera = (camera_t *) (base + header->cameraOffset);
+  storage->spheres = (sphere_t *) (base + header->sphereOffset);
+  storage->numSpheres = header->numSpheres;
+  storage->planes = (plane_t *) (base + header->planeOffset);
+  storage->numPlanes = header->numPlanes;
+  storage->lights = (light_t *) (base + header->lightOffset);
+  storage->numLights = header->numLights;
+
+  // Only the table of object pointers needs building
+  object_ref_record_t *refs = (object_ref_record_t *)
+                              (base + header->objectRefOffset);
+  storage->numObjects = header->numObjects;
+  storage->objects = arenaAlloc(arena, sizeof(object_t *) *
+                                       (header->numObjects + 1));
+  if (storage->objects == NULL) {
+    unmapSceneFile(output);
+    return ARENA_ALLOC_ERROR;
+  }
+
+  for (int i = 0; i < header->numObjects; i++) {
+    int index = refs[i].index;
+    object_t *object = NULL;
+
+    if (refs[i].kind == OBJECT_KIND_SPHERE &&
+        index >= 0 && index < storage->numSpheres) {
+      object = (object_t *) &storage->spheres[index];
+    }
+    else if (refs[i].kind == OBJECT_KIND_PLANE &&
+             index >= 0 && index < storage->numPlanes) {
+      object = (object_t *) &storage->planes[index];
+    }
+
+    if (object == NULL || object->kind != refs[i].kind) {
+      unmapSceneFile(output);
+      return INVALID_SCENE_FILE;
+    }
+    storage->objects[i] = object;
+  }
+
+  if (header->flags & SCENE_FILE_HAS_BVH) {
+    int errorStatus = mapBvh(output, header, arena);
+    if (errorStatus != 0) {
+      unmapSceneFile(output);
+      return errorStatus;
+    }
+  }
+
+  return 0;
+}
+
+
+void unmapSceneFile(mapped_scene_t *scene) {
+
+  // Tables built at load time belong to the arena, the rest is the mapping
+  if (scene->mapping != NULL) {
+    munmap(scene->mapping, scene->mappingSize);
+  }
+
+  memset(scene, 0, sizeof(mapped_scene_t));
+}
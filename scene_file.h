@@ -0,0 +1,124 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+// Include standard libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include "vector.h"
+#include "parsing.h"
+#include "bvh.h"
+#include "kernels.h"
+#include "arena.h"
+
+// Numeric constants
+#define SCENE_FILE_VERSION 3 // Bump whenever a record layout changes
+#define SCENE_FILE_BYTE_ORDER 0x01020304 // Read back swapped on a foreign CPU
+#define SCENE_FILE_ALIGNMENT 32 // Every section can be loaded as a vector
+
+#define SCENE_FILE_HAS_BVH 1
+
+// Error code constants
+#define INVALID_SCENE_FILE -7
+
+// String constants
+#define SCENE_FILE_MAGIC "RCSCENE" // Includes the terminator, 8 bytes
+
+// Define types to be used in c file
+typedef struct scene_file_header_t scene_file_header_t;
+typedef struct object_ref_record_t object_ref_record_t;
+typedef struct mapped_scene_t mapped_scene_t;
+
+// Objects, lights and the camera are stored as the packed structs from
+// parsing.h, so the record sizes are checked along with the version
+struct scene_file_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint64_t fileSize;
+  uint32_t flags;
+  uint32_t sphereSize;
+  uint32_t planeSize;
+  uint32_t lightSize;
+  uint32_t cameraSize;
+  uint32_t nodeSize;
+  int32_t numObjects;
+  int32_t numSpheres;
+  int32_t numPlanes;
+  int32_t numLights;
+  int32_t numNodes;
+  uint32_t realSize; // Bytes in real_t, float and double builds differ
+  uint64_t cameraOffset; // Every offset is from the start of the file
+  uint64_t sphereOffset;
+  uint64_t planeOffset;
+  uint64_t lightOffset;
+  uint64_t objectRefOffset;
+  uint64_t nodeOffset; // Sections below are only written with a bvh
+  uint64_t sphereOffsets[5]; // x, y, z, length2, radius2
+  uint64_t sphereIdOffset;
+  uint64_t planeOffsets[6]; // x, y, z, nx, ny, nz
+  uint64_t planeIdOffset;
+};
+
+struct object_ref_record_t { // Scene order of the visible objects
+  int32_t kind;
+  int32_t index; // In to the array of its kind
+};
+
+struct mapped_scene_t {
+  camera_t *camera;
+  scene_storage_t storage; // Arrays in the mapping, objects in the arena
+  bvh_t *bvh; // NULL when the file has no prebuilt hierarchy
+  void *mapping;
+  size_t mappingSize;
+};
+
+
+/**
+ * Writes a parsed scene to a flat binary file that mapSceneFile can use
+ * without parsing, optionally including a prebuilt bounding volume hierarchy
+ *
+ * @param  path     path of the file to write
+ * @param  camera   camera of the scene
+ * @param  storage  objects and lights of the scene
+ * @param  bvh      hierarchy built over the objects, or NULL for none
+ * @return          success status of function, INVALID_SCENE_FILE on error
+ */
+int writeSceneFile(const char *path, camera_t *camera,
+                   scene_storage_t *storage, bvh_t *bvh);
+
+/**
+ * Checks whether the file at the given path starts like a compiled scene
+ *
+ * @param  path  path of the file to check
+ * @return       1 if the file is a compiled scene, 0 otherwise
+ */
+int isSceneFile(const char *path);
+
+/**
+ * Maps a compiled scene in to memory. Objects, lights, hierarchy nodes
+ * and intersection arrays are used straight from the read only mapping,
+ * so only the tables of object pointers are built at load time
+ *
+ * @param  output  pointer to a mapped_scene_t to fill
+ * @param  path    path of the file to map
+ * @param  arena   arena that owns the tables built at load time
+ * @return         success status of function, INVALID_SCENE_FILE on error,
+ *                 ARENA_ALLOC_ERROR when the arena ran out
+ */
+int mapSceneFile(mapped_scene_t *output, const char *path, arena_t *arena);
+
+/**
+ * Unmaps a scene from mapSceneFile. Its tables are released along with
+ * the arena they came from
+ *
+ * @param  scene  pointer to the mapped_scene_t to release
+ */
+void unmapSceneFile(mapped_scene_t *scene);
+
+#endif  // SCENE_FILE_H
@@ -0,0 +1,176 @@
+// Include header file
+#include "scheduler.h"
+#include <unistd.h> // sysconf
+
+
+// State shared between all of the workers of one scheduleTiles call
+typedef struct {
+  tile_t *tiles;
+  tile_deque_t *deques;
+  int numThreads;
+  tile_func_t func;
+  void *userData;
+} pool_t;
+
+typedef struct {
+  pool_t *pool;
+  int index;
+} worker_t;
+
+
+int availableThreads(void) {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int) count : 1;
+}
+
+
+// Take a tile from the bottom of our own deque, -1 when empty
+static int popTile(tile_deque_t *deque) {
+  int tile = -1;
+
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom > deque->top) {
+    tile = deque->tiles[--deque->bottom];
+  }
+  pthread_mutex_unlock(&deque->lock);
+
+  return tile;
+}
+
+
+// Take a tile from the top of another worker's deque, -1 when empty
+static int stealTile(tile_deque_t *deque) {
+  int tile = -1;
+
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom > deque->top) {
+    tile = deque->tiles[deque->top++];
+  }
+  pthread_mutex_unlock(&deque->lock);
+
+  return tile;
+}
+
+
+static void *workerMain(void *data) {
+
+  worker_t *worker = data;
+  pool_t *pool = worker->pool;
+  int tile;
+
+  while (1) {
+
+    // Prefer our own work, it is adjacent to what we just rendered
+    tile = popTile(&pool->deques[worker->index]);
+
+    // Otherwise try every other worker once, starting with our neighbour
+    for (int i = 1; tile < 0 && i < pool->numThreads; i++) {
+      tile = stealTile(&pool->deques[(worker->index + i) % pool->numThreads]);
+    }
+
+    // No tiles are ever added after startup, so empty everywhere means done
+    if (tile < 0) {
+      break;
+    }
+
+    pool->func(&pool->tiles[tile], worker->index, pool->userData);
+  }
+
+  return NULL;
+}
+
+
+int scheduleTiles(int width, int height, int tileSize, int numThreads,
+                  tile_func_t func, void *userData) {
+
+  int tilesX = (width + tileSize - 1) / tileSize;
+  int tilesY = (height + tileSize - 1) / tileSize;
+  int numTiles = tilesX * tilesY;
+
+  if (numThreads > numTiles) {
+    numThreads = numTiles;
+  }
+  if (numThreads < 1) {
+    numThreads = 1;
+  }
+
+  pool_t pool;
+  pool.tiles = malloc(sizeof(tile_t) * numTiles);
+  pool.deques = malloc(sizeof(tile_deque_t) * numThreads);
+  pool.numThreads = numThreads;
+  pool.func = func;
+  pool.userData = userData;
+
+  int *tileIndices = malloc(sizeof(int) * numTiles);
+  worker_t *workers = malloc(sizeof(worker_t) * numThreads);
+  pthread_t *threads = malloc(sizeof(pthread_t) * numThreads);
+
+  if (pool.tiles == NULL || pool.deques == NULL || tileIndices == NULL ||
+      workers == NULL || threads == NULL) {
+    free(threads);
+    free(workers);
+    free(tileIndices);
+    free(pool.deques);
+    free(pool.tiles);
+    return SCHEDULER_ALLOC_ERROR;
+  }
+
+  // Lay the tiles out in row-major order
+  for (int i = 0; i < numTiles; i++) {
+    pool.tiles[i].x0 = (i % tilesX) * tileSize;
+    pool.tiles[i].y0 = (i / tilesX) * tileSize;
+    pool.tiles[i].x1 = pool.tiles[i].x0 + tileSize;
+    pool.tiles[i].y1 = pool.tiles[i].y0 + tileSize;
+    if (pool.tiles[i].x1 > width) pool.tiles[i].x1 = width;
+    if (pool.tiles[i].y1 > height) pool.tiles[i].y1 = height;
+  }
+
+  // Seed each deque with a contiguous run of tiles, stored in reverse so
+  // the owner pops them top to bottom and thieves take from the far end
+  for (int i = 0; i < numThreads; i++) {
+    int first = (int) ((long) numTiles * i / numThreads);
+    int last = (int) ((long) numTiles * (i + 1) / numThreads);
+
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+    pool.deques[i].tiles = tileIndices + first;
+    pool.deques[i].top = 0;
+    pool.deques[i].bottom = last - first;
+
+    for (int j = 0; j < last - first; j++) {
+      pool.deques[i].tiles[j] = last - 1 - j;
+    }
+  }
+
+  // The calling thread acts as worker 0
+  int started = 1;
+  for (int i = 0; i < numThreads; i++) {
+    workers[i].pool = &pool;
+    workers[i].index = i;
+  }
+  for (int i = 1; i < numThreads; i++, started++) {
+    if (pthread_create(&threads[i], NULL, workerMain, &workers[i]) != 0) {
+      fprintf(stderr, "Warning: Only %d of %d render threads started\n",
+              started, numThreads);
+      break;
+    }
+  }
+
+  // Any tiles left behind by a failed thread start are stolen by the rest
+  workerMain(&workers[0]);
+
+  for (int i = 1; i < started; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // Clean up allocated memory
+  for (int i = 0; i < numThreads; i++) {
+    pthread_mutex_destroy(&pool.deques[i].lock);
+  }
+  free(threads);
+  free(workers);
+  free(tileIndices);
+  free(pool.deques);
+  free(pool.tiles);
+
+  return 0;
+}
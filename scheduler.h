@@ -0,0 +1,60 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// Include standard libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <pthread.h>
+
+// Error code constants
+#define SCHEDULER_ALLOC_ERROR -5
+
+// Define types to be used in c file
+typedef struct tile_t tile_t;
+typedef struct tile_deque_t tile_deque_t;
+typedef void (*tile_func_t)(const tile_t *tile, int threadIndex,
+                            void *userData);
+
+struct tile_t { // Half open pixel rectangle [x0, x1) x [y0, y1)
+  int x0;
+  int y0;
+  int x1;
+  int y1;
+};
+
+struct tile_deque_t { // Owner pops from the bottom, thieves steal the top
+  pthread_mutex_t lock;
+  int *tiles;
+  int top;
+  int bottom;
+};
+
+
+/**
+ * Get the number of processors available to the program.
+ * 
+ * @return  number of online processors, at least 1
+ */
+int availableThreads(void);
+
+/**
+ * Split an image in to tiles and run a function over every tile using a
+ * pool of worker threads. Each worker owns a deque seeded with a
+ * contiguous run of tiles, and steals from the other workers once its
+ * own deque runs dry. If a thread fails to start, the threads that did
+ * start render its tiles and a warning is printed.
+ * 
+ * @param  width       pixel width of the image
+ * @param  height      pixel height of the image
+ * @param  tileSize    edge length of a square tile in pixels
+ * @param  numThreads  number of worker threads to use
+ * @param  func        function to call for each tile
+ * @param  userData    pointer passed through to func
+ * @return             error status of the scheduling, SCHEDULER_ALLOC_ERROR
+ *                     if the pool could not be allocated, in which case no
+ *                     tile is rendered
+ */
+int scheduleTiles(int width, int height, int tileSize, int numThreads,
+                  tile_func_t func, void *userData);
+
+#endif  // SCHEDULER_H
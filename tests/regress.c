@@ -0,0 +1,436 @@
+// Renders the reference scenes and checks them against golden images and
+// the recorded render times
+#include <math.h> // INFINITY
+#include "../ppmrw.h"
+
+// Numeric constants
+#define TEST_WIDTH 200
+#define TEST_HEIGHT 150
+#define NUM_RUNS 5
+#define MAX_CHANNEL_ERROR 8 // Largest difference allowed in any channel
+#define MEAN_CHANNEL_ERROR 0.5 // Largest average difference of a channel
+#define MAX_SLOWDOWN 25.0 // Percent the total render time may grow by
+#define MAX_LINE 256
+#define MAX_COMMAND 1024
+#define MAX_BASELINE 64
+
+// String constants
+#define RAYCAST_PATH "./raycast"
+#define GOLDEN_DIR "tests/golden"
+#define OUTPUT_DIR "tests/output"
+#define BASELINE_PATH "tests/baseline.csv"
+#define RANGE_PATH OUTPUT_DIR "/range.ppm"
+#define RANGE_IMAGE "P3\n1 1\n100\n200 0 0\n" // A channel over the maximum
+#define USAGE_MESSAGE "\
+Usage: regress [options]\n\
+Options:\n\
+  --golden: write the golden images from this build instead of checking\n\
+  --baseline: record the render times later runs are checked against\n\
+  --max-error N: largest difference allowed in any channel of any pixel\n\
+    (default 8)\n\
+  --mean-error E: largest average difference of each channel (default 0.5)\n\
+  --slowdown PERCENT: percent the total render time may grow by over the\n\
+    baseline (default 25)\n\
+Run from the repository root after make and make regress.\n"
+
+// Define types to be used in c file
+typedef struct {
+  const char *name;
+  const char *scene;
+  const char *options;
+  const char *golden; // Cases rendering the same image share a golden
+} test_case_t;
+
+typedef struct {
+  int maxError[3]; // Per channel, red, green then blue
+  double meanError[3];
+} image_diff_t;
+
+typedef struct {
+  char name[MAX_LINE];
+  double renderSeconds;
+} test_time_t;
+
+// Every engine and option that should not change the image is checked
+// against the same golden as the plain render
+static const test_case_t cases[] = {
+  { "ball_plane", "examples/ball_plane.csv", "", "ball_plane" },
+  { "fringe", "examples/fringe.csv", "", "fringe" },
+  { "fringe_threads", "examples/fringe.csv", "--threads 4", "fringe" },
+  { "fringe_list", "examples/fringe.csv", "--accel list", "fringe" },
+  { "fringe_wavefront", "examples/fringe.csv", "--engine wavefront",
+    "fringe" },
+  { "fringe_packet", "examples/fringe.csv", "--packet 2", "fringe" },
+  { "fringe_scalar", "examples/fringe.csv", "--simd scalar", "fringe" },
+  { "fringe_stream", "examples/fringe.csv", "--stream 16", "fringe" },
+  { "fringe_p3", "examples/fringe.csv", "--format p3", "fringe" },
+  { "fringe_progressive", "examples/fringe.csv", "--progressive 10",
+    "fringe" },
+  { "fringe_aa", "examples/fringe.csv", "--aa 2", "fringe_aa" },
+  { "mixed", "tests/scenes/mixed.csv", "", "mixed" },
+  { "mixed_threads", "tests/scenes/mixed.csv", "--threads 4", "mixed" },
+  { "mixed_wavefront", "tests/scenes/mixed.csv", "--engine wavefront",
+    "mixed" },
+  { "glass", "tests/scenes/glass.csv", "", "glass" },
+  { "glass_deep", "tests/scenes/glass.csv", "--max-depth 6", "glass_deep" },
+};
+
+// Images read through mapPPM as well, each must match readPPM exactly
+static const char *mappedImages[][2] = {
+  { "map_p6", GOLDEN_DIR "/fringe.ppm" },
+  { "map_p3", OUTPUT_DIR "/fringe_p3.ppm" },
+};
+
+
+// Render a case once, returns the render time or a negative on failure
+static double renderCase(const test_case_t *test, const char *path) {
+
+  char command[MAX_COMMAND];
+  snprintf(command, sizeof(command), RAYCAST_PATH " --stats text %s %d %d "
+           "%s %s", test->options, TEST_WIDTH, TEST_HEIGHT, test->scene,
+           path);
+
+  FILE *pipe = popen(command, "r");
+  if (pipe == NULL) {
+    fprintf(stderr, "Error: Unable to run '%s'\n", command);
+    return -1;
+  }
+
+  char line[MAX_LINE];
+  char key[MAX_LINE];
+  double value;
+  double seconds = -1;
+  while (fgets(line, sizeof(line), pipe) != NULL) {
+    if (sscanf(line, "%255s %lf", key, &value) == 2 &&
+        strcmp(key, "render") == 0) {
+      seconds = value;
+    }
+  }
+
+  if (pclose(pipe) != 0 || seconds < 0) {
+    fprintf(stderr, "Error: '%s' failed\n", command);
+    return -1;
+  }
+
+  return seconds;
+}
+
+
+// Read a PPM with readPPM, returns 0 on success
+static int loadImage(const char *path, ppm_t *image) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    return 1;
+  }
+  int status = readPPM(image, file);
+  fclose(file);
+  return status;
+}
+
+
+// Read a PPM with both mapPPM and readPPM, returns 1 if they agree
+static int checkMapped(const char *path) {
+
+  ppm_t mapped;
+  ppm_t read;
+  if (mapPPM(&mapped, path) != 0) {
+    fprintf(stderr, "Error: Unable to map '%s'\n", path);
+    return 0;
+  }
+  if (loadImage(path, &read) != 0) {
+    fprintf(stderr, "Error: Unable to read '%s'\n", path);
+    freePPM(&mapped);
+    return 0;
+  }
+
+  int passed = mapped.width == read.width &&
+               mapped.height == read.height &&
+               mapped.maxColorValue == read.maxColorValue &&
+               memcmp(mapped.pixels, read.pixels, sizeof(pixel_t) *
+                      read.width * read.height) == 0;
+  freePPM(&mapped);
+  freePPM(&read);
+  return passed;
+}
+
+
+// Check that mapPPM rejects a channel over the maximum, returns 1 if it does
+static int checkMappedRange(void) {
+
+  FILE *file = fopen(RANGE_PATH, "w");
+  if (file == NULL || fputs(RANGE_IMAGE, file) == EOF || fclose(file) != 0) {
+    fprintf(stderr, "Error: Unable to write '" RANGE_PATH "'\n");
+    return 0;
+  }
+
+  ppm_t mapped;
+  int passed = mapPPM(&mapped, RANGE_PATH) == MALFORMED_HEADER;
+  if (!passed) {
+    freePPM(&mapped);
+  }
+  remove(RANGE_PATH);
+  return passed;
+}
+
+
+// Largest and average difference of each channel between two images of
+// the same size
+static void diffImages(const ppm_t *a, const ppm_t *b, image_diff_t *diff) {
+
+  long sums[3] = { 0, 0, 0 };
+  int numPixels = a->width * a->height;
+
+  memset(diff, 0, sizeof(image_diff_t));
+  for (int i = 0; i < numPixels; i++) {
+    int errors[3] = { abs(a->pixels[i].r - b->pixels[i].r),
+                      abs(a->pixels[i].g - b->pixels[i].g),
+                      abs(a->pixels[i].b - b->pixels[i].b) };
+    for (int c = 0; c < 3; c++) {
+      sums[c] += errors[c];
+      if (errors[c] > diff->maxError[c]) {
+        diff->maxError[c] = errors[c];
+      }
+    }
+  }
+
+  for (int c = 0; c < 3; c++) {
+    diff->meanError[c] = (double) sums[c] / numPixels;
+  }
+}
+
+
+// Recorded render time of a case, or a negative if it has none
+static double baselineTime(const test_time_t *baseline, int numBaseline,
+                           const char *name) {
+  for (int i = 0; i < numBaseline; i++) {
+    if (strcmp(baseline[i].name, name) == 0) {
+      return baseline[i].renderSeconds;
+    }
+  }
+  return -1;
+}
+
+
+// Read the recorded render times, returns the number read
+static int readBaseline(const char *path, test_time_t *baseline) {
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) return 0;
+
+  char line[MAX_LINE];
+  int count = 0;
+  while (count < MAX_BASELINE && fgets(line, sizeof(line), file) != NULL) {
+    if (sscanf(line, "%255[^,],%lf", baseline[count].name,
+               &baseline[count].renderSeconds) == 2) {
+      count++;
+    }
+  }
+
+  fclose(file);
+  return count;
+}
+
+
+int main(int argc, char *argv[]) {
+
+  int writeGolden = 0;
+  int writeBaseline = 0;
+  int maxError = MAX_CHANNEL_ERROR;
+  double meanError = MEAN_CHANNEL_ERROR;
+  double maxSlowdown = MAX_SLOWDOWN;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--golden") == 0) {
+      writeGolden = 1;
+    }
+    else if (strcmp(argv[i], "--baseline") == 0) {
+      writeBaseline = 1;
+    }
+    else if (i + 1 < argc && strcmp(argv[i], "--max-error") == 0) {
+      maxError = atoi(argv[++i]);
+    }
+    else if (i + 1 < argc && strcmp(argv[i], "--mean-error") == 0) {
+      meanError = atof(argv[++i]);
+    }
+    else if (i + 1 < argc && strcmp(argv[i], "--slowdown") == 0) {
+      maxSlowdown = atof(argv[++i]);
+    }
+    else {
+      fprintf(stderr, USAGE_MESSAGE);
+      return 1;
+    }
+  }
+
+  if (maxError < 0 || meanError < 0 || maxSlowdown < 0) {
+    fprintf(stderr, "Error: Invalid threshold, must be >= 0\n");
+    return 1;
+  }
+
+  int numCases = sizeof(cases) / sizeof(cases[0]);
+  int numRuns = writeGolden ? 1 : NUM_RUNS;
+  char outputPath[MAX_LINE];
+  char goldenPath[MAX_LINE];
+
+  test_time_t baseline[MAX_BASELINE];
+  int numBaseline = writeBaseline ? 0 : readBaseline(BASELINE_PATH, baseline);
+  test_time_t times[MAX_BASELINE];
+
+  mkdir(OUTPUT_DIR, 0755);
+
+  printf("%dx%d, best of %d runs, max error %d, mean error %g\n",
+         TEST_WIDTH, TEST_HEIGHT, numRuns, maxError, meanError);
+  printf("%-20s %-6s %14s %20s %9s", "case", "result", "max r/g/b",
+         "mean r/g/b", "render_s");
+  printf(numBaseline > 0 ? " %9s\n" : "\n", "baseline");
+
+  int numFailed = 0;
+  double totalSeconds = 0;
+  double totalBaseline = 0;
+
+  for (int i = 0; i < numCases; i++) {
+    const test_case_t *test = &cases[i];
+    snprintf(outputPath, sizeof(outputPath), OUTPUT_DIR "/%s.ppm",
+             test->name);
+    snprintf(goldenPath, sizeof(goldenPath), GOLDEN_DIR "/%s.ppm",
+             test->golden);
+
+    double best = INFINITY;
+    for (int run = 0; run < numRuns && best >= 0; run++) {
+      double seconds = renderCase(test, outputPath);
+      if (seconds < best) {
+        best = seconds;
+      }
+    }
+    if (best < 0) {
+      printf("%-20s %-6s\n", test->name, "FAIL");
+      numFailed++;
+      continue;
+    }
+    snprintf(times[i].name, sizeof(times[i].name), "%s", test->name);
+    times[i].renderSeconds = best;
+
+    ppm_t output;
+    if (loadImage(outputPath, &output) != 0) {
+      fprintf(stderr, "Error: Unable to read '%s'\n", outputPath);
+      printf("%-20s %-6s\n", test->name, "FAIL");
+      numFailed++;
+      continue;
+    }
+
+    // The first case naming a golden writes it, the rest are checked
+    // against it so the update still catches engines that disagree
+    if (writeGolden && strcmp(test->name, test->golden) == 0) {
+      FILE *file = fopen(goldenPath, "wb");
+      if (file == NULL || writePPM(&output, file, 6) != 0 ||
+          fclose(file) != 0) {
+        fprintf(stderr, "Error: Unable to write '%s'\n", goldenPath);
+        freePPM(&output);
+        return 1;
+      }
+    }
+
+    ppm_t golden;
+    if (loadImage(goldenPath, &golden) != 0) {
+      fprintf(stderr, "Error: Unable to read '%s', make test-golden "
+                      "writes it\n", goldenPath);
+      printf("%-20s %-6s\n", test->name, "FAIL");
+      freePPM(&output);
+      numFailed++;
+      continue;
+    }
+
+    int passed = golden.width == output.width &&
+                 golden.height == output.height;
+    image_diff_t diff;
+    memset(&diff, 0, sizeof(diff));
+    if (passed) {
+      diffImages(&output, &golden, &diff);
+      for (int c = 0; c < 3; c++) {
+        if (diff.maxError[c] > maxError || diff.meanError[c] > meanError) {
+          passed = 0;
+        }
+      }
+    }
+    else {
+      fprintf(stderr, "Error: '%s' is %dx%d, the golden is %dx%d\n",
+              outputPath, output.width, output.height, golden.width,
+              golden.height);
+    }
+    freePPM(&output);
+    freePPM(&golden);
+
+    char maxText[MAX_LINE];
+    char meanText[MAX_LINE];
+    snprintf(maxText, sizeof(maxText), "%d/%d/%d", diff.maxError[0],
+             diff.maxError[1], diff.maxError[2]);
+    snprintf(meanText, sizeof(meanText), "%.3f/%.3f/%.3f",
+             diff.meanError[0], diff.meanError[1], diff.meanError[2]);
+    printf("%-20s %-6s %14s %20s %9.4f", test->name, passed ? "ok" : "FAIL",
+           maxText, meanText, best);
+
+    // Single renders this small are noisy, so only the total is checked
+    double recorded = baselineTime(baseline, numBaseline, test->name);
+    if (recorded >= 0) {
+      printf(" %9.4f\n", recorded);
+      totalSeconds += best;
+      totalBaseline += recorded;
+    }
+    else {
+      printf(numBaseline > 0 ? " %9s\n" : "\n", "-");
+    }
+
+    if (!passed) {
+      numFailed++;
+    }
+  }
+
+  // The mapped loader must agree with readPPM on both formats
+  int numMapped = sizeof(mappedImages) / sizeof(mappedImages[0]);
+  for (int i = 0; i < numMapped && !writeGolden; i++) {
+    int passed = checkMapped(mappedImages[i][1]);
+    printf("%-20s %-6s\n", mappedImages[i][0], passed ? "ok" : "FAIL");
+    numFailed += !passed;
+  }
+  if (!writeGolden) {
+    int passed = checkMappedRange();
+    printf("%-20s %-6s\n", "map_range", passed ? "ok" : "FAIL");
+    numFailed += !passed;
+  }
+
+  if (writeBaseline && numFailed == 0) {
+    FILE *file = fopen(BASELINE_PATH, "w");
+    if (file == NULL) {
+      fprintf(stderr, "Error: Unable to open '" BASELINE_PATH "' for "
+                      "writing\n");
+      return 1;
+    }
+    fprintf(file, "case,render_s\n");
+    for (int i = 0; i < numCases; i++) {
+      fprintf(file, "%s,%.6f\n", times[i].name, times[i].renderSeconds);
+    }
+    if (fclose(file) != 0) {
+      fprintf(stderr, "Error: Unable to write '" BASELINE_PATH "'\n");
+      return 1;
+    }
+    printf("Render times recorded in " BASELINE_PATH "\n");
+  }
+  else if (totalBaseline > 0) {
+    double slowdown = (totalSeconds / totalBaseline - 1) * 100;
+    int slow = slowdown > maxSlowdown;
+    printf("Total render %.4f s against %.4f s recorded, %+.1f%% (limit "
+           "%+.1f%%) %s\n", totalSeconds, totalBaseline, slowdown,
+           maxSlowdown, slow ? "FAIL" : "ok");
+    if (slow) {
+      numFailed++;
+    }
+  }
+  else if (!writeGolden) {
+    printf("No render times recorded, make test-baseline records them\n");
+  }
+
+  printf("%d of %d checks failed\n", numFailed,
+         numCases + (writeGolden ? 0 : numMapped + 1) +
+         (totalBaseline > 0 ? 1 : 0));
+
+  return numFailed > 0 ? 1 : 0;
+}
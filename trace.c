@@ -0,0 +1,90 @@
+// Include header file
+#include "trace.h"
+
+
+double traceNow(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+int traceInit(trace_t *trace, int numWorkers, arena_t *arena) {
+  trace->numRings = numWorkers + 1;
+  trace->rings = arenaAlloc(arena, sizeof(trace_ring_t) * trace->numRings);
+  if (trace->rings == NULL) return ARENA_ALLOC_ERROR;
+  for (int i = 0; i < trace->numRings; i++) {
+    trace->rings[i].spans = arenaAlloc(arena, sizeof(trace_span_t) *
+                                              TRACE_RING_CAPACITY);
+    if (trace->rings[i].spans == NULL) return ARENA_ALLOC_ERROR;
+    trace->rings[i].count = 0;
+  }
+  trace->origin = traceNow();
+  return 0;
+}
+
+
+void traceSpan(trace_ring_t *ring, const char *name, double start, int x,
+               int y) {
+
+  if (ring == NULL) {
+    return;
+  }
+
+  trace_span_t *span = &ring->spans[ring->count & (TRACE_RING_CAPACITY - 1)];
+  span->name = name;
+  span->start = start;
+  span->end = traceNow();
+  span->x = x;
+  span->y = y;
+  ring->count++;
+}
+
+
+int traceWrite(trace_t *trace, const char *path) {
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return 1;
+  }
+
+  // Name each thread's track, then its spans oldest first
+  fprintf(file, "{\"traceEvents\":[\n");
+  for (int i = 0; i < trace->numRings; i++) {
+    fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                  "\"tid\":%d,\"args\":{\"name\":", i > 0 ? ",\n" : "", i);
+    if (i == 0) {
+      fprintf(file, "\"main\"}}");
+    }
+    else {
+      fprintf(file, "\"worker %d\"}}", i - 1);
+    }
+  }
+
+  long dropped = 0;
+  for (int i = 0; i < trace->numRings; i++) {
+    trace_ring_t *ring = &trace->rings[i];
+    long first = 0;
+    if (ring->count > TRACE_RING_CAPACITY) {
+      first = ring->count - TRACE_RING_CAPACITY;
+      dropped += first;
+    }
+
+    for (long j = first; j < ring->count; j++) {
+      trace_span_t *span = &ring->spans[j & (TRACE_RING_CAPACITY - 1)];
+      fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f", span->name, i,
+              (span->start - trace->origin) * 1e6,
+              (span->end - span->start) * 1e6);
+      if (span->x != TRACE_NO_ARG) {
+        fprintf(file, ",\"args\":{\"x\":%d,\"y\":%d}", span->x, span->y);
+      }
+      fprintf(file, "}");
+    }
+  }
+
+  fprintf(file, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":"
+                "{\"droppedSpans\":%ld}}\n", dropped);
+
+  return fclose(file) != 0;
+}
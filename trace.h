@@ -0,0 +1,81 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Include standard libraries
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h> // clock_gettime
+#include "arena.h"
+
+// Numeric constants
+#define TRACE_RING_CAPACITY (1 << 15) // Spans kept per thread, a power of 2
+#define TRACE_NO_ARG -1 // Pixel position that is left out of the file
+
+// Define types to be used in c file
+typedef struct trace_span_t trace_span_t;
+typedef struct trace_ring_t trace_ring_t;
+typedef struct trace_t trace_t;
+
+struct trace_span_t {
+  const char *name; // Static string, never copied
+  double start; // CLOCK_MONOTONIC seconds
+  double end;
+  int x; // Top left pixel of a tile or band, TRACE_NO_ARG when unused
+  int y;
+};
+
+struct trace_ring_t { // Written by one thread only, read once it is done
+  trace_span_t *spans;
+  long count; // Spans ever added, the oldest are overwritten past capacity
+};
+
+struct trace_t { // Timeline of one run, ring 0 for the main thread
+  trace_ring_t *rings;
+  int numRings;
+  double origin; // Time that becomes 0 in the file
+};
+
+
+/**
+ * Get the current CLOCK_MONOTONIC time in seconds. The renderer and the
+ * benchmarks time everything with it, so spans and phases agree.
+ *
+ * @return  seconds since an arbitrary starting point
+ */
+double traceNow(void);
+
+/**
+ * Set up a trace with one ring for the main thread and one per worker.
+ *
+ * @param  trace       trace to initialize
+ * @param  numWorkers  number of render threads
+ * @param  arena       arena the rings are allocated from
+ * @return             0 on success, ARENA_ALLOC_ERROR when the arena ran out
+ */
+int traceInit(trace_t *trace, int numWorkers, arena_t *arena);
+
+/**
+ * Add a span ending now to a ring. Only the thread that owns the ring may
+ * call this, so no lock is taken; once the ring is full the oldest span
+ * is overwritten.
+ *
+ * @param  ring   ring of the calling thread, or NULL to do nothing
+ * @param  name   name of the span, a string that outlives the trace
+ * @param  start  time the span started, from traceNow
+ * @param  x      left pixel of the tile or band, or TRACE_NO_ARG
+ * @param  y      top pixel of the tile or band, or TRACE_NO_ARG
+ */
+void traceSpan(trace_ring_t *ring, const char *name, double start, int x,
+               int y);
+
+/**
+ * Write every ring as Chrome trace event JSON, which chrome://tracing and
+ * Perfetto can open. Must only be called once every thread is done.
+ *
+ * @param  trace  trace to write
+ * @param  path   file to write
+ * @return        0 on success, 1 if the file could not be written
+ */
+int traceWrite(trace_t *trace, const char *path);
+
+#endif  // TRACE_H
@@ -3,38 +3,72 @@
 
 // Include standard libraries
 #include <stdlib.h>
-#include <math.h>
+#include <tgmath.h> // sqrt, pow and the rest take the width of real_t
+
+// Scalar of every position, direction, color and t value. Building with
+// make PRECISION=float defines RAYCAST_FLOAT and halves the size of the
+// scene and of each ray, and doubles the lanes of each SIMD vector
+#ifdef RAYCAST_FLOAT
+typedef float real_t;
+#define REAL_NAME "float"
+#else
+typedef double real_t;
+#define REAL_NAME "double"
+#endif
 
 // Define types to be used in c file
-typedef double* vector3_t;
+typedef struct vec3_t vec3_t;
+
+struct vec3_t {
+  real_t x, y, z;
+};
 
 
+/**
+ * Create a new value vector.
+ * 
+ * @param  x  x value of vector
+ * @param  y  y value of vector
+ * @param  z  z value of vector
+ * @return    vector with the given components
+ */
+static inline vec3_t vec3_make(real_t x, real_t y, real_t z) {
+  vec3_t c = { x, y, z };
+  return c;
+}
+
 /**
  * Add two vectors element-wise.
  * 
- * @param c  output vector
- * @param a  first input vector
- * @param b  second input vector
+ * @param  a  first input vector
+ * @param  b  second input vector
+ * @return    sum of the vectors
  */
-void vector3_add(vector3_t c, vector3_t a, vector3_t b);
+static inline vec3_t vec3_add(vec3_t a, vec3_t b) {
+  return vec3_make(a.x + b.x, a.y + b.y, a.z + b.z);
+}
 
 /**
  * Subtract two vectors element-wise.
  * 
- * @param c  output vector
- * @param a  input vector to subtract from
- * @param b  input vector to use for subtraction
+ * @param  a  input vector to subtract from
+ * @param  b  input vector to use for subtraction
+ * @return    difference of the vectors
  */
-void vector3_sub(vector3_t c, vector3_t a, vector3_t b);
+static inline vec3_t vec3_sub(vec3_t a, vec3_t b) {
+  return vec3_make(a.x - b.x, a.y - b.y, a.z - b.z);
+}
 
 /**
  * Scale a vector.
  * 
- * @param c  output vector
- * @param a  vector to scale
- * @param b  scalar value
+ * @param  a  vector to scale
+ * @param  b  scalar value
+ * @return    scaled vector
  */
-void vector3_scale(vector3_t c, vector3_t a, double b);
+static inline vec3_t vec3_scale(vec3_t a, real_t b) {
+  return vec3_make(a.x * b, a.y * b, a.z * b);
+}
 
 /**
  * Dot product two vectors.
@@ -43,16 +77,22 @@ void vector3_scale(vector3_t c, vector3_t a, double b);
  * @param  b  second input vector
  * @return    result of dot product
  */
-double vector3_dot(vector3_t a, vector3_t b);
+static inline real_t vec3_dot(vec3_t a, vec3_t b) {
+  return a.x*b.x + a.y*b.y + a.z*b.z;
+}
 
 /**
  * Cross product two vectors.
  * 
- * @param c  output vector
- * @param a  first input vector
- * @param b  second input vector
+ * @param  a  first input vector
+ * @param  b  second input vector
+ * @return    result of cross product
  */
-void vector3_cross(vector3_t c, vector3_t a, vector3_t b);
+static inline vec3_t vec3_cross(vec3_t a, vec3_t b) {
+  return vec3_make(a.y*b.z - a.z*b.y,
+                   a.z*b.x - a.x*b.z,
+                   a.x*b.y - a.y*b.x);
+}
 
 /**
  * Get the magnitude of a vector
@@ -60,31 +100,18 @@ void vector3_cross(vector3_t c, vector3_t a, vector3_t b);
  * @param  a  input vector
  * @return    magnitude of vector
  */
-double vector3_mag(vector3_t a);
-
-/**
- * Copy the values of a vector to another
- * 
- * @param  c  output vector to copy in to
- * @param  a  input vector to copy
- */
-void vector3_copy(vector3_t c, vector3_t a);
+static inline real_t vec3_mag(vec3_t a) {
+  return sqrt(a.x*a.x + a.y*a.y + a.z*a.z);
+}
 
 /**
  * Normalize the vector in to a unit vector
  * 
  * @param  a  input vector to normalize
+ * @return    unit vector in the direction of a
  */
-void vector3_normalize(vector3_t a);
-
-/**
- * Create a new vector.
- * 
- * @param  a  x value of vector
- * @param  b  y value of vector
- * @param  c  z value of vector
- * @return    newly created vector
- */
-vector3_t vector3_create(double a, double b, double c);
+static inline vec3_t vec3_normalize(vec3_t a) {
+  return vec3_scale(a, 1 / vec3_mag(a));
+}
 
 #endif  // VECTOR_H